@@ -89,9 +89,50 @@ int main(int argc, char* argv[]){ // for UECda
 #ifndef MATCH
         // プレー設定 大会版ビルドでは定数として埋め込む
         else if(!strcmp(argv[c], "-th")){ // num of threads
-            int NThreads = atoi(argv[c + 1]);
+            int NThreads = max(1, atoi(argv[c + 1]));
+            Settings::NThreads = NThreads;
             Settings::NPlayThreads = NThreads;
             Settings::NChangeThreads = max(1, NThreads / 2);
+        }else if(!strcmp(argv[c], "-nw")){ // num of worlds in the pool
+            Settings::NWorlds = max(1, atoi(argv[c + 1]));
+        }else if(!strcmp(argv[c], "-dth")){ // num of threads dedicated to world creation
+            Settings::NDealerThreads = max(0, atoi(argv[c + 1]));
+        }else if(!strcmp(argv[c], "-np")){ // num of particles in estimation
+            Settings::NParticles = max(1, atoi(argv[c + 1]));
+        }else if(!strcmp(argv[c], "-bl")){ // length of move buffer per thread
+            Settings::threadBufferLength = max(1024, atoi(argv[c + 1]));
+        }else if(!strcmp(argv[c], "-l2b")){ // L2 book size (entries)
+            Settings::L2BookSize = max(4, atoi(argv[c + 1]));
+        }else if(!strcmp(argv[c], "-tl")){ // time limit of a match (sec)
+            Settings::timeLimitedSearch = true;
+            Settings::matchTimeLimitMicS = (uint64_t)(atof(argv[c + 1]) * 1000 * 1000);
+        }else if(!strcmp(argv[c], "-ng")){ // num of games in a match
+            Settings::NGamesPerMatch = atoi(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-pd")){ // pondering
+            Settings::pondering = true;
+        }else if(!strcmp(argv[c], "-nopd")){ // no pondering
+            Settings::pondering = false;
+        }else if(!strcmp(argv[c], "-cw")){ // carry worlds over turns
+            Settings::carryWorlds = true;
+        }else if(!strcmp(argv[c], "-nocw")){ // rebuild worlds every decision
+            Settings::carryWorlds = false;
+        }else if(!strcmp(argv[c], "-is")){ // keep all rejection candidates as weighted worlds
+            Settings::importanceSampling = true;
+        }else if(!strcmp(argv[c], "-nois")){ // pick one rejection candidate per world
+            Settings::importanceSampling = false;
+        }else if(!strcmp(argv[c], "-lc")){ // cache play likelihood terms
+            Settings::playLikelihoodCache = true;
+        }else if(!strcmp(argv[c], "-nolc")){ // recompute play likelihood every time
+            Settings::playLikelihoodCache = false;
+        }else if(!strcmp(argv[c], "-ex")){ // enumerate all deals in small endgames
+            Settings::exactEndgameEstimation = true;
+            Settings::exactDealMaxPatterns = max(1, atoi(argv[c + 1]));
+        }else if(!strcmp(argv[c], "-noex")){ // always sample deals
+            Settings::exactEndgameEstimation = false;
+        }else if(!strcmp(argv[c], "-crn")){ // common random numbers in playouts
+            Settings::commonRandomNumbers = true;
+        }else if(!strcmp(argv[c], "-nocrn")){ // independent random numbers in playouts
+            Settings::commonRandomNumbers = false;
         }else if(!strcmp(argv[c], "-pm")){ // play modeling
             Settings::simulationPlayModel = true;
         }else if(!strcmp(argv[c], "-npm")){ // no play modeling
@@ -120,6 +161,33 @@ int main(int argc, char* argv[]){ // for UECda
             Settings::MateSearchInSimulation = true;
         }else if(!strcmp(argv[c], "-nomates")){ // no Mate search in simulations
             Settings::MateSearchInSimulation = false;
+        }else if(!strcmp(argv[c], "-tp")){ // truncated playouts (plies before truncation)
+            Settings::truncatedPlayout = true;
+            Settings::truncationPlies = max(0, atoi(argv[c + 1]));
+        }else if(!strcmp(argv[c], "-notp")){ // playouts to the game end
+            Settings::truncatedPlayout = false;
+        }else if(!strcmp(argv[c], "-bp")){ // batched playouts
+            Settings::batchPlayout = true;
+        }else if(!strcmp(argv[c], "-nobp")){ // one playout at a time
+            Settings::batchPlayout = false;
+        }else if(!strcmp(argv[c], "-als")){ // adaptive leaf search budget (share of search time)
+            Settings::adaptiveLeafSearch = true;
+            Settings::leafSearchTimeShare = atof(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-noals")){ // fixed leaf search budget
+            Settings::adaptiveLeafSearch = false;
+        }else if(!strcmp(argv[c], "-l2n")){ // node limit of L2 search in playouts
+            Settings::leafL2NodeLimit = max(1, atoi(argv[c + 1]));
+        }else if(!strcmp(argv[c], "-oc")){ // playout outcome cache (max remaining cards)
+            Settings::playoutOutcomeCache = true;
+            Settings::outcomeCacheMaxCards = max(0, atoi(argv[c + 1]));
+        }else if(!strcmp(argv[c], "-ocr")){ // rate of reusing sampled outcomes in playout outcome cache
+            Settings::outcomeCacheReuseRate = max(0.0, min(1.0, atof(argv[c + 1])));
+        }else if(!strcmp(argv[c], "-nooc")){ // no playout outcome cache
+            Settings::playoutOutcomeCache = false;
+        }else if(!strcmp(argv[c], "-srs")){ // merge suit-symmetric root candidates
+            Settings::rootSymmetryReduction = true;
+        }else if(!strcmp(argv[c], "-nosrs")){ // no merging of root candidates
+            Settings::rootSymmetryReduction = false;
         }else if(!strcmp(argv[c], "-ss")){ // selector in simulation
             std::string selectorName = std::string(argv[c + 1]);
             if(!strcmp(argv[c + 1], "e")){ // exp
@@ -133,6 +201,18 @@ int main(int argc, char* argv[]){ // for UECda
             }else{
                 cerr << " : unknown selector [" << std::string(std::string()) << "] : default selector will be used." << endl;
             }
+        }else if(!strcmp(argv[c], "-ra")){ // root allocator in monte carlo
+            if(!strcmp(argv[c + 1], "ucb")){ // UCB-root
+                Settings::rootAllocator = RootAllocatorType::UCB_ROOT;
+            }else if(!strcmp(argv[c + 1], "sh")){ // sequential halving
+                Settings::rootAllocator = RootAllocatorType::SEQUENTIAL_HALVING;
+            }else if(!strcmp(argv[c + 1], "sr")){ // successive rejects
+                Settings::rootAllocator = RootAllocatorType::SUCCESSIVE_REJECTS;
+            }else if(!strcmp(argv[c + 1], "pw")){ // progressive widening with policy priors
+                Settings::rootAllocator = RootAllocatorType::PROGRESSIVE_WIDENING;
+            }else{
+                cerr << " : unknown root allocator [" << std::string(argv[c + 1]) << "] : default allocator will be used." << endl;
+            }
         }else if(!strcmp(argv[c], "-dt")){ // deal type in estimation
             std::string dealTypeName = std::string(argv[c + 1]);
             if(!strcmp(argv[c + 1], "re")){ // rejection
@@ -143,6 +223,8 @@ int main(int argc, char* argv[]){ // for UECda
                 Settings::monteCarloDealType = DealType::SBJINFO;
             }else if(!strcmp(argv[c + 1], "rn")){ // random
                 Settings::monteCarloDealType = DealType::RANDOM;
+            }else if(!strcmp(argv[c + 1], "p")){ // particle filter
+                Settings::monteCarloDealType = DealType::PARTICLE;
             }else{
                 cerr << " : unknown deal type [" << std::string(std::string()) << "] : default deal type will be used." << endl;
             }
@@ -475,6 +557,10 @@ int main(int argc, char* argv[]){ // for UECda
             receiveCards(recv_table);
             tmpTime = clms.stop();
             
+            if(!myTurn){
+                client.endWaiting();
+            }
+            
             // サーバーが受理した役(場に出ている役)
             
             //cerr << toString(recv_table) << endl;
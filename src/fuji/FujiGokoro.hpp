@@ -31,6 +31,9 @@
 // 必勝判定
 #include "logic/mate.hpp"
 
+// スートの対称性
+#include "logic/suitSymmetry.hpp"
+
 // 末端探索
 #include "search/l2Judge.hpp"
 
@@ -64,6 +67,8 @@
 
 // モンテカルロ
 #include "montecarlo/monteCarlo.hpp"
+#include "montecarlo/monteCarloPool.hpp"
+#include "montecarlo/ponder.hpp"
 
 // 相手の行動解析
 #include "model/playerAnalysis.hpp"
@@ -76,11 +81,309 @@ namespace UECda{
         private:
             using dice64_t = XorShift64;
             
-            ThreadTools threadTools[N_THREADS];
+            std::vector<ThreadTools> threadTools; // 試合開始時に Settings::NThreads 個用意する
             SharedData shared;
+#ifndef POLICY_ONLY
+            // モンテカルロ用常駐スレッド
+            MonteCarloWorkerPool mcPool;
+            RootAllocatorStatistics allocatorStats;
+            
+            // 相手の手番中の先読み
+            PlayouterField ponderField;
+            std::atomic<bool> ponderStop;
+            bool pondering = false;
+            
+            // 先読みで予測した次の自分の着手決定
+            // 間の相手が全員パスして自分の手番が来た局面を予測し、その局面をルートとしてプレイアウトしておく
+            // 実際の着手決定の局面が予測と同じであれば、その結果をルートの統計に加える
+            struct PonderPrediction{
+                int gameNum, plays; // 試合番号と、その局面までの棋譜の着手数
+                uint32_t bd, ps;
+                Cards myCards, opsCards;
+                
+                bool operator ==(const PonderPrediction& rhs)const{
+                    return gameNum == rhs.gameNum && plays == rhs.plays
+                    && bd == rhs.bd && ps == rhs.ps
+                    && myCards == rhs.myCards && opsCards == rhs.opsCards;
+                }
+            };
+            // 前回全て列挙した配り方
+            // 世界プールの世界の順番は列挙したときのまま(パスでは世界を動かさない)なので、事前の重みは番号で対応させる
+            struct EnumeratedDeals{
+                int gameNum = -1, plays = -1; // 試合番号と、列挙したときの棋譜の着手数
+                Cards remCards = CARDS_NULL;
+                int worlds = 0; // 列挙した世界数(0 なら無効)
+                std::vector<double> logPrior;
+            };
+            EnumeratedDeals enumeration;
+            
+            PlayouterField ponderRootField; // 予測した局面
+            RootInfo ponderRoot;
+            PonderPrediction ponderPrediction;
+            bool ponderPredicted = false; // ponderRoot が ponderPrediction の局面の結果か
+            
+            void runMonteCarlo(RootInfo *const proot, const PlayouterField *const pfield, int threads){
+                threads = max(1, min(threads, mcPool.size()));
+                if(Settings::commonRandomNumbers)proot->setCommonRandomNumbers(shared.gal.size(), mainDice().rand());
+                mcPool.run([this, proot, pfield, threads](int ith)->void{
+                    MonteCarloThread<RootInfo, PlayouterField, SharedData, ThreadTools>
+                    (ith, threads, proot, pfield, &shared, &threadTools[ith]);
+                }, threads);
+                int unvisited = 0;
+                const int candidates = proot->candidates;
+                if(Settings::rootAllocator == RootAllocatorType::PROGRESSIVE_WIDENING){
+                    // 方策の確率が低く対象にならなかった候補は選ばない
+                    unvisited = proot->pruneUnvisited();
+                }else{
+                    // 候補を絞る方式で除いた候補は選ばない
+                    unvisited = proot->pruneEliminated();
+                }
+                allocatorStats.feed(proot->simulationsToDecision(), proot->allSimulations, candidates, unvisited);
+#ifdef MONITOR
+                WorldPipelineStatistics pipelineStats;
+                for(int th = 0; th < threads; ++th){
+                    pipelineStats += threadTools[th].pipelineStats;
+                }
+                cerr << pipelineStats.toString() << endl;
+                if(Settings::playoutOutcomeCache){
+                    PlayoutOutcomeStatistics outcomeStats;
+                    for(int th = 0; th < threads; ++th){
+                        outcomeStats += threadTools[th].outcomeCache.statistics();
+                    }
+                    cerr << outcomeStats.toString() << endl;
+                }
+#endif
+            }
+            void reweightWorlds(const PlayouterField *const pfield, int threads){
+                // 前のターンから持ち越した世界をその後の棋譜で評価し直し、
+                // 尤もらしくなくなった世界を消す(空いた分はモンテカルロ中に新しく作る)
+                // 新しい世界は採択棄却法で温度 REJECTION_TEMPERATURE の softmax により選ばれるので、
+                // 持ち越した世界も同じ温度で、対数尤度の変化 delta について exp(delta / T) に比例して残す
+                // 重点サンプリングの重み付きの世界は消さずに、重みに exp(delta / T) を掛ける
+                if(shared.gal.actives <= 0)return;
+                threads = max(1, min(threads, mcPool.size()));
+                std::vector<double> delta(shared.gal.size(), DBL_MAX);
+                mcPool.run([this, pfield, threads, &delta](int ith)->void{
+                    ReweightThread(ith, threads, pfield, &shared, &threadTools[ith], delta.data());
+                }, threads);
+                double maxDelta = -DBL_MAX;
+                for(double d : delta){
+                    if(d != DBL_MAX)maxDelta = max(maxDelta, d); // DBL_MAX は評価し直さなかった世界
+                }
+                if(maxDelta == -DBL_MAX)return;
+                const double temperature = RandomDealer<N_PLAYERS>::REJECTION_TEMPERATURE;
+                if(Settings::importanceSampling && Settings::monteCarloDealType == DealType::REJECTION){
+                    // 重みを更新し、評価し直した世界の重みの平均を元に戻す
+                    double oldSum = 0, newSum = 0;
+                    for(int w = 0; w < shared.gal.actives; ++w){
+                        if(delta[w] == DBL_MAX)continue;
+                        ImaginaryWorld *const pw = shared.gal.access(w);
+                        oldSum += pw->weight;
+                        pw->weight *= exp((delta[w] - maxDelta) / temperature);
+                        newSum += pw->weight;
+                    }
+                    if(newSum <= 0)return;
+                    for(int w = 0; w < shared.gal.actives; ++w){
+                        if(delta[w] != DBL_MAX)shared.gal.access(w)->weight *= oldSum / newSum;
+                    }
+                    return;
+                }
+                auto& dice = mainDice();
+                shared.gal.sieve([&](int w, const ImaginaryWorld& world)->bool{
+                    if(delta[w] >= maxDelta)return true;
+                    return dice.drand() < exp((delta[w] - maxDelta) / temperature);
+                });
+            }
+            void updateParticles(const PlayouterField *const pfield, int threads){
+                // 粒子フィルタを現在の棋譜まで進め、必要なら復元抽出と若返りを行う
+                auto& particles = shared.particles;
+                ClockMicS clms;
+                clms.start();
+                threads = max(1, min(threads, mcPool.size()));
+                const int turn = shared.gameLog.plays();
+                // 粒子が無い、または全て矛盾した場合は配り直す
+                const bool redeal = !particles.ready();
+                const int fromTurn = redeal ? 0 : particles.getProcessedTurn();
+                std::vector<ParticleFilterStatistics> stats(threads);
+                mcPool.run([this, pfield, threads, redeal, fromTurn, &stats](int ith)->void{
+                    ParticleThread(ith, threads, redeal, fromTurn, pfield, &shared, &threadTools[ith], &stats[ith]);
+                }, threads);
+                if(particles.resample(&mainDice())){
+                    mcPool.run([this, pfield, threads, &stats](int ith)->void{
+                        RejuvenationThread(ith, threads, pfield, &shared, &threadTools[ith], &stats[ith]);
+                    }, threads);
+                }
+                auto& total = particles.statistics();
+                for(const auto& s : stats)total += s;
+                if(redeal)total.deals += 1;
+                particles.finish(turn);
+                total.updateTime += clms.stop();
+            }
+            bool enumerateWorlds(const PlayouterField *const pfield, const RootInfo& root, int threads){
+                // 相手の特定されていないカードの配り方が少なければ全て列挙し、
+                // 棋譜の尤度と交換から決まる事前の重みを付けた世界で世界プールを置き換える
+                // 前回列挙してから配り方の集合が変わっていなければ(間の着手がパスだけ)列挙し直さず、
+                // 棋譜も変わっていなければ重みもそのまま使う
+                // 尤度の計算はスレッドで分担し、探索の期限を過ぎたら列挙をやめてサンプリングに戻す
+                auto& gal = shared.gal;
+                RandomDealer<N_PLAYERS> estimator;
+                estimator.set(*pfield, shared);
+                const double patterns = estimator.countDealPatterns();
+                if(patterns > min(Settings::exactDealMaxPatterns, gal.size()))return false;
+                
+                const int plays = shared.gameLog.plays();
+                const bool sameDeals = enumeration.gameNum == field.getGameNum()
+                && enumeration.remCards == pfield->getRemCards()
+                && enumeration.worlds > 0 && enumeration.worlds == gal.actives;
+                if(sameDeals && enumeration.plays == plays && gal.weighted)return true;
+                
+                if(!sameDeals){
+                    clearWorlds();
+                    enumeration.logPrior.clear();
+                    estimator.iterateAllDeals([&](Cards *const c, double logPrior)->void{
+                        ImaginaryWorld *const pw = gal.searchSpace();
+                        if(pw == nullptr)return;
+                        pw->set(*pfield, c);
+                        gal.regist(pw);
+                        enumeration.logPrior.push_back(logPrior);
+                    });
+                }
+                enumeration.worlds = 0;
+                if(gal.actives <= 0)return false;
+                
+                threads = max(1, min(threads, mcPool.size()));
+                const std::chrono::steady_clock::time_point *const pdeadline = root.timeLimited ? &root.deadline : nullptr;
+                std::atomic<bool> expired(false);
+                mcPool.run([this, pfield, threads, pdeadline, &expired](int ith)->void{
+                    EnumerationThread(ith, threads, pfield, &shared, &threadTools[ith],
+                                      enumeration.logPrior.data(), pdeadline, &expired);
+                }, threads);
+                if(expired){
+                    CERR << "exact deals expired " << gal.actives << " / " << patterns << endl;
+                    clearWorlds();
+                    return false;
+                }
+                double maxLogWeight = -DBL_MAX;
+                for(int w = 0; w < gal.actives; ++w){
+                    maxLogWeight = max(maxLogWeight, gal.access(w)->weight);
+                }
+                for(int w = 0; w < gal.actives; ++w){
+                    ImaginaryWorld *const pw = gal.access(w);
+                    pw->weight = exp(pw->weight - maxLogWeight);
+                }
+                gal.setWeighted();
+                enumeration.gameNum = field.getGameNum();
+                enumeration.plays = plays;
+                enumeration.remCards = pfield->getRemCards();
+                enumeration.worlds = gal.actives;
+                CERR << "exact deals " << gal.actives << " / " << patterns << (sameDeals ? " (reused)" : "") << endl;
+                return true;
+            }
+            void clearWorlds(){
+                shared.gal.clear();
+                enumeration.worlds = 0;
+            }
+            PonderPrediction makePonderPrediction(const PlayouterField& afield, int plays)const{
+                const int myPlayerNum = field.getMyPlayerNum();
+                PonderPrediction prediction;
+                prediction.gameNum = field.getGameNum();
+                prediction.plays = plays;
+                prediction.bd = (uint32_t)afield.bd;
+                prediction.ps = (uint32_t)afield.ps;
+                prediction.myCards = afield.getHand(myPlayerNum).getCards();
+                prediction.opsCards = afield.getOpsHand(myPlayerNum).getCards();
+                return prediction;
+            }
+            bool predictNextDecision(PonderPrediction *const pprediction){
+                // 現在の局面から間の相手が全員パスしたときの自分の手番の局面を ponderRootField に作る
+                // 相手が空場で手番を持つ場合(まずパスしない)や、自分の手番が来ない場合は予測しない
+                // 相手の手札は分からないので、procSlowest ではなく手札を調べずにパスの処理だけを行う
+                const int myPlayerNum = field.getMyPlayerNum();
+                PlayouterField& pf = ponderRootField;
+                setSubjectiveField(field, &pf);
+                int passes = 0;
+                while((int)pf.getTurnPlayer() != myPlayerNum){
+                    if(pf.isNF() || passes >= N_PLAYERS)return false;
+                    const int tp = pf.getTurnPlayer();
+                    if(pf.isSoloAwake()){
+                        pf.flush();
+                    }else{
+                        pf.setPlayerAsleep(tp);
+                        pf.rotateTurnPlayer(tp);
+                        pf.procBoardStateHashPass(tp, pf.getTurnPlayer());
+                    }
+                    pf.addTurnNum();
+                    ++passes;
+                }
+                pf.prepareForPlay(true);
+                *pprediction = makePonderPrediction(pf, shared.gameLog.plays() + passes);
+                return true;
+            }
+            bool setPonderRoot(){
+                // 予測した局面 ponderRootField の着手を候補として先読み用のルートを作る
+                // 着手が1つしかない局面ではモンテカルロを行わないので作らない
+                const int myPlayerNum = field.getMyPlayerNum();
+                const Cards myCards = ponderRootField.getHand(myPlayerNum).getCards();
+                const Cards opsCards = ponderRootField.getOpsHand(myPlayerNum).getCards();
+                const Board bd = ponderRootField.getBoard();
+                MoveInfo mv[N_MAX_MOVES + 256];
+                int NMoves = genMove(mv, myCards, bd);
+                if(NMoves <= 1)return false;
+                if(bd.isNF())NMoves += genNullPass(mv + NMoves);
+                if(containsJOKER(myCards) && containsS3(opsCards) && bd.isGroup()){
+                    NMoves += genJokerGroup(mv + NMoves, myCards, opsCards, bd);
+                }
+                ponderRoot.init();
+                ponderRoot.setPlay(mv, NMoves, field, shared, calcLimitSimulations(NMoves, false));
+                // 方策の確率は一様にしておく(ルートの統計に加えるのはモンテカルロの結果だけ)
+                double score[N_MAX_MOVES + 256];
+                for(int m = 0; m < NMoves; ++m)score[m] = 0;
+                ponderRoot.feedPolicyScore(score, NMoves);
+                return true;
+            }
+            void addPonderStatistics(RootInfo *const proot, const PlayouterField& tfield){
+                // 先読みで予測した局面と同じであれば、先読みのプレイアウト結果を加える
+                if(!ponderPredicted)return;
+                ponderPredicted = false; // 使うのは1回だけ
+                if(!(makePonderPrediction(tfield, shared.gameLog.plays()) == ponderPrediction)){
+                    CERR << "ponder prediction missed" << endl;
+                    return;
+                }
+                const int added = proot->addStatistics(ponderRoot);
+                CERR << "ponder statistics : " << ponderRoot.allSimulations << " trials on " << added << " candidates" << endl;
+            }
+            void stopPondering(){
+                if(pondering){
+                    ponderStop = true;
+                    ponderRoot.exitFlag = true;
+                    mcPool.wait();
+                    pondering = false;
+                }
+            }
+#endif
             
             // 0番スレッドのサイコロをメインサイコロとして使う
-            dice64_t& dice = threadTools[0].dice;
+            dice64_t& mainDice(){ return threadTools[0].dice; }
+            
+            // 現在の決定を始めた時刻(時間制御探索用)
+            std::chrono::steady_clock::time_point decisionStartTime;
+            
+            static int calcLimitSimulations(int candidates, bool isChange){
+                // 候補数からシミュレーション回数の上限を決める
+                return std::min(isChange ? 10000 : 5000, (int)(pow((double)candidates, 0.8) * 700));
+            }
+            
+            void setSearchDeadline(RootInfo *const proot, int myNCards, int candidates, bool isChange){
+#ifndef POLICY_ONLY
+                if(Settings::timeLimitedSearch){
+                    // 持ち時間から今回の探索時間を割り当てる
+                    uint64_t budget = shared.timeManager.calcBudget(shared.timeAnalyzer, field.getGameNum(),
+                                                                    myNCards, candidates, isChange);
+                    proot->setDeadline(decisionStartTime + std::chrono::microseconds(budget));
+                    CERR << "search time budget = " << budget << " us" << endl;
+                }
+#endif
+            }
             
         public:
             using field_t = UECda::Fuji::FujiField;
@@ -98,7 +401,7 @@ namespace UECda{
                 // 乱数系列を初期化
                 XorShift64 tdice;
                 tdice.srand(s);
-                for(int th = 0; th < N_THREADS; ++th){
+                for(int th = 0; th < (int)threadTools.size(); ++th){
                     threadTools[th].dice.srand(tdice.rand() * (th + 111));
                 }
             }
@@ -107,20 +410,45 @@ namespace UECda{
                 // field にプレーヤー番号が入っている状態で呼ばれる
                 shared.setMyPlayerNum(field.getMyPlayerNum());
                 
+                // スレッドごとのデータを設定された数だけ用意する
+                threadTools.resize(max(1, Settings::NThreads));
+                
                 // サイコロ初期化
                 // シード指定の場合はこの後に再設定される
                 setRandomSeed((uint32_t)time(NULL));
                 
                 // スレッドごとのデータ初期化
-                for(int th = 0; th < N_THREADS; ++th){
-                    threadTools[th].init(th);
+                for(int th = 0; th < (int)threadTools.size(); ++th){
+                    threadTools[th].init(th, Settings::threadBufferLength);
+                }
+                
+                // 置換表
+                if(L2::book.size() != (uint64_t)Settings::L2BookSize){
+                    L2::book.resize(Settings::L2BookSize);
                 }
                 
 #ifndef POLICY_ONLY
-                // 世界プール監視員を設定
-                for(int th = 0; th < N_THREADS; ++th){
-                    shared.ga.set(th, &threadTools[th].gal);
+                // 世界プールを確保し、監視員を設定
+                if(shared.gal.size() != Settings::NWorlds){
+                    shared.gal.init(Settings::NWorlds);
+                }
+                if(Settings::monteCarloDealType == DealType::PARTICLE
+                   && shared.particles.size() != Settings::NParticles){
+                    shared.particles.init(Settings::NParticles);
+                }
+                for(auto& tools : threadTools){
+                    tools.worldCache.init(Settings::NWorlds);
+                    if(Settings::playLikelihoodCache
+                       && tools.likelihoodCache.size() != PLAY_LIKELIHOOD_CACHE_SIZE){
+                        tools.likelihoodCache.init(PLAY_LIKELIHOOD_CACHE_SIZE);
+                    }
                 }
+                shared.ga.set(0, &shared.gal);
+                // モンテカルロ用スレッドを立てておく
+                mcPool.init(min((int)threadTools.size(), max(Settings::NPlayThreads, Settings::NChangeThreads)));
+                // 持ち時間管理
+                shared.timeManager.init(Settings::matchTimeLimitMicS, Settings::NGamesPerMatch,
+                                        Settings::minDecisionTimeMicS, Settings::maxDecisionTimeMicS);
 #endif
                 
                 auto& playPolicy = shared.basePlayPolicy;
@@ -146,6 +474,19 @@ namespace UECda{
                     shared.estimationChangePolicy.fin(DIRECTORY_PARAMS_IN + "change_policy_param.dat");
                 }
                 ifs.close();
+                // 打ち切りプレイアウト用の順位予測
+                if(Settings::truncatedPlayout){
+                    ifs.open(DIRECTORY_PARAMS_IN + "static_eval_param.dat");
+                    if(ifs){
+                        shared.staticEvaluator.fin(DIRECTORY_PARAMS_IN + "static_eval_param.dat");
+                    }else{
+                        cerr << "static_eval_param.dat not found : playouts will not be truncated." << endl;
+#ifndef MATCH
+                        Settings::truncatedPlayout = false;
+#endif
+                    }
+                    ifs.close();
+                }
 #endif
                 
                 // 方策の温度
@@ -181,7 +522,19 @@ namespace UECda{
                 
             }
             
-            Cards change(uint32_t change_qty){ // 交換関数
+            Cards change(uint32_t change_qty){
+                // 自分の交換についての変数を更新
+                ClockMicS clms;
+                clms.start();
+                decisionStartTime = std::chrono::steady_clock::now();
+                Cards ret = changeSub(change_qty);
+#ifndef POLICY_ONLY
+                shared.timeAnalyzer.my_change_time_sum += clms.stop();
+                shared.timeAnalyzer.my_changes++;
+#endif
+                return ret;
+            }
+            Cards changeSub(uint32_t change_qty){ // 交換関数
                 assert(change_qty == 1U || change_qty == 2U);
                 
                 RootInfo root;
@@ -276,8 +629,7 @@ namespace UECda{
                 }
                 
                 // ルートノード設定
-                int limitSimulations = std::min(10000, (int)(pow((double)NCands, 0.8) * 700));
-                root.setChange(cand, NCands, field, shared, limitSimulations);
+                root.setChange(cand, NCands, field, shared, calcLimitSimulations(NCands, true));
                 
                 // 方策関数による評価
                 double escore[N_MAX_CHANGES + 1], score[N_MAX_CHANGES];
@@ -292,22 +644,15 @@ namespace UECda{
                 // モンテカルロ法による評価
                 if(changeCards == CARDS_NULL){
                     // 世界プールを整理する
-                    for(int th = 0; th < N_THREADS; ++th)threadTools[th].gal.clear();
+                    clearWorlds();
 #ifdef USE_POLICY_TO_ROOT
                     root.addPolicyScoreToMonteCarloScore();
 #endif
                     PlayouterField tfield;
                     setSubjectiveField(field, &tfield);
+                    setSearchDeadline(&root, countCards(myCards), NCands, true);
                     // モンテカルロ開始
-                    if(Settings::NChangeThreads > 1){
-                        std::vector<std::thread> thr;
-                        for(int ith = 0; ith < Settings::NChangeThreads; ++ith)
-                            thr.emplace_back(std::thread(&MonteCarloThread<RootInfo, PlayouterField, SharedData, ThreadTools>,
-                                                         ith, &root, &tfield, &shared, &threadTools[ith]));
-                        for(auto& th : thr)th.join();
-                    }else{
-                        MonteCarloThread<RootInfo, PlayouterField, SharedData, ThreadTools>(0, &root, &tfield, &shared, &threadTools[0]);
-                    }
+                    runMonteCarlo(&root, &tfield, Settings::NChangeThreads);
                 }
 #endif // POLICY_ONLY
                 root.sort();
@@ -321,7 +666,7 @@ namespace UECda{
                                                    Settings::simulationAmplifyCoef,
                                                    Settings::simulationAmplifyExponent);
                     // rootは着手をソートしているので元の着手生成バッファから選ぶ
-                    changeCards = cand[selector.run_all(dice.drand())];
+                    changeCards = cand[selector.run_all(mainDice().drand())];
                 }
 #endif
                 if(changeCards == CARDS_NULL){
@@ -351,12 +696,21 @@ namespace UECda{
             void prepareForGame(){
 #ifndef POLICY_ONLY
                 field.initWorldPatterns();
+                // 交換の探索で作った世界は交換前のものなので使わない
+                clearWorlds();
+                shared.particles.clear();
+                ponderPredicted = false;
+                // 棋譜が変わるので尤度の項は使えない
+                for(auto& tools : threadTools){
+                    tools.likelihoodCache.clear();
+                }
 #endif
             }
             Move play(){
                 // 自分のプレーについての変数を更新
                 ClockMicS clms;
                 clms.start();
+                decisionStartTime = std::chrono::steady_clock::now();
                 Move ret = playSub();
 #ifndef POLICY_ONLY
                 shared.timeAnalyzer.my_play_time_sum += clms.stop();
@@ -448,7 +802,7 @@ namespace UECda{
                     
                     // 着手多様性確保のため着手をランダムシャッフル
                     for(int i = NMoves; i > 1; --i)
-                        std::swap(mv[dice.rand() % i], mv[i - 1]);
+                        std::swap(mv[mainDice().rand() % i], mv[i - 1]);
                     
                     // 場の情報をまとめる
                     assert(tfield.getTurnPlayer() == myPlayerNum);
@@ -525,8 +879,7 @@ namespace UECda{
                     //getchar();
                     
                     // ルートノード設定
-                    int limitSimulations = std::min(5000, (int)(pow((double)NMoves, 0.8) * 700));
-                    root.setPlay(mv, NMoves, field, shared, limitSimulations);
+                    root.setPlay(mv, NMoves, field, shared, calcLimitSimulations(NMoves, false));
                     
                     // 方策関数による評価(必勝のときも行う, 除外された着手も考慮に入れる)
                     double score[N_MAX_MOVES + 256];
@@ -541,21 +894,49 @@ namespace UECda{
 #ifndef POLICY_ONLY
                     // モンテカルロ法による評価(結果確定のとき以外)
                     if(!fieldInfo.isMate() && !fieldInfo.isGiveUp()){
-                        if(rp_mc == 0) // 最初の場合は世界プールを整理する
-                            for(int th = 0; th < N_THREADS; ++th)threadTools[th].gal.clear();
+                        // スートを入れ替えると移り合う候補は1つだけ調べる
+                        SuitSymmetry symmetry;
+                        if(Settings::rootSymmetryReduction){
+                            // 手札推定は棋譜を再生するので、この試合の着手のスートも変えない置換に限る
+                            uint32_t playedSuits = 0;
+                            for(int t = 0; t < shared.gameLog.plays(); ++t){
+                                const Move m = shared.gameLog.play(t).move();
+                                if(!m.isPASS())playedSuits |= 1U << m.suits();
+                            }
+                            symmetry.init(myCards, opsCards, commonCards(field.getMySentCards(), opsCards), bd, playedSuits);
+                        }
+                        const auto symmetryKey = [&symmetry](const RootAction& a)->uint64_t{
+                            return symmetry.canonicalKey(a.move.mv());
+                        };
+                        if(symmetry.any()){
+                            const int merged = root.mergeEquivalentCandidates(symmetryKey);
+                            CERR << "symmetric candidates " << merged << " / " << root.actions << endl;
+                            // 打ち切り回数と探索時間は残った候補の数で決める
+                            root.limitSimulations = calcLimitSimulations(root.candidates, false);
+                        }
+                        // 先読みで予測した局面であれば、先読み中のプレイアウト結果から始める
+                        // 同一視して除いた候補の結果は加えないよう、候補をまとめた後に行う
+                        if(rp_mc == 0 && Settings::pondering)addPonderStatistics(&root, tfield);
 #ifdef USE_POLICY_TO_ROOT
                         root.addPolicyScoreToMonteCarloScore();
 #endif
-                        // モンテカルロ開始
-                        if(Settings::NPlayThreads > 1){
-                            std::vector<std::thread> thr;
-                            for(int ith = 0; ith < Settings::NPlayThreads; ++ith)
-                                thr.emplace_back(std::thread(&MonteCarloThread<RootInfo, PlayouterField, SharedData, ThreadTools>,
-                                                             ith, &root, &tfield, &shared, &threadTools[ith]));
-                            for(auto& th : thr)th.join();
-                        }else{
-                            MonteCarloThread<RootInfo, PlayouterField, SharedData, ThreadTools>(0, &root, &tfield, &shared, &threadTools[0]);
+                        // 世界の準備にかかる時間も探索時間に含めるので、先に期限を決める
+                        setSearchDeadline(&root, countCards(myCards), root.candidates, false);
+                        // 最初の場合は世界プールを整理する
+                        // 先読みや持ち越しを行っている場合は、それまでに作って生き残った世界を使う
+                        // 配り方が少なければ全て列挙して、サンプリングの代わりに使う
+                        const bool exact = Settings::exactEndgameEstimation
+                        && enumerateWorlds(&tfield, root, Settings::NPlayThreads);
+                        if(!exact){
+                            if(rp_mc == 0 && !Settings::pondering && !Settings::carryWorlds)clearWorlds();
+                            if(rp_mc == 0 && Settings::carryWorlds)reweightWorlds(&tfield, Settings::NPlayThreads);
+                            if(rp_mc == 0 && Settings::monteCarloDealType == DealType::PARTICLE){
+                                updateParticles(&tfield, Settings::NPlayThreads);
+                            }
                         }
+                        // モンテカルロ開始
+                        runMonteCarlo(&root, &tfield, Settings::NPlayThreads);
+                        if(symmetry.any())root.shareEquivalentStatistics(symmetryKey);
                         rp_mc++;
                     }
 #endif
@@ -619,7 +1000,7 @@ namespace UECda{
                                                        Settings::simulationAmplifyCoef,
                                                        Settings::simulationAmplifyExponent);
                         // rootは着手をソートしているので元の着手生成バッファから選ぶ
-                        playMove = mv[selector.run_all(dice.drand())].mv();
+                        playMove = mv[selector.run_all(mainDice().drand())].mv();
                     }
 #endif
                     if(playMove == MOVE_NONE){
@@ -657,6 +1038,15 @@ namespace UECda{
             void afterMyPlay(){
 #ifndef POLICY_ONLY
                 field.procWorldPatterns(field.lastMove.qty());
+                if(Settings::carryWorlds){
+                    // 世界を自分の着手によって進める
+                    if(!field.lastMove.isPASS()){
+                        shared.ga.proceedWorlds(field.lastTurnPlayer, field.lastMove);
+                    }
+                }else if(Settings::pondering){
+                    // 先読みは自分の着手後の局面から作り直す
+                    clearWorlds();
+                }
 #endif
             }
             void afterOthersPlay(){
@@ -666,10 +1056,50 @@ namespace UECda{
                 if(!field.lastMove.isPASS() && field.lastWorldPatterns > 1.0){
                     shared.ga.proceed(field.lastTurnPlayer, field.lastMove, field.getWPCmp());
                 }
+                // 世界を着手によって進め、矛盾する世界を消す
+                if(!field.lastMove.isPASS()){
+                    shared.ga.proceedWorlds(field.lastTurnPlayer, field.lastMove);
+                }
 #endif
             }
             void waitBeforeWon(){
-                
+#ifndef POLICY_ONLY
+                if(Settings::pondering && !pondering){
+                    // 相手の手番中に次の自分の着手決定のための世界を作っておく
+                    setSubjectiveField(field, &ponderField);
+                    // 次の自分の着手決定の局面が予測できれば、その候補のプレイアウトも行う
+                    // 予測が前回と同じ(間の相手がパスした)ときは、それまでの結果に加えていく
+                    RootInfo *proot = nullptr;
+                    const PlayouterField *pfield = &ponderField;
+                    PonderPrediction prediction;
+                    if(predictNextDecision(&prediction)){
+                        if(!ponderPredicted || !(prediction == ponderPrediction)){
+                            ponderPrediction = prediction;
+                            ponderPredicted = setPonderRoot();
+                        }
+                        if(ponderPredicted){
+                            ponderRoot.exitFlag = false;
+                            proot = &ponderRoot;
+                            pfield = &ponderRootField;
+                        }
+                    }else{
+                        ponderPredicted = false;
+                    }
+                    const int threads = max(1, min(Settings::NPlayThreads, mcPool.size()));
+                    ponderStop = false;
+                    pondering = true;
+                    mcPool.start([this, proot, pfield, threads](int ith)->void{
+                        PonderThread(ith, threads, proot, pfield, &shared, &threadTools[ith], &ponderStop);
+                    }, threads);
+                }
+#endif
+            }
+            void endWaiting(){
+                // 他人のプレーの結果を受け取った直後に呼ばれる
+                // 棋譜や局面が更新される前に先読みを止める
+#ifndef POLICY_ONLY
+                stopPondering();
+#endif
             }
             void waitAfterWon(){
                 
@@ -711,12 +1141,41 @@ namespace UECda{
                 shared.closeGame(field);
             }
             void closeMatch(){
+#ifndef POLICY_ONLY
+                stopPondering();
+                mcPool.close();
+#ifdef MONITOR
+                cerr << allocatorStats.toString() << endl;
+                if(Settings::monteCarloDealType == DealType::PARTICLE){
+                    cerr << shared.particles.statistics().toString() << endl;
+                }
+                PlayoutMateStatistics mateStats;
+                LeafSearchStatistics leafStats;
+                PlayLikelihoodCacheStatistics likelihoodStats;
+                for(auto& tools : threadTools){
+                    likelihoodStats += tools.likelihoodCache.statistics();
+                    tools.likelihoodCache.statistics().clear();
+                    mateStats += tools.mateStats;
+                    tools.mateStats.clear();
+                    leafStats += tools.leafSearch.statistics();
+                    tools.leafSearch.statistics().clear();
+                }
+                cerr << mateStats.toString() << endl;
+                cerr << leafStats.toString() << endl;
+                if(Settings::playLikelihoodCache){
+                    cerr << likelihoodStats.toString() << endl;
+                }
+#endif
+                allocatorStats.clear();
+#endif
                 shared.closeMatch();
                 field.closeMatch();
-                for(int th = 0; th < N_THREADS; ++th){
-                    threadTools[th].close();
+                for(auto& tools : threadTools){
+                    tools.close();
                 }
             }
+            Client():
+            threadTools(N_THREADS){}
             ~Client(){
                 closeMatch();
             }
@@ -12,6 +12,7 @@
 #include "../../structure/log/minLog.hpp"
 
 #include "../model/playerBias.hpp"
+#include "../search/maxN.hpp"
 
 // 相手手札を推定して配布
 
@@ -143,6 +144,10 @@ namespace UECda{
             
         public:
             
+            // 採択棄却法で候補の尤度から選ぶときの温度
+            // 持ち越した世界の選別や重みの更新も同じ温度で行う
+            static constexpr double REJECTION_TEMPERATURE = 0.3;
+            
             RandomDealer(){}
             ~RandomDealer(){}
             
@@ -150,6 +155,7 @@ namespace UECda{
             int create(world_t *const dst, DealType type, const field_t& field,
                        const sharedData_t& shared, threadTools_t *const ptools){
                 Cards c[N_PLAYERS];
+                double lhs = 0; // 作成時点での棋譜の対数尤度
                 // レベル指定からカード分配
                 switch(type){
                     case DealType::RANDOM: // 残りカードを完全ランダム分配
@@ -159,13 +165,96 @@ namespace UECda{
                     case DealType::BIAS: // 逆関数法でバイアスを掛けて配る
                         dealWithBias(c, &ptools->dice); break;
                     case DealType::REJECTION: // 採択棄却法で良さそうな配置のみ返す
-                        dealWithRejection(c, shared, ptools); break;
+                        lhs = dealWithRejection(c, shared, ptools); break;
+                    case DealType::PARTICLE: // 粒子フィルタの粒子を重みに従って選ぶ
+                        if(shared.particles.ready()
+                           && shared.particles.getProcessedTurn() == shared.gameLog.plays()){
+                            const auto& particle = shared.particles.sample(&ptools->dice);
+                            for(int p = 0; p < N; ++p){
+                                c[p] = particle.field.getCards(p);
+                            }
+                            lhs = particle.logLikelihood;
+                        }else{
+                            // 粒子が現在の局面まで進んでいなければ採択棄却法
+                            lhs = dealWithRejection(c, shared, ptools);
+                        }
+                        break;
                     default: UNREACHABLE; break;
                 }
                 dst->set(field, c);
+                if(Settings::carryWorlds && HARate > 1){
+                    // 次のターン以降に持ち越して再評価するため、作成時点の尤度を覚えておく
+                    dst->logLikelihood = (type == DealType::REJECTION || type == DealType::PARTICLE)
+                    ? lhs : calcPlayLikelihood(c, shared, ptools);
+                }
                 return 0;
             }
             
+            template<class field_t, class world_t, class sharedData_t, class threadTools_t>
+            int createImportance(world_t *const *const dst, int n, const field_t& field,
+                                 const sharedData_t& shared, threadTools_t *const ptools){
+                // 重点サンプリング
+                // 採択棄却法の候補 n 個(HARate 個まで)を1つに絞らず全て世界にし、
+                // 採択棄却法が選ぶ確率に比例する重みを付ける(重みの平均は1)
+                // 作った世界の数を返す
+                n = max(1, min(n, (int)HARate));
+                if(HARate <= 1){
+                    // 尤度を計算しない場合は通常通り
+                    create(dst[0], DealType::REJECTION, field, shared, ptools);
+                    return 1;
+                }
+                ana.start();
+                Cards cand[HARATE_MAX][N];
+                double candLHS[HARATE_MAX];
+                double maxLHS = -DBL_MAX;
+                for(int t = 0; t < n; ++t){
+                    if(dealWithRejection_ChangePart(cand[t], shared, ptools) != 0){
+                        ana.addFailure(3);
+                        ++failures;
+                        if(failures > 1)flag.set(1);
+                    }
+                    candLHS[t] = calcPlayLikelihood(cand[t], shared, ptools);
+                    maxLHS = max(maxLHS, candLHS[t]);
+                }
+                double weight[HARATE_MAX];
+                double weightSum = 0;
+                for(int t = 0; t < n; ++t){
+                    weight[t] = exp((candLHS[t] - maxLHS) / REJECTION_TEMPERATURE);
+                    weightSum += weight[t];
+                }
+                for(int t = 0; t < n; ++t){
+                    dst[t]->set(field, cand[t]);
+                    dst[t]->weight = weight[t] * n / weightSum;
+                    dst[t]->logLikelihood = candLHS[t];
+                }
+                ana.end(3);
+                return n;
+            }
+            uint32_t getHARate()const noexcept{ return HARate; }
+            
+            template<class world_t, class field_t, class sharedData_t, class threadTools_t>
+            double reweightWorld(world_t *const pw, const field_t& field,
+                                 const sharedData_t& shared, threadTools_t *const ptools){
+                // 前のターンから持ち越した世界を、その後の棋譜で評価し直す
+                // 前回評価時からの対数尤度の変化を返す(評価し直す必要が無い場合は DBL_MAX)
+                const int turn = field.getTurnNum();
+                if(HARate <= 1 || pw->evaluatedTurn == turn)return DBL_MAX;
+                
+                ana.start();
+                
+                Cards c[N];
+                for(int p = 0; p < N; ++p){
+                    c[p] = pw->getCards(p);
+                }
+                const double lhs = calcPlayLikelihood(c, shared, ptools);
+                const double delta = lhs - pw->logLikelihood;
+                pw->logLikelihood = lhs;
+                pw->evaluatedTurn = turn;
+                
+                ana.end(4);
+                return delta;
+            }
+            
             template<class dice64_t>
             void dealAllRand(Cards *const dst, dice64_t *const pdice)const{
                 // 完全ランダム分配
@@ -293,10 +382,12 @@ namespace UECda{
             }
             
             template<class sharedData_t, class threadTools_t>
-            void dealWithRejection(Cards *const dst, const sharedData_t& shared,
-                                   threadTools_t *const ptools){
+            double dealWithRejection(Cards *const dst, const sharedData_t& shared,
+                                     threadTools_t *const ptools){
                 // 採択棄却法メイン
                 // 設定されたレートの分、カード配置を作成し、手札親和度最大のものを選ぶ
+                // 選んだ配置の棋譜の対数尤度を返す(尤度を計算しなかった場合は0)
+                double chosenLHS = 0;
                 assert(HARate >= 1 && HARate < 64);
                 
                 //HARate = 1;
@@ -347,8 +438,9 @@ namespace UECda{
                     }
                     
                     //ランダムに選んでどうか
-                    SoftmaxSelector selector(candLHS, HARate, 0.3);
+                    SoftmaxSelector selector(candLHS, HARate, (double)REJECTION_TEMPERATURE);
                     bestCand = selector.run_all(&ptools->dice);
+                    chosenLHS = candLHS[bestCand];
                     
                     for(int p = 0; p < N; ++p){
                         dst[p] = cand[bestCand][p];
@@ -365,6 +457,85 @@ namespace UECda{
                 for(int r = 0; r < N; ++r){
                     assert(countCards(dst[infoClassPlayer[r]]) == NOwn[r]);
                 }
+                return chosenLHS;
+            }
+            
+            template<class sharedData_t, class threadTools_t>
+            void dealForParticle(Cards *const dst, const sharedData_t& shared,
+                                 threadTools_t *const ptools)const{
+                // 粒子フィルタの初期粒子用に、交換の情報だけを考えて配る
+                // 棋譜の尤度は粒子フィルタ側で着手ごとに掛ける
+                if(dealWithRejection_ChangePart(dst, shared, ptools) != 0){
+                    ana.addFailure(3);
+                }
+            }
+            
+            double countDealPatterns()const{
+                // 特定されていないカードの配り方の数(交換による制約は考えない)
+                int n[N_PLAYERS];
+                for(int r = 0; r < N; ++r)n[r] = NDeal[r];
+                return countHandPatterns(NDistCards, n);
+            }
+            
+            template<class callback_t>
+            void iterateAllDeals(const callback_t& callback)const{
+                // 特定されていないカードの全ての配り方について、
+                // 現在の手札(プレーヤー番号順)と交換から決まる事前の対数重みを callback に渡す
+                // 交換と矛盾する配り方は飛ばす
+                int n[N_PLAYERS];
+                for(int r = 0; r < N; ++r)n[r] = NDeal[r];
+                iterateAllHandPatterns(distCards, NDistCards, n, [&](const Cards *const dealt)->void{
+                    Cards c[N_PLAYERS];
+                    for(int r = 0; r < N; ++r){
+                        c[infoClassPlayer[r]] = andCards(remCards, addCards(detCards[r], dealt[r]));
+                    }
+                    const double logPrior = calcChangeLogPrior(c);
+                    if(logPrior == -DBL_MAX)return;
+                    callback(c, logPrior);
+                });
+            }
+            
+            double calcChangeLogPrior(const Cards *const c)const{
+                // 自分が上位のとき、交換相手の献上後の手札 H に対して
+                // 献上札は自分の配布時の手札のうち H の最高位より高いものから選ばれているので、
+                // その選び方の数が配置の事前の重みになる(選べなければ矛盾)
+                if(phase.isInitGame() || phase.isInChange() || myClass >= MIDDLE)return 0;
+                const int partnerClass = getChangePartnerClass(myClass);
+                const Cards partnerCards = maskCards(addCards(c[infoClassPlayer[partnerClass]], detCards[partnerClass]),
+                                                     sentCards);
+                const Cards higher = anyCards(partnerCards) ? pickHigher(pickHigh(partnerCards, 1)) : CARDS_ALL;
+                const int k = countCards(andCards(myDealtCards, higher));
+                if(k < N_CHANGE_CARDS(myClass))return -DBL_MAX;
+                return log(dCombination(k, N_CHANGE_CARDS(myClass)));
+            }
+            
+            // 粒子フィルタ用の情報
+            int getMyPlayerNum()const noexcept{ return myNum; }
+            Cards getOrgCards(const Cards *const c, int p)const{
+                // 現在の手札から交換後の手札を復元する
+                return addCards(c[p], detCards[infoClass[p]]);
+            }
+            Cards getFreeCards(int p, Cards c)const{
+                // 手札 c のうち、誰の物か特定されていないカード
+                if(p == myNum)return CARDS_NULL;
+                Cards det = CARDS_NULL;
+                for(int r = 0; r < N; ++r)addCards(&det, detCards[r]);
+                return maskCards(c, det);
+            }
+            bool isMovableTo(Cards x, int p)const{
+                // カード x を p に移してよいか(p 以外の誰の物とも特定されていない)
+                for(int r = 0; r < N; ++r){
+                    if(r != infoClass[p] && anyCards(andCards(x, detCards[r])))return false;
+                }
+                return true;
+            }
+            bool isSwappable(int p)const{
+                // 相手同士でカードを入れ替えてよいプレーヤー
+                // 自分が上位のときの交換相手は、献上したカードより強いカードを持てないので除く
+                if(p == myNum || NDeal[infoClass[p]] == 0)return false;
+                if(!phase.isInitGame() && myClass < MIDDLE
+                   && infoClass[p] == getChangePartnerClass(myClass))return false;
+                return true;
             }
             
             void init(){
@@ -1161,6 +1332,8 @@ namespace UECda{
                 }
             }
             
+        public:
+            // 棋譜の尤度(粒子フィルタからも使う)
             template<class sharedData_t, class threadTools_t>
             double calcPlayLikelihood(Cards *const c, const sharedData_t& shared, threadTools_t *const ptools)const{
                 
@@ -1174,12 +1347,9 @@ namespace UECda{
                 double timeLH = 0;
                 double playLH = 0;
                 
-                BitSet32 pwFlag;
                 std::array<Cards, N> orgCards;
                 BitSet32 tmpPlayFlag = playFlag;
-                MoveInfo *const mv = ptools->buf;
                 
-                pwFlag.reset();
                 for(int p = 0; p < N; ++p){
                     orgCards[p] = c[p] | detCards[infoClass[p]];
                 }
@@ -1190,92 +1360,133 @@ namespace UECda{
                  // after change callback
                  [](const auto& field)->void{},
                  // play callback
-                 [&pwFlag, &playLH, &timeLH, &orgCards, mv, tmpPlayFlag, by_time, &shared]
+                 [this, &playLH, &timeLH, tmpPlayFlag, by_time, &shared, ptools]
                  (const auto& field, const auto& chosenMove, uint32_t usedTime)->int{
-                     const uint32_t tp = field.getTurnPlayer();
-                     
-                     //cerr<<field.getTurnNum()<<" "<<chosenMove<<" "<<field.getBoard()<<endl;
-                     
-                     const Cards usedCards = chosenMove.cards();
-                     const PlayerModel *const ppm = &shared.playerModelSpace.model(tp);
-                     const Board bd = field.getBoard();
-                     const Cards myCards = field.getCards(tp);
-                     const Hand& myHand = field.getHand(tp);
-                     const Hand& opsHand = field.getOpsHand(tp);
-                     
-                     if(!holdsCards(myCards, usedCards)){
-                         return -1; // 終了(エラー?)
-                     }
-                     
-                     if(tmpPlayFlag.test(tp)){
-                         // カードが全確定しているプレーヤー(主に自分と、既に上がったプレーヤー)については考慮しない
-                         
-                         // 場の情報をまとめる
-                         const int NMoves = genMove(mv, myHand, bd);
-                         assert(NMoves > 0);
-                         
-                         if(NMoves > 1){
-                             for(int m = 0; m < NMoves; ++m){
-                                 bool mate = checkHandMate(0, mv + NMoves, mv[m], myHand, opsHand, bd, field.fieldInfo);
-                                 if(mate){ mv[m].setMPMate(); }
-                             }
-                         }
-                         
-                         // フェーズ(空場0、通常場1、パス支配場2)
-                         const int ph = bd.isNF() ? 0 : (field.fieldInfo.isPassDom()? 2 : 1);
-                         
-#ifdef ESTIMATION_BY_TIME
-                         if(by_time && field.getTurnNum() != 0 && ph == 1 && chosenMove.isPASS()){
-                             const auto& timeModel = ppm->timeModel();
-                             
-                             int idx = dominatesHand(bd, myHand) ? 1 : 0; // pass only
-                             
-                             uint32_t ts = min(6U, max(1U, log2i(usedTime * time_rate / 256 ) / 2) - 1U);
-                             ASSERT(0 <= ts && ts <= 6, cerr << "ts = " << ts << endl;);
-                             if(timeModel.time_dist7[idx][ts]){
-                                 timeLH += log((double)timeModel.time_dist7[idx][ts] / (double)timeModel.dist_sum[idx]);
-                             }else{
-                                 timeLH -= 99999;
-                             }
-                         }
-#endif
-                         // プレー尤度計算
-                         if(NMoves > 1/* && !pwFlag.test(tp)*/){
-                             // search move
-                             int chosenIdx = searchMove(mv, NMoves, [chosenMove](const auto& tmp)->bool{
-                                 return tmp.meldPart() == chosenMove.meldPart();
-                             });
-                             
-                             if(chosenIdx == -1){ // 自分の合法手生成では生成されない手が出された
-                                 playLH += log(1 / (double)(NMoves + 1));
-                             }else{
-                                 
-                                 std::array<double, N_MAX_MOVES> score;
-                                 calcPlayPolicyScoreSlow<0>(score.data(), mv, NMoves, field, shared.estimationPlayPolicy);
-                                 // Mateの手のスコアを設定
-                                 double maxScore = *std::max_element(score.begin(), score.begin() + NMoves);
-                                 for(int m = 0; m < NMoves; ++m)
-                                     if(mv[m].isMate())score[m] = maxScore + 4;
-                                 SoftmaxSelector selector(score.data(), NMoves, Settings::simulationTemperaturePlay);
-                                 if(Settings::simulationPlayModel){
-                                     addPlayerPlayBias(score.data(), mv, NMoves, field, *ppm, Settings::playerBiasCoef);
-                                 }
-                                 selector.to_prob();
-                                 if(selector.sum != 0){
-                                     playLH += log(max(selector.prob(chosenIdx), 1 / 256.0));
-                                 }else{ // 等確率とする
-                                     playLH += log(1 / (double)NMoves);
-                                 }
-                             }
-                         }
-                     }
-                     return 0;
+                     return calcMoveLikelihood(&playLH, &timeLH, field, chosenMove, usedTime,
+                                               tmpPlayFlag, by_time, shared, ptools);
                  });
                 
                 //cerr<<" play: "<<playLH<<" time: "<<timeLH<<endl;
                 
                 return playLH + timeLH;
             }
+            
+            template<class field_t, class sharedData_t, class threadTools_t>
+            int calcMoveLikelihood(double *const pLH, const field_t& field, const Move chosenMove, uint32_t usedTime,
+                                   const sharedData_t& shared, threadTools_t *const ptools)const{
+                // 1つの着手の対数尤度を加える(粒子フィルタ用)
+                double timeLH = 0;
+                const int ret = calcMoveLikelihood(pLH, &timeLH, field, chosenMove, usedTime,
+                                                   playFlag, shared.estimating_by_time, shared, ptools);
+                *pLH += timeLH;
+                return ret;
+            }
+            
+            template<class field_t, class sharedData_t, class threadTools_t>
+            int calcMoveLikelihood(double *const pPlayLH, double *const pTimeLH,
+                                   const field_t& field, const Move chosenMove, uint32_t usedTime,
+                                   BitSet32 tmpPlayFlag, int by_time,
+                                   const sharedData_t& shared, threadTools_t *const ptools)const{
+                // 着手 chosenMove の対数尤度を加える
+                // 手番のプレーヤーが出されたカードを持っていなければ -1 を返す
+                const uint32_t tp = field.getTurnPlayer();
+                MoveInfo *const mv = ptools->buf;
+                
+                //cerr<<field.getTurnNum()<<" "<<chosenMove<<" "<<field.getBoard()<<endl;
+                
+                const Cards usedCards = chosenMove.cards();
+                const PlayerModel *const ppm = &shared.playerModelSpace.model(tp);
+                const Board bd = field.getBoard();
+                const Cards myCards = field.getCards(tp);
+                const Hand& myHand = field.getHand(tp);
+                const Hand& opsHand = field.getOpsHand(tp);
+                
+                if(!holdsCards(myCards, usedCards)){
+                    return -1; // 終了(エラー?)
+                }
+                
+                if(tmpPlayFlag.test(tp)){
+                    // カードが全確定しているプレーヤー(主に自分と、既に上がったプレーヤー)については考慮しない
+                    
+                    // 同じ試合の同じ手番では、手番のプレーヤーの手札以外の情報は共通なので、
+                    // 手札が同じなら前に計算した項を使う
+                    auto& cache = ptools->likelihoodCache;
+                    const bool useCache = Settings::playLikelihoodCache && cache.size() > 0;
+                    const int turn = field.getTurnNum();
+                    const uint64_t key = PlayLikelihoodCache::makeKey(turn, tp, myHand.hash);
+                    double term;
+                    if(useCache && cache.probe(key, turn, &term)){
+                        *pPlayLH += term;
+                        return 0;
+                    }
+                    Clock clock;
+                    if(useCache)clock.start();
+                    const double playLH0 = *pPlayLH, timeLH0 = *pTimeLH;
+                    
+                    // 場の情報をまとめる
+                    const int NMoves = genMove(mv, myHand, bd);
+                    assert(NMoves > 0);
+                    
+                    if(NMoves > 1){
+                        for(int m = 0; m < NMoves; ++m){
+                            bool mate = checkHandMate(0, mv + NMoves, mv[m], myHand, opsHand, bd, field.fieldInfo);
+                            if(mate){ mv[m].setMPMate(); }
+                        }
+                    }
+                    
+                    // フェーズ(空場0、通常場1、パス支配場2)
+                    const int ph = bd.isNF() ? 0 : (field.fieldInfo.isPassDom()? 2 : 1);
+                    
+#ifdef ESTIMATION_BY_TIME
+                    if(by_time && field.getTurnNum() != 0 && ph == 1 && chosenMove.isPASS()){
+                        const auto& timeModel = ppm->timeModel();
+                        
+                        int idx = dominatesHand(bd, myHand) ? 1 : 0; // pass only
+                        
+                        uint32_t ts = min(6U, max(1U, log2i(usedTime * time_rate / 256 ) / 2) - 1U);
+                        ASSERT(0 <= ts && ts <= 6, cerr << "ts = " << ts << endl;);
+                        if(timeModel.time_dist7[idx][ts]){
+                            *pTimeLH += log((double)timeModel.time_dist7[idx][ts] / (double)timeModel.dist_sum[idx]);
+                        }else{
+                            *pTimeLH -= 99999;
+                        }
+                    }
+#endif
+                    // プレー尤度計算
+                    if(NMoves > 1){
+                        // search move
+                        int chosenIdx = searchMove(mv, NMoves, [chosenMove](const auto& tmp)->bool{
+                            return tmp.meldPart() == chosenMove.meldPart();
+                        });
+                        
+                        if(chosenIdx == -1){ // 自分の合法手生成では生成されない手が出された
+                            *pPlayLH += log(1 / (double)(NMoves + 1));
+                        }else{
+                            
+                            std::array<double, N_MAX_MOVES> score;
+                            calcPlayPolicyScoreSlow<0>(score.data(), mv, NMoves, field, shared.estimationPlayPolicy);
+                            // Mateの手のスコアを設定
+                            double maxScore = *std::max_element(score.begin(), score.begin() + NMoves);
+                            for(int m = 0; m < NMoves; ++m)
+                                if(mv[m].isMate())score[m] = maxScore + 4;
+                            SoftmaxSelector selector(score.data(), NMoves, Settings::simulationTemperaturePlay);
+                            if(Settings::simulationPlayModel){
+                                addPlayerPlayBias(score.data(), mv, NMoves, field, *ppm, Settings::playerBiasCoef);
+                            }
+                            selector.to_prob();
+                            if(selector.sum != 0){
+                                *pPlayLH += log(max(selector.prob(chosenIdx), 1 / 256.0));
+                            }else{ // 等確率とする
+                                *pPlayLH += log(1 / (double)NMoves);
+                            }
+                        }
+                    }
+                    if(useCache){
+                        cache.regist(key, (*pPlayLH - playLH0) + (*pTimeLH - timeLH0), clock.stop());
+                    }
+                }
+                return 0;
+            }
         };
         
         template<>AtomicAnalyzer<5, 1, 0> RandomDealer<N_PLAYERS>::ana("RandomDealer");
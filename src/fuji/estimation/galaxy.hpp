@@ -10,63 +10,140 @@
 
 namespace UECda{
     
-    constexpr int MAX_N_WORLDS = 128;
-    
-    template<class wrd_t, int SIZE = (MAX_N_WORLDS / N_THREADS)>
+    template<class wrd_t>
     struct Galaxy{
         
         using world_t = wrd_t;
         
         // 幾多の世界が詰まっている入れ物のような何か
-        // スレッドごとに
+        // 全スレッドで共有する
+        // 探索中の世界作成では先頭から順にスロットを atomic に確保し、
+        // 作成が終わった世界を ready フラグで他のスレッドに公開する
+        // 世界の削除と並べ替え(proceed, sieve, clear)は探索していない間にのみ行う
+        
+        std::atomic<int> claimed; // 確保されたスロット数(先頭から詰めて使う)
+        std::atomic<int> actives; // 作成が終わった世界数
+        int capacity; // スロット数(起動時に決める)
+        std::unique_ptr<std::atomic<bool>[]> ready;
+        std::unique_ptr<world_t[]> worldMemory;
+        world_t *world;
         
-        int usedLimit;
-        int actives;
-        int nullLimit;
-        world_t world[SIZE];
+        // 配り方を全て列挙して重みを付けた世界だけが入っているとき、重みの累積和で選ぶ
+        bool weighted;
+        std::unique_ptr<double[]> cumWeight;
         
         Galaxy()
         {
-            clear();
+            init(N_WORLDS);
         }
         
         ~Galaxy(){
             close();
         }
         
-        int size()const{return SIZE;}
+        void init(int size){
+            // スロットを確保し直す(探索していない間に呼ぶ)
+            capacity = max(1, size);
+            ready.reset(new std::atomic<bool>[capacity]);
+            worldMemory.reset(new world_t[capacity]);
+            world = worldMemory.get();
+            cumWeight.reset(new double[capacity]);
+            clear();
+        }
+        
+        int size()const{return capacity;}
         
         void clear(){
-            for(int w = 0; w < SIZE; ++w){
+            for(int w = 0; w < capacity; ++w){
                 world[w].clear();
+                ready[w] = false;
             }
-            usedLimit = SIZE;
+            claimed = 0;
             actives = 0;
-            nullLimit = 0;
+            weighted = false;
+        }
+        
+        void setWeighted(){
+            // 作成済みの世界の weight の累積和を作り、以降は pickByWeight で選べるようにする
+            // (探索していない間に呼ぶ)
+            const int limit = min(capacity, claimed.load());
+            double sum = 0;
+            for(int w = 0; w < limit; ++w){
+                if(isReady(w))sum += world[w].weight;
+                cumWeight[w] = sum;
+            }
+            if(sum <= 0)return;
+            for(int w = 0; w < limit; ++w)cumWeight[w] /= sum;
+            weighted = true;
+        }
+        
+        world_t* pickByWeight(double u){
+            // 重みの累積分布で u (0 <= u < 1) の位置の世界を返す
+            const int limit = min(capacity, claimed.load());
+            const int w = std::upper_bound(cumWeight.get(), cumWeight.get() + limit, u) - cumWeight.get();
+            return &world[min(w, limit - 1)];
         }
         
         void close(){
             clear();
         }
         
-        void proceed(const int p, const Move mv, const Cards c, const double compRatio){
-            
+        int proceed(const int p, const Move mv, const Cards c){
+            // 着手 mv (使用カード c) によって世界を進める
+            // 矛盾する世界は消し、生き残った世界は前に詰める
+            return sieve([p, mv, c](int w, world_t& wld)->bool{
+                if(!holdsCards(wld.getCards(p), c)){ // 矛盾
+                    return false; // そんな世界は存在しなかった
+                }
+                wld.proc(p, mv, c);
+                return true;
+            });
+        }
+        
+        template<class callback_t>
+        int sieve(const callback_t& keep){
+            // keep(w, world) が false を返した世界を消し、生き残った世界は前に詰める
+            int survivals = 0;
+            const int limit = min(capacity, claimed.load());
+            for(int w = 0; w < limit; ++w){
+                if(!isReady(w))continue;
+                if(!keep(w, world[w])){
+                    world[w].clear();
+                    ready[w] = false;
+                    continue;
+                }
+                if(survivals != w){
+                    world[survivals] = world[w];
+                    ready[survivals] = true;
+                    world[w].clear();
+                    ready[w] = false;
+                }
+                ++survivals;
+            }
+            claimed = survivals;
+            actives = survivals;
+            weighted = false;
+            return survivals;
         }
         
         void checkRationality(){
             
         }
         
+        bool isReady(const int w)const{
+            return ready[w].load(std::memory_order_acquire);
+        }
+        
         world_t* access(const int w){
-            assert(0 <= w && w < SIZE);
+            assert(0 <= w && w < capacity);
             return &world[w];
         }
         
-        world_t* searchSpace(const int line, const int limit){
-            // 空になっている分割スペースを返す
-            for(int w = line; w < line + limit; ++w){
-                if(!world[w].isActive()){//ここに登録
-                    DERR << "WORLD " << w << "IS INACTIVE!" << endl;
+        world_t* searchSpace(){
+            // 空いているスロットを1つ確保して返す
+            int w = claimed.load(std::memory_order_relaxed);
+            while(w < capacity){
+                if(claimed.compare_exchange_weak(w, w + 1)){
                     return &world[w];
                 }
             }
@@ -75,31 +152,70 @@ namespace UECda{
         }
         
         template<class dice_t>
-        world_t* pickRand(const int line, const int limit, dice_t *const dice){
-            // activeである世界のどれかにランダムアクセスする
-            int w = line + (dice->rand() % limit);
-            
-            if(0 <= w && w < SIZE && world[w].isActive()){
-                return &world[w];
-            }else{
-                assert(0);
-                return nullptr;
+        world_t* pickRand(dice_t *const dice){
+            // 作成が終わっている世界のどれかにランダムアクセスする
+            // 作成中のスロットに当たった場合は引き直す
+            const int limit = min(capacity, claimed.load(std::memory_order_acquire));
+            if(limit <= 0)return nullptr;
+            for(int t = 0; t < 8; ++t){
+                const int w = dice->rand() % limit;
+                if(isReady(w))return &world[w];
+            }
+            for(int w = 0; w < limit; ++w){
+                if(isReady(w))return &world[w];
             }
+            return nullptr;
         }
         
         int regist(world_t *const wld){
-            if(!(0 <= (wld - world) && (wld - world) < SIZE && (!wld->isActive()))){
+            const int w = wld - world;
+            if(!(0 <= w && w < capacity && !isReady(w))){
                 assert(0);
                 return -1;
             }
             wld->activate();
-            actives++;
+            ready[w].store(true, std::memory_order_release);
+            actives.fetch_add(1);
             return 0;
         }
+    };
+    
+    struct WorldPipelineStatistics{
+        // 世界作成の記録(スレッドごと)
+        // 作成専用スレッドが世界プールを先に埋め、プレイアウトを行うスレッドはできた世界を使う
+        uint64_t produced; // 作成専用スレッドが作った世界数
+        uint64_t producerTime; // 作成専用スレッドが世界作成に使った時間(クロック)
+        uint64_t requests; // プレイアウト側が新しい世界を求めた回数
+        uint64_t depthSum, depthMax; // そのときに先に作られていた世界数
+        uint64_t borrowed; // 求めた世界が未完成で、できている世界を代わりに使った回数
+        uint64_t stalls; // 使える世界が無く、自分で作った回数
+        uint64_t stallTime; // 自分で作るのに使った時間(クロック)
         
-        void addActives(){
-            ++actives;
+        void clear(){
+            produced = producerTime = 0;
+            requests = depthSum = depthMax = 0;
+            borrowed = stalls = stallTime = 0;
         }
+        void feedDepth(int depth){
+            ++requests;
+            depthSum += max(depth, 0);
+            depthMax = max(depthMax, (uint64_t)max(depth, 0));
+        }
+        WorldPipelineStatistics& operator+=(const WorldPipelineStatistics& rhs){
+            produced += rhs.produced; producerTime += rhs.producerTime;
+            requests += rhs.requests; depthSum += rhs.depthSum;
+            depthMax = max(depthMax, rhs.depthMax);
+            borrowed += rhs.borrowed; stalls += rhs.stalls; stallTime += rhs.stallTime;
+            return *this;
+        }
+        std::string toString()const{
+            std::ostringstream oss;
+            oss << "WorldPipeline : produced " << produced << " (" << producerTime << " clock)";
+            oss << " depth " << depthSum / (double)max(requests, (uint64_t)1) << " (max " << depthMax << ")";
+            oss << " borrowed " << borrowed << " stalls " << stalls << " (" << stallTime << " clock)";
+            return oss.str();
+        }
+        WorldPipelineStatistics(){ clear(); }
     };
     
     template<class glxy_t, int N = N_THREADS>
@@ -167,7 +283,19 @@ namespace UECda{
             pgal[g] = gal;
         }
         
+        void proceedWorlds(int p, const Move& mv){
+            // 全ての世界プールを着手によって進める
+            const Cards c = mv.cards();
+            if(anyCards(c)){
+                for(int g = 0; g < N; ++g){
+                    pgal[g]->proceed(p, mv, c);
+                }
+            }
+        }
+        
         void proceed(int p, const Move& mv, const double compRatio){
+            // 世界推定力の解析のみ行う
+            // 世界を実際に進めるのは proceedWorlds()
             
             assert(compRatio > 0);
             
@@ -192,7 +320,6 @@ namespace UECda{
                                 //完全矛盾による世界の自然死を判定
                                 if(!holdsCards(tmpW.getCards(p), c)){//矛盾
                                     DERR << "World " << w << " died..." << endl;
-                                    tmpW.clear();//そんな世界は存在しなかった
                                     dieds++;
                                 }else{
                                     //世界死がおきなかった
@@ -213,7 +340,6 @@ namespace UECda{
                             }
                         }
                         
-                        pgal[g]->actives -= dieds;
                         //actives -= dieds;
                         //cerr<<"Galaxy : "<<actives<<" worlds are still active."<<std::endl;
                         population += pops;
@@ -0,0 +1,133 @@
+/*
+ likelihoodCache.hpp
+ Katsuki Ohto
+ */
+
+#ifndef UECDA_FUJI_LIKELIHOODCACHE_HPP_
+#define UECDA_FUJI_LIKELIHOODCACHE_HPP_
+
+#include "../../include.h"
+
+// 棋譜の尤度計算の着手ごとの項の置換表(スレッドごと)
+// 同じ試合の棋譜の t 手目の局面は、手番のプレーヤーの手札以外は全ての候補配置で共通なので、
+// 着手の対数尤度は (手番, プレーヤー, 手札のハッシュ値) で決まる
+// 採択棄却法の候補や持ち越した世界の再評価、次の着手決定で同じ手札が出てきたときに使い回す
+// 試合が変わると棋譜と相手モデルが変わるので、試合開始時に世代番号で消去する
+
+namespace UECda{
+    namespace Fuji{
+        
+        struct PlayLikelihoodCacheStatistics{
+            static constexpr int N_TURNS = 64; // これ以降の手番はまとめて数える
+            uint64_t probes[N_TURNS], hits[N_TURNS];
+            uint64_t stores, replaced;
+            uint64_t missTime; // 項を計算した時間の合計(クロック)
+            
+            void clear(){
+                for(int t = 0; t < N_TURNS; ++t)probes[t] = hits[t] = 0;
+                stores = replaced = 0;
+                missTime = 0;
+            }
+            uint64_t allProbes()const{
+                uint64_t n = 0;
+                for(int t = 0; t < N_TURNS; ++t)n += probes[t];
+                return n;
+            }
+            uint64_t allHits()const{
+                uint64_t n = 0;
+                for(int t = 0; t < N_TURNS; ++t)n += hits[t];
+                return n;
+            }
+            PlayLikelihoodCacheStatistics& operator+=(const PlayLikelihoodCacheStatistics& rhs){
+                for(int t = 0; t < N_TURNS; ++t){
+                    probes[t] += rhs.probes[t];
+                    hits[t] += rhs.hits[t];
+                }
+                stores += rhs.stores; replaced += rhs.replaced;
+                missTime += rhs.missTime;
+                return *this;
+            }
+            std::string toString()const{
+                std::ostringstream oss;
+                const uint64_t p = allProbes(), h = allHits();
+                const double missTimeAvg = missTime / (double)max(p - h, (uint64_t)1);
+                oss << "PlayLikelihoodCache : hit " << h << " / " << p;
+                oss << " (" << h / (double)max(p, (uint64_t)1) << ")";
+                oss << " stores " << stores << " replaced " << replaced;
+                oss << " saved " << (uint64_t)(h * missTimeAvg) << " clock" << endl;
+                oss << " hit rate by turn :";
+                for(int t = 0; t < N_TURNS; ++t){
+                    if(probes[t] > 0)oss << " " << t << ":" << hits[t] / (double)probes[t];
+                }
+                return oss.str();
+            }
+            PlayLikelihoodCacheStatistics(){ clear(); }
+        };
+        
+        class PlayLikelihoodCache{
+        public:
+            struct Entry{
+                uint64_t key;
+                uint32_t stamp;
+                double value; // 対数尤度の項
+            };
+            
+            static uint64_t makeKey(int turn, int p, uint64_t handHash){
+                return handHash ^ ((uint64_t)(turn * N_PLAYERS + p + 1) * 0x9E3779B97F4A7C15ULL);
+            }
+            
+            void init(int size){
+                // 大きさは2の累乗に切り上げる
+                int sz = 1;
+                while(sz < size)sz <<= 1;
+                table.reset(new Entry[sz]);
+                memset(table.get(), 0, sizeof(Entry) * sz);
+                mask = sz - 1;
+                stamp = 1;
+                stats.clear();
+            }
+            int size()const noexcept{ return table ? (mask + 1) : 0; }
+            
+            void clear(){
+                // 試合開始時に呼ぶ
+                if(!table)return;
+                if(++stamp == 0){ // 一周したら全部消す
+                    memset(table.get(), 0, sizeof(Entry) * size());
+                    stamp = 1;
+                }
+            }
+            
+            bool probe(uint64_t key, int turn, double *const pvalue){
+                const int t = min(turn, PlayLikelihoodCacheStatistics::N_TURNS - 1);
+                ++stats.probes[t];
+                const Entry& e = table[key & mask];
+                if(e.stamp != stamp || e.key != key)return false;
+                *pvalue = e.value;
+                ++stats.hits[t];
+                return true;
+            }
+            void regist(uint64_t key, double value, uint64_t time){
+                ++stats.stores;
+                stats.missTime += time;
+                Entry& e = table[key & mask];
+                if(e.stamp == stamp && e.key != key)++stats.replaced;
+                e.key = key;
+                e.stamp = stamp;
+                e.value = value;
+            }
+            
+            PlayLikelihoodCacheStatistics& statistics()noexcept{ return stats; }
+            const PlayLikelihoodCacheStatistics& statistics()const noexcept{ return stats; }
+            
+            PlayLikelihoodCache(): mask(0), stamp(0){}
+            
+        private:
+            std::unique_ptr<Entry[]> table;
+            int mask;
+            uint32_t stamp;
+            PlayLikelihoodCacheStatistics stats;
+        };
+    }
+}
+
+#endif // UECDA_FUJI_LIKELIHOODCACHE_HPP_
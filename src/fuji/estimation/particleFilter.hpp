@@ -0,0 +1,350 @@
+/*
+ particleFilter.hpp
+ Katsuki Ohto
+ */
+
+#ifndef UECDA_FUJI_PARTICLEFILTER_HPP_
+#define UECDA_FUJI_PARTICLEFILTER_HPP_
+
+#include "../../include.h"
+
+// 相手手札推定の粒子フィルタ(DealType::PARTICLE)
+// 1試合の間、重み付きの手札配置(粒子)の集合を持ち続け、
+// 着手決定のたびにその間に行われた着手だけを各粒子で進めて、着手の尤度を重みに掛ける
+// 粒子の中で相手が持っていないはずのカードが出された場合は、
+// そのカードを持っている相手と、出したプレーヤーの確定していないカード1枚を入れ替えて修復する
+// (重みはそれまでの着手の尤度を計算し直さないので近似だが、棋譜全体の尤度は修復後の手札で計算し直す)
+// 有効粒子数が閾値を下回ったら重みに従って復元抽出し、重複した粒子を
+// 相手同士のカードの入れ替えを提案とするメトロポリス・ヘイスティングス法で若返らせる
+// (受理確率の基準になる棋譜全体の尤度は、若返りの前に現在の推定器で計算し直す)
+
+namespace UECda{
+    namespace Fuji{
+        
+        struct ParticleFilterStatistics{
+            uint64_t decisions; // 更新回数
+            uint64_t moves; // 粒子ごとに進めた着手の数の合計
+            uint64_t repairs, deaths; // 修復した回数と、修復できず捨てた粒子数
+            uint64_t deals; // 粒子を配り直した回数
+            uint64_t resamples;
+            uint64_t rejuvenationTrials, rejuvenationAccepts;
+            double ESSRateSum; // 更新後の有効粒子数の割合の合計
+            uint64_t updateTime; // 更新にかかった時間(マイクロ秒)
+            
+            void clear(){
+                decisions = moves = 0;
+                repairs = deaths = 0;
+                deals = resamples = 0;
+                rejuvenationTrials = rejuvenationAccepts = 0;
+                ESSRateSum = 0;
+                updateTime = 0;
+            }
+            ParticleFilterStatistics& operator+=(const ParticleFilterStatistics& rhs){
+                // スレッドごとの記録を足し合わせる
+                decisions += rhs.decisions; moves += rhs.moves;
+                repairs += rhs.repairs; deaths += rhs.deaths;
+                deals += rhs.deals; resamples += rhs.resamples;
+                rejuvenationTrials += rhs.rejuvenationTrials;
+                rejuvenationAccepts += rhs.rejuvenationAccepts;
+                ESSRateSum += rhs.ESSRateSum;
+                updateTime += rhs.updateTime;
+                return *this;
+            }
+            std::string toString()const{
+                std::ostringstream oss;
+                const double n = max(decisions, (uint64_t)1);
+                oss << "ParticleFilter : " << decisions << " updates";
+                oss << " moves " << moves / n << " repairs " << repairs / n << " deaths " << deaths / n;
+                oss << " deals " << deals << " resamples " << resamples;
+                oss << " rejuvenation " << rejuvenationAccepts << " / " << rejuvenationTrials;
+                oss << " ESS " << ESSRateSum / n;
+                oss << " time " << updateTime / n << " us";
+                return oss.str();
+            }
+            ParticleFilterStatistics(){ clear(); }
+        };
+        
+        class ParticleFilter{
+        public:
+            struct Particle{
+                PlayouterField field; // 処理済みの手番まで進めた局面
+                double logWeight; // 前回の復元抽出からの対数尤度
+                double logLikelihood; // 棋譜全体の対数尤度
+                bool alive;
+                bool duplicated; // 復元抽出で複製されたもの
+            };
+            
+            static constexpr double RESAMPLE_RATE = 0.5; // 有効粒子数がこの割合を下回ったら復元抽出
+            static constexpr int REJUVENATION_STEPS = 4; // 重複した粒子ごとの入れ替えの提案回数
+            
+            void init(int n){
+                particles.resize(max(n, 1));
+                cdf.resize(particles.size());
+                clear();
+            }
+            void clear(){
+                // 試合開始時に呼ぶ
+                processedTurn = -1;
+                ready_ = false;
+            }
+            int size()const noexcept{ return (int)particles.size(); }
+            bool ready()const noexcept{ return ready_; }
+            bool dealt()const noexcept{ return processedTurn >= 0; }
+            int getProcessedTurn()const noexcept{ return processedTurn; }
+            
+            ParticleFilterStatistics& statistics()noexcept{ return stats; }
+            const ParticleFilterStatistics& statistics()const noexcept{ return stats; }
+            
+            // 以下の ~Thread は探索していない間に threads 個のスレッドで分担して呼ぶ
+            // dealer は呼び出したスレッドで現在の局面から設定したもの
+            
+            template<class dealer_t, class sharedData_t, class threadTools_t>
+            void dealThread(int ith, int threads, dealer_t& dealer,
+                            const sharedData_t& shared, threadTools_t *const ptools){
+                // 交換の情報だけを考えて粒子を配り、交換後の局面に置く
+                for(int i = ith; i < size(); i += threads){
+                    Particle& pt = particles[i];
+                    Cards c[N_PLAYERS];
+                    dealer.dealForParticle(c, shared, ptools);
+                    setFieldAfterChangeByHands(&pt.field, c, dealer, shared);
+                    pt.logWeight = pt.logLikelihood = 0;
+                    pt.alive = true;
+                    pt.duplicated = false;
+                }
+            }
+            
+            template<class dealer_t, class sharedData_t, class threadTools_t>
+            void advanceThread(int ith, int threads, int fromTurn, const dealer_t& dealer,
+                               const sharedData_t& shared, threadTools_t *const ptools,
+                               ParticleFilterStatistics *const pstats){
+                // fromTurn 以降の棋譜の着手で各粒子を進め、着手の尤度を重みに掛ける
+                const auto& gLog = shared.gameLog;
+                for(int i = ith; i < size(); i += threads){
+                    Particle& pt = particles[i];
+                    if(!pt.alive)continue;
+                    PlayouterField& field = pt.field;
+                    bool repaired = false;
+                    for(int t = fromTurn; t < gLog.plays(); ++t){
+                        const auto& play = gLog.play(t);
+                        const Move move = play.move();
+                        const int tp = field.getTurnPlayer();
+                        field.prepareForPlay();
+                        if(!holdsCards(field.getCards(tp), move.cards())){
+                            if(!repair(&field, tp, move.cards(), dealer, &ptools->dice)){
+                                pt.alive = false;
+                                pstats->deaths += 1;
+                                break;
+                            }
+                            pstats->repairs += 1;
+                            repaired = true;
+                            field.prepareForPlay();
+                        }
+                        double lh = 0;
+                        dealer.calcMoveLikelihood(&lh, field, move, play.time(), shared, ptools);
+                        pt.logWeight += lh;
+                        pt.logLikelihood += lh;
+                        field.procSlowest(move);
+                        pstats->moves += 1;
+                    }
+                    if(pt.alive && repaired){
+                        // 修復で手札が変わったので、棋譜全体の尤度を修復後の手札で計算し直す
+                        pt.logLikelihood = calcLogLikelihood(pt, dealer, shared, ptools);
+                    }
+                }
+            }
+            
+            int alives()const{
+                int n = 0;
+                for(const Particle& pt : particles)n += pt.alive ? 1 : 0;
+                return n;
+            }
+            
+            template<class dice_t>
+            bool resample(dice_t *const pdice){
+                // 有効粒子数が少なければ重みに従って系統抽出で復元抽出する
+                // 復元抽出したかを返す
+                const double ess = calcESS();
+                if(ess <= 0 || ess >= RESAMPLE_RATE * size())return false; // 全て矛盾した場合は配り直す
+                
+                calcCDF();
+                std::vector<Particle> sampled(size());
+                const double step = 1.0 / size();
+                double u = pdice->drand() * step;
+                int j = 0, lastj = -1;
+                for(int i = 0; i < size(); ++i, u += step){
+                    // 丸め誤差で u が最後の累積和を超えても、最後の生きている粒子で止める
+                    while(j < lastAlive && (cdf[j] <= u || !particles[j].alive))++j;
+                    sampled[i] = particles[j];
+                    sampled[i].duplicated = (j == lastj); // 2つ目以降の複製
+                    sampled[i].logWeight = 0;
+                    lastj = j;
+                }
+                particles.swap(sampled);
+                stats.resamples += 1;
+                return true;
+            }
+            
+            template<class dealer_t, class sharedData_t, class threadTools_t>
+            void rejuvenateThread(int ith, int threads, const dealer_t& dealer,
+                                  const sharedData_t& shared, threadTools_t *const ptools,
+                                  ParticleFilterStatistics *const pstats){
+                // 重複した粒子について、相手同士のカード1枚ずつの入れ替えを提案し、
+                // 棋譜全体の尤度の比で受理する
+                auto& dice = ptools->dice;
+                for(int i = ith; i < size(); i += threads){
+                    Particle& pt = particles[i];
+                    if(!pt.duplicated)continue;
+                    pt.duplicated = false;
+                    // 修復や前回までの更新の推定器との違いを受理確率に持ち込まないよう、
+                    // 基準の尤度を現在の推定器で計算し直す
+                    pt.logLikelihood = calcLogLikelihood(pt, dealer, shared, ptools);
+                    for(int k = 0; k < REJUVENATION_STEPS; ++k){
+                        Cards c[N_PLAYERS];
+                        for(int p = 0; p < N_PLAYERS; ++p)c[p] = pt.field.getCards(p);
+                        if(!proposeSwap(c, dealer, &dice))continue;
+                        pstats->rejuvenationTrials += 1;
+                        const double lhs = dealer.calcPlayLikelihood(c, shared, ptools);
+                        if(log(max(dice.drand(), DBL_MIN)) < lhs - pt.logLikelihood){
+                            // 受理したので、交換後の局面から棋譜の最後まで進め直す
+                            setFieldAfterChangeByHands(&pt.field, c, dealer, shared);
+                            const auto& gLog = shared.gameLog;
+                            for(int t = 0; t < gLog.plays(); ++t){
+                                pt.field.prepareForPlay();
+                                pt.field.procSlowest(gLog.play(t).move());
+                            }
+                            pt.logLikelihood = lhs;
+                            pstats->rejuvenationAccepts += 1;
+                        }
+                    }
+                }
+            }
+            
+            void finish(int turn){
+                // 更新の最後に呼ぶ
+                processedTurn = turn;
+                ready_ = alives() > 0;
+                if(ready_){
+                    stats.ESSRateSum += calcESS() / size();
+                    calcCDF();
+                }
+                stats.decisions += 1;
+            }
+            
+            template<class dice_t>
+            const Particle& sample(dice_t *const pdice)const{
+                // 重みに従って粒子を1つ選ぶ(探索中に複数スレッドから呼んでよい)
+                const double u = pdice->drand();
+                // 矛盾した粒子は累積和が増えないので選ばれないが、
+                // 丸め誤差で末尾を超えた場合は最後の生きている粒子にする
+                const int i = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+                return particles[min(i, lastAlive)];
+            }
+            
+            const Particle& particle(int i)const{ return particles[i]; }
+            
+            ParticleFilter(): processedTurn(-1), lastAlive(0), ready_(false){}
+            
+        private:
+            std::vector<Particle> particles;
+            std::vector<double> cdf; // 正規化した重みの累積和
+            int processedTurn; // この手番の前までの着手を処理済み
+            int lastAlive; // 生きている最後の粒子の番号(calcCDF で更新)
+            bool ready_;
+            ParticleFilterStatistics stats;
+            
+            double calcESS()const{
+                double maxLW = -DBL_MAX;
+                for(const Particle& pt : particles)if(pt.alive)maxLW = max(maxLW, pt.logWeight);
+                if(maxLW == -DBL_MAX)return 0;
+                double sum = 0, sum2 = 0;
+                for(const Particle& pt : particles){
+                    if(!pt.alive)continue;
+                    const double w = exp(pt.logWeight - maxLW);
+                    sum += w; sum2 += w * w;
+                }
+                return sum * sum / sum2;
+            }
+            void calcCDF(){
+                double maxLW = -DBL_MAX;
+                for(const Particle& pt : particles)if(pt.alive)maxLW = max(maxLW, pt.logWeight);
+                double sum = 0;
+                lastAlive = 0;
+                for(int i = 0; i < size(); ++i){
+                    if(particles[i].alive){
+                        sum += exp(particles[i].logWeight - maxLW);
+                        lastAlive = i;
+                    }
+                    cdf[i] = sum;
+                }
+                for(int i = 0; i < size(); ++i)cdf[i] /= sum;
+            }
+            template<class dealer_t, class sharedData_t, class threadTools_t>
+            static double calcLogLikelihood(const Particle& pt, const dealer_t& dealer,
+                                            const sharedData_t& shared, threadTools_t *const ptools){
+                // 粒子の現在の手札での棋譜全体の対数尤度
+                Cards c[N_PLAYERS];
+                for(int p = 0; p < N_PLAYERS; ++p)c[p] = pt.field.getCards(p);
+                return dealer.calcPlayLikelihood(c, shared, ptools);
+            }
+            template<class dealer_t, class sharedData_t>
+            static void setFieldAfterChangeByHands(PlayouterField *const pfield, const Cards *const c,
+                                                   const dealer_t& dealer, const sharedData_t& shared){
+                // 現在の手札の配置から交換後の局面を作る
+                std::array<Cards, N_PLAYERS> orgCards;
+                for(int p = 0; p < N_PLAYERS; ++p)orgCards[p] = dealer.getOrgCards(c, p);
+                setFieldBeforeAll(*pfield, shared.gameLog);
+                setFieldAfterChange(*pfield, shared.gameLog, orgCards);
+            }
+            
+            template<class dealer_t, class dice_t>
+            static bool repair(PlayouterField *const pfield, int tp, Cards used,
+                               const dealer_t& dealer, dice_t *const pdice){
+                // tp が持っていないカードを出したので、持っているプレーヤーから1枚ずつ入れ替える
+                Cards lack = maskCards(used, pfield->getCards(tp));
+                while(anyCards(lack)){
+                    const Cards x = IntCardToCards(popIntCardLow(&lack));
+                    int q = -1;
+                    for(int p = 0; p < N_PLAYERS; ++p){
+                        if(p != tp && holdsCards(pfield->getCards(p), x))q = p;
+                    }
+                    if(q < 0 || q == dealer.getMyPlayerNum() || !dealer.isMovableTo(x, tp))return false;
+                    // 代わりに渡すのは、出すカード以外で tp の確定していないカード
+                    const Cards free = maskCards(dealer.getFreeCards(tp, pfield->getCards(tp)), used);
+                    if(!anyCards(free))return false;
+                    const Cards y = pickRandomCard(free, pdice);
+                    pfield->makeChange(tp, q, y);
+                    pfield->makeChange(q, tp, x);
+                }
+                return true;
+            }
+            
+            template<class dealer_t, class dice_t>
+            static bool proposeSwap(Cards *const c, const dealer_t& dealer, dice_t *const pdice){
+                // 確定していないカードを持つ相手2人を選び、1枚ずつ入れ替える
+                int cand[N_PLAYERS];
+                int NCands = 0;
+                for(int p = 0; p < N_PLAYERS; ++p){
+                    if(dealer.isSwappable(p) && anyCards(dealer.getFreeCards(p, c[p])))cand[NCands++] = p;
+                }
+                if(NCands < 2)return false;
+                const int i = pdice->rand() % NCands;
+                const int j = (i + 1 + pdice->rand() % (NCands - 1)) % NCands;
+                const int p = cand[i], q = cand[j];
+                const Cards x = pickRandomCard(dealer.getFreeCards(p, c[p]), pdice);
+                const Cards y = pickRandomCard(dealer.getFreeCards(q, c[q]), pdice);
+                c[p] = addCards(maskCards(c[p], x), y);
+                c[q] = addCards(maskCards(c[q], y), x);
+                return true;
+            }
+            
+            template<class dice_t>
+            static Cards pickRandomCard(Cards c, dice_t *const pdice){
+                int k = pdice->rand() % countCards(c);
+                while(k-- > 0)c = maskCards(c, IntCardToCards(popIntCardLow(&c)));
+                return IntCardToCards(popIntCardLow(&c));
+            }
+        };
+    }
+}
+
+#endif // UECDA_FUJI_PARTICLEFILTER_HPP_
@@ -11,410 +11,182 @@
 #include "../../structure/primitive/prim.hpp"
 #include "../../structure/primitive/prim2.hpp"
 
-namespace UECda{
+#include "../policy/playPolicy.hpp"
 
+namespace UECda{
+    
     /**************************順位予測**************************/
     
+    // 空場の完全情報局面から、残っているプレーヤーの上がり順の分布を予測する
+    // 上がり順は Plackett-Luce モデルとする
+    // 各プレーヤーの点を計算し、残っているプレーヤーの中から点の softmax で次に上がる人を選ぶ
+    // 1段ごとには着手方策と同じ softmax 分類なので、学習も方策と同じ仕組みで行う
+    
     namespace StaticEvalSpace{
         enum{
-            // 交換
-            EVAL_GGG,
+            EVAL_NCARDS, // 手札枚数
+            EVAL_NMELDS, // 最小分割数
+            EVAL_RANK, // 平均ランク(現在のオーダー)
+            EVAL_JOKER, // ジョーカー所持
+            EVAL_EIGHT, // 8の枚数
+            EVAL_SEQ, // 階段を作れるか
+            EVAL_SEAT, // 手番プレーヤーから何人目か
             EVAL_ALL,
         };
         
-        constexpr int evalNumTable[EVAL_ALL] = {
-            //交換
-            11 + 10 + 9 + 4 * 13,
-            
-            0,
-            
-            0, //14,
-            
-            1,
-            3,
-            
+        constexpr int numTable[] = {
+            16,
+            16,
             1,
             1,
             1,
             1,
-            
-            1,
-            2,
-            
-            //16 * 16 * 20,
-            16 * 16 * N_PATTERNS_SUITS_SUITS,
+            N_PLAYERS,
         };
+        
         constexpr int EVAL_NUM(unsigned int fea){
-            return polNumTable[fea];
+            return numTable[fea];
         }
         constexpr int EVAL_IDX(unsigned int fea){
             return (fea == 0) ? 0 : (EVAL_IDX(fea - 1) + EVAL_NUM(fea - 1));
         }
         constexpr int EVAL_NUM_ALL = EVAL_IDX(EVAL_ALL);
         
-#define LINEOUT(feature, str) {out << str << endl; int base = POL_IDX(feature); for (int i = 0; i < POL_NUM(feature); ++i){ os(base + i); }out << endl;}
+#define LINEOUT(feature, str) { out << str << endl; int base = EVAL_IDX(feature);\
+for (int i = 0; i < EVAL_NUM(feature); ++i){os(base + i); } out << endl; }
         
-        int commentToParam(std::ostream& out, const double param[EVAL_NUM_ALL]){
-            /*auto os = [&out, param](int idx)->void{ out << param[idx] << " "; };
-            
-            out << "****** CHANGE POLICY ******" << endl;
-            
-            {
-                out << "1PQR or SEQ" << endl;
-                int base = POL_IDX(POL_CHANGE_HAND_1PQR_SEQ);
-                out << "  SEQ" << endl;
-                for (int i = 0; i < 11; ++i){ os(base + i); }out << endl;
-                for (int i = 0; i < 10; ++i){ os(base + 11 + i); }out << endl;
-                for (int i = 0; i < 9; ++i){ os(base + 21 + i); }out << endl;
-                out << "  GROUP" << endl;
-                for (int i = 0; i < 13; ++i){
-                    for (int j = 0; j < 4; ++j){ os(base + 30 + 4 * i + j); }out << endl;
-                }
-            }
-            
-            LINEOUT(POL_CHANGE_HAND_2PQR_SEQ, "2PQR or SEQ");
-            LINEOUT(POL_CHANGE_HAND_D3, "D3 BONUS");
-            LINEOUT(POL_CHANGE_HAND_JOKER_S3, "S3-JOKER LINK BONUS");
-            LINEOUT(POL_CHANGE_HAND_MAX1_RANK, "MAX1 RANK");
-            LINEOUT(POL_CHANGE_HAND_MAX2_RANK, "MAX2 RANK");
-            LINEOUT(POL_CHANGE_HAND_MIN1_RANK, "MIN1 RANK");
-            LINEOUT(POL_CHANGE_HAND_MIN2_RANK, "MIN2 RANK");
-            LINEOUT(POL_CHANGE_DOUBLE, "DOUBLE PRESENT");
-            LINEOUT(POL_CHANGE_PART_SEQ, "PART SEQ PRESENT");
-            //LINEOUT(,);*/
+        template<typename T>
+        int commentToEvalParam(std::ostream& out, const T param[EVAL_NUM_ALL]){
+            auto os = [&out, param](int idx)->void{ out << param[idx] << " "; };
+            
+            out << "****** STATIC EVALUATOR ******" << endl;
+            
+            LINEOUT(EVAL_NCARDS, "NCARDS");
+            LINEOUT(EVAL_NMELDS, "NMELDS");
+            LINEOUT(EVAL_RANK, "AVG_RANK");
+            LINEOUT(EVAL_JOKER, "JOKER");
+            LINEOUT(EVAL_EIGHT, "EIGHT");
+            LINEOUT(EVAL_SEQ, "SEQ");
+            LINEOUT(EVAL_SEAT, "SEAT_FROM_TURN");
             return 0;
         }
 #undef LINEOUT
     }
-        
-    using StaticEvaluator = SoftmaxPolicy<StaticEvalSpace::EVAL_NUM_ALL, 2>;
-    using StaticEvaluatorLearner = SoftmaxPolicyLearner<ChangePolicy>;
     
-    int foutComment(const StaticEvaluator& mdl, const std::string& fName){
+    template<typename T> using StaticEvaluator = SoftmaxClassifier<StaticEvalSpace::EVAL_NUM_ALL, 1, 1, T>;
+    template<typename T> using StaticEvaluatorLearner = SoftmaxClassifyLearner<StaticEvaluator<T>>;
+    
+    template<typename T>
+    int foutComment(const StaticEvaluator<T>& ev, const std::string& fName){
         std::ofstream ofs(fName, std::ios::out);
-        return StaticEvalSpace::commentToParam(ofs, mdl.param_);
+        return StaticEvalSpace::commentToEvalParam(ofs, ev.param_);
     }
-  
-#define Foo(i) s += pol.param(i);\
-    if(M && pol.plearner_ != nullptr){\
-        pol.plearner_->vec_.back().emplace_back(std::pair<int, double>((i), 1.0));}
     
-#define FooX(i, x) s += pol.param(i) * (x);\
-    FASSERT(x,);\
-    if(M && pol.plearner_ != nullptr){\
-        pol.plearner_->vec_.back().emplace_back(std::pair<int, double>((i), (x)));}
+#define Foo(i) s += ev.param(i);\
+    if(M){ ev.feedFeatureScore(m, (i), 1.0); }
     
-    template<int M = 1, class field_t, class policy_t>
-    int calcChangePolicyScoreSlow(double *const dst,
-                                  const Cards *const change,
-                                  const int NChanges,
-                                  const Cards myCards,
-                                  const int NChangeCards,
-                                  const field_t& field,
-                                  const policy_t& pol){
-        
-        using namespace ChangePolicySpace;
-        
-        pol.template initCalculatingScore<M>(N_PLAYERS);
+#define FooX(i, x) s += ev.param(i) * (x);FASSERT(x,);\
+    if(M){ ev.feedFeatureScore(m, (i), (x)); }
+    
+    template<int M = 1, class field_t, class move_t, class evaluator_t>
+    int calcStaticEvalScore(double *const dst,
+                            const int *const players,
+                            const int NPlayers,
+                            const field_t& field,
+                            move_t *const buf,
+                            const evaluator_t& ev){
+        // players[m] が残りの中で次に上がる点を計算する
+        using namespace StaticEvalSpace;
         
-        const Cards pqr = convCards_PQR(myCards);
+        const Board bd = field.getBoard();
+        const int order = bd.tmpOrder();
         
-        // 相対プレーヤー番号から実際のプレーヤー番号への変換
-        int rp2p[N_PLAYERS], rp = 0;
-        for(int s = field.getTurnSeat(); s != field.getTurnSeat(); s = field.getNextSeat()){
-            int p = field.getSeatPlayer(s);
-            if(field.isAlive(p)){
-                rp2p[rp++] = p;
+        // 手番プレーヤーから席順で何人目か(上がったプレーヤーは数えない)
+        int seatDistance[N_PLAYERS] = {0};
+        {
+            int tp = field.getTurnPlayer();
+            for(int d = 0; d < (int)field.getNAlivePlayers(); ++d){
+                seatDistance[tp] = d;
+                do{
+                    tp = field.getNextSeatPlayer(tp);
+                }while(!field.isAlive(tp));
             }
         }
         
-        for(int r0 = RANK_MIN; r0 <= RANK_JOKER; ++r0){
-            for(int rp0 = 0; rp0 < field.getNAlivePlayers(); ++rp0){
-                const int p0 = rp2p[rp0];
-                if((field.getCards(p0) >> (r0 * 4)) & 15){
-                    for(int r1 = r0 + 1; r1 <= RANK_JOKER; ++r1){
-                        for(int rp1 = 0; rp1 < field.getNAlivePlayers(); ++rp1){
-                            const int p1 = rp2p[rp1];
-                            for(int r2 = r1 + 1; r2 <= RANK_JOKER; ++r2){
-                                for(int rp2 = 0; rp2 < field.getNAlivePlayers(); ++rp2){
-                                    const int p2 = rp2p[rp2];
-                if(field.)
-            }
-        }
+        ev.template initCalculatingScore(NPlayers);
         
-        for(int cl = 0; cl < N_PLAYERS; ++cl){
-            
-            pol.template initCalculatingCandidateScore<M>();
-            
-            double s = 0;
-            int i;
-            const Cards changeCards = change[m];
-            const Cards changePlainCards = maskJOKER(changeCards);
-            const Cards afterCards = maskCards(myCards, changeCards);
-            const Cards afterPlainCards = maskJOKER(afterCards);
+        for(int m = 0; m < NPlayers; ++m){
             
-            const Cards afterPqr = convCards_PQR(afterPlainCards);
+            ev.template initCalculatingCandidateScore();
             
-            // 1PQR, SEQ (snowl score except joker)
-            {
-                int base = POL_IDX(POL_CHANGE_HAND_1PQR_SEQ);
-                
-                Cards tmp = afterPlainCards;
-                Cards seq3 = polymRanks<3>(tmp);
-                if(seq3){
-                    Cards seq4 = polymRanks<2>(seq3);
-                    if(seq4){
-                        Cards seq5 = polymRanks<2>(seq4);
-                        if(seq5){
-                            // 6枚以上の階段も5枚階段と同じパラメータで扱う(ダブルカウントしないように注意)
-                            maskCards(&seq4, extractRanks<2>(seq5));
-                            maskCards(&seq3, extractRanks<3>(seq5));
-                            maskCards(&tmp, extractRanks<5>(seq5));
-                            while(1){
-                                IntCard ic = pickIntCardLow(seq5);
-                                
-                                i = base + convIntCard_Rank(ic) - RANK_3;
-                                Foo(i);
-                                
-                                maskCards(&seq5, extractRanks<5>(convCard(ic)));
-                                if(!seq5){ break; }
-                            }
-                        }
-                        if(seq4){
-                            maskCards(&tmp, extractRanks<4>(seq4));
-                            maskCards(&seq3, extractRanks<2>(seq4));
-                            while(1){
-                                IntCard ic = popIntCard(&seq4);
-                                
-                                i = base + 9 + convIntCard_Rank(ic) - RANK_3;
-                                Foo(i);
-                                
-                                if(!seq4){ break; }
-                            }
-                        }
-                    }
-                    if(seq3){
-                        maskCards(&tmp, extractRanks<3>(seq3));
-                        while(1){
-                            IntCard ic = popIntCard(&seq3);
-                            i = base + 19 + convIntCard_Rank(ic) - RANK_3;
-                            Foo(i);
-                            if(!seq3){ break; }
-                        }
-                    }
-                }
-                
-                if(tmp){
-                    base += 30 - 4;
-                    //CERR << OutCards(tmp);
-                    tmp = convCards_PQR(tmp); // 枚数位置型に変換
-                    //CERR << OutCards(tmp) << endl; getchar();
-                    while(1){
-                        IntCard ic = popIntCard(&tmp);
-                        
-                        i = base + ic; // 枚数位置型なのでそのままインデックスになる
-                        Foo(i);
-                        
-                        if(!tmp){break;}
-                    }
-                }
-            }
+            const int p = players[m];
+            const Hand& hand = field.getHand(p);
+            const Cards c = hand.getCards();
+            typename evaluator_t::real_t s = 0;
             
-            { // D3 BONUS
-                constexpr int base = POL_IDX(POL_CHANGE_HAND_D3);
-                if(containsCard(afterCards, CARDS_D3)){
-                    i = base;
-                    Foo(i);
-                }
-            }
+            PlayerPolicySubValue sub;
+            sub.set(hand, buf);
             
-            { // JOKER_S3 BONUS
-                constexpr int base = POL_IDX(POL_CHANGE_HAND_JOKER_S3);
-                if(containsCard(afterCards, CARDS_S3)){
-                    if(containsCard(afterCards, CARDS_JOKER)){ // mine
-                        i = base;
-                        Foo(i);
-                    }else{ // ops
-                        i = base + 1;
-                        Foo(i);
-                    }
-                }else if(containsCard(afterCards, CARDS_JOKER)){
-                    i = base + 2;
-                    Foo(i);
-                }
+            Foo(EVAL_IDX(EVAL_NCARDS) + min((int)hand.qty, EVAL_NUM(EVAL_NCARDS) - 1));
+            Foo(EVAL_IDX(EVAL_NMELDS) + min((int)sub.NParty, EVAL_NUM(EVAL_NMELDS) - 1));
+            FooX(EVAL_IDX(EVAL_RANK), (sub.rankScore[order] - 8) / 4.0);
+            if(containsJOKER(c)){
+                Foo(EVAL_IDX(EVAL_JOKER));
             }
-            
-            { // MAX, MIN RANK
-                Cards tmpPqr = afterPqr;
-                int hr1;
-                if(containsJOKER(afterCards)){
-                    hr1 = RANK_MAX + 1;
-                }else{
-                    IntCard ic = popIntCardHigh(&tmpPqr);
-                    hr1 = getIntCard_Rank(ic);
-                }
-                const int hr2 = getIntCard_Rank(pickIntCardHigh(tmpPqr));
-                const int lr1 = getIntCard_Rank(popIntCardLow(&tmpPqr));
-                const int lr2 = getIntCard_Rank(pickIntCardLow(tmpPqr));
-                
-                FooX(POL_IDX(POL_CHANGE_HAND_MAX1_RANK), hr1);
-                FooX(POL_IDX(POL_CHANGE_HAND_MAX2_RANK), hr2);
-                FooX(POL_IDX(POL_CHANGE_HAND_MIN1_RANK), lr1);
-                FooX(POL_IDX(POL_CHANGE_HAND_MIN2_RANK), lr2);
-            }
-            
-            { // DOUBLE PRESENT, PART SEQ PRESENT
-                if(NChangeCards == 2){
-                    if(!any2Cards(convCards_ER(changePlainCards))){ // 同じ階級のカードをあげる
-                        Foo(POL_IDX(POL_CHANGE_DOUBLE));
-                    }else if(polymRanks<2>(changePlainCards)){ // 同じスートの連続した2階級
-                        Foo(POL_IDX(POL_CHANGE_PART_SEQ));
-                    }else if(polymJump(changePlainCards)){ // 同じスートの1つ飛ばし階級
-                        Foo(POL_IDX(POL_CHANGE_PART_SEQ) + 1);
-                    }
-                }
-            }
-            
-            { // 2 CARDS
-                constexpr int base = POL_IDX(POL_CHANGE_CC);
-                
-                /*const Cards changeRankCards = gatherAll4Bits(changeCards);
-                if(!any2Cards(changeCards)){
-                    IntCard ic = convIntCard(changeRankCards);
-                    unsigned int rx4 = getIntCard_Rankx4(ic);
-                    unsigned int rank = rx4 / 4;
-                    uint32_t suits = (myCards >> rx4) & SUITS_ALL;
-                    for(int r = RANK_MIN; r <= RANK_MAX + 2; ++r){
-                        FooX(base + rank * 16 * 20 + r * 20 + get2SuitsIndex(suits, (myCards >> (r * 4)) & SUITS_ALL), -1);
-                    }
-                    
-                    suits = (afterCards >> rx4) & SUITS_ALL;
-                    for(int r = RANK_MIN; r <= RANK_MAX + 2; ++r){
-                        Foo(base + rank * 16 * 20 + r * 20 + get2SuitsIndex(suits, (afterCards >> (r * 4)) & SUITS_ALL));
-                    }
-                }else{
-                    
-                 
-                }*/
-
-                //Cards addPqr = maskCards(afterPqr | (afterCards & CARDS_JOKER), pqr | (myCards & CARDS_JOKER));
-                //Cards subPqr = maskCards(pqr | (myCards & CARDS_JOKER), afterPqr | (afterCards & CARDS_JOKER));
-                
-                //assert(countCards(addPqr) <= NChangeCards);
-                if(containsJOKER(changeCards)){
-                    for(int r = RANK_MIN; r <= RANK_MAX; ++r){
-                        FooX(base
-                             + (RANK_MAX + 2) * 16 * N_PATTERNS_SUITS_SUITS
-                             + r * N_PATTERNS_SUITS_SUITS
-                             + ((pqr >> (r * 4)) & SUITS_ALL),
-                             -1);
-                        Foo(base
-                            + (RANK_MAX + 2) * 16 * N_PATTERNS_SUITS_SUITS
-                            + r * N_PATTERNS_SUITS_SUITS
-                            + ((afterPqr >> (r * 4)) & SUITS_ALL));  // suits - suits のパターン数より少ないのでOK
-                    }
-                    /*FooX(base
-                         + rank * 16 * N_PATTERNS_SUITS_SUITS
-                         + (RANK_MAX + 2) * N_PATTERNS_SUITS_SUITS
-                         + 1,
-                         -1);*/
-                    /*Foo(base
-                        + rank * 16 * N_PATTERNS_SUITS_SUITS
-                        + (RANK_MAX + 2) * N_PATTERNS_SUITS_SUITS
-                        + 0);*/
-                    // 他のとこでやってくれるからここではいらない
-                }
-                
-                // 交換するランクのカードと他のカードとの関係
-                const Cards diffRanks = convCards_ER(changeCards);
-                Cards tmp = diffRanks;
-                while(tmp){
-                    IntCard ic = popIntCard(&tmp);
-                    unsigned int rx4 = getIntCard_Rankx4(ic);
-                    unsigned int rank = rx4 / 4;
-                    // プレーンカード同士の関係
-                    for(int r = RANK_MIN; r <= RANK_MAX; ++r){
-                        FooX(base
-                             + rank * 16 * N_PATTERNS_SUITS_SUITS
-                             + r * N_PATTERNS_SUITS_SUITS
-                             + getSuitsSuitsIndex((myCards >> rx4) & SUITS_ALL,
-                                                  (myCards >> (r * 4)) & SUITS_ALL),
-                             -1);
-                        Foo(base
-                            + rank * 16 * N_PATTERNS_SUITS_SUITS
-                            + r * N_PATTERNS_SUITS_SUITS
-                            + getSuitsSuitsIndex((afterCards >> rx4) & SUITS_ALL,
-                                                 (afterCards >> (r * 4)) & SUITS_ALL));
-                    }
-                    // ジョーカーとの関係
-                    FooX(base
-                         + rank * 16 * N_PATTERNS_SUITS_SUITS
-                         + (RANK_MAX + 2) * N_PATTERNS_SUITS_SUITS
-                         + ((pqr >> rx4) & SUITS_ALL),
-                         -1);
-                    Foo(base
-                        + rank * 16 * N_PATTERNS_SUITS_SUITS
-                        + (RANK_MAX + 2) * N_PATTERNS_SUITS_SUITS
-                        + ((afterPqr >> rx4) & SUITS_ALL));
-                }
+            FooX(EVAL_IDX(EVAL_EIGHT), countCards(c & CARDS_8));
+            if(sub.hasSeq){
+                Foo(EVAL_IDX(EVAL_SEQ));
             }
+            Foo(EVAL_IDX(EVAL_SEAT) + seatDistance[p]);
             
-            double exps = exp(s / pol.temperature());
+            ev.template feedCandidateScore(m, exp(s / ev.temperature()));
             
-            pol.template feedCandidateScore<M>(exps);
-            
-            if(M){
-                if(dst != nullptr){
-                    dst[m + 1] = dst[m] + exps;
-                }
-            }else{
-                dst[m + 1] = dst[m] + exps;
+            if(!M || dst != nullptr){
+                dst[m] = s;
             }
         }
+        ev.template finishCalculatingScore();
+        
         return 0;
     }
     
-#undef Foo
 #undef FooX
+#undef Foo
     
-    template<class cards_t, class field_t, class policy_t, class dice_t>
-    int changeWithPolicy(const cards_t *const buf, const int NChanges, const Cards myCards, const int NChangeCards,
-                             const field_t& field, const policy_t& pol, dice_t *const pdice){
-        double score[N_MAX_CHANGES + 1];
-        calcChangePolicyScoreSlow<0>(score, buf, NChanges, myCards, NChangeCards, field, pol);
-        double r = pdice->drand() * score[NChanges];
-        return sortedDAsearch(score, 0, NChanges, r);
-    }
-    
-    template<class cards_t, class field_t, class policy_t, class dice_t>
-    int changeWithBestPolicy(const cards_t *const buf, const int NChanges, const Cards myCards, const int NChangeCards,
-                             const field_t& field, const policy_t& pol, dice_t *const pdice){
-        double score[N_MAX_CHANGES + 1];
-        calcChangePolicyScoreSlow<0>(score, buf, NChanges, myCards, NChangeCards, field, pol);
-        int bestIndex[N_MAX_CHANGES];
-        bestIndex[0] = -1;
-        int NBestMoves = 0;
-        double bestScore = -DBL_MAX;
-        for(int m = 0; m < NChanges; ++m){
-            double s = score[m + 1] - score[m];
-            //cerr << OutCards(buf[m]) << " : " << log(s) << endl;
-            if(s > bestScore){
-                bestIndex[0] = m;
-                bestScore = s;
-                NBestMoves = 1;
-            }else if(s == bestScore){
-                bestIndex[NBestMoves] = m;
-                ++NBestMoves;
-            }
+    template<class field_t, class move_t, class evaluator_t, class dice_t>
+    void simulateClassesByStaticEval(field_t *const pfield,
+                                     move_t *const buf,
+                                     const evaluator_t& ev,
+                                     dice_t *const pdice){
+        // 打ち切ったプレイアウトの終局の代わりに、評価関数から上がり順を1つ選んで順位を決める
+        int players[N_PLAYERS];
+        int NPlayers = 0;
+        for(int p = 0; p < N_PLAYERS; ++p){
+            if(pfield->isAlive(p)){ players[NPlayers++] = p; }
+        }
+        double score[N_PLAYERS];
+        calcStaticEvalScore<0>(score, players, NPlayers, *pfield, buf, ev);
+        for(int m = 0; m < NPlayers; ++m){
+            score[m] = exp(score[m] / ev.temperature());
         }
-        if(NBestMoves <= 1){
-            return bestIndex[0];
-        }else{
-            return bestIndex[pdice->rand() % NBestMoves];
+        int cl = pfield->getBestClass();
+        while(NPlayers > 1){
+            double sum = 0;
+            for(int m = 0; m < NPlayers; ++m){ sum += score[m]; }
+            double r = pdice->drand() * sum;
+            int m = 0;
+            for(; m < NPlayers - 1; ++m){
+                r -= score[m];
+                if(r <= 0){ break; }
+            }
+            pfield->setPlayerNewClass(players[m], cl++);
+            // 選ばれたプレーヤーを末尾と入れ替えて外す
+            --NPlayers;
+            std::swap(players[m], players[NPlayers]);
+            std::swap(score[m], score[NPlayers]);
         }
+        pfield->setPlayerNewClass(players[0], cl);
     }
 }
 
-
-
-#endif // UECDA_POLICY_CHANGEPOLICY_HPP_
+#endif // UECDA_EVAL_STATICEVAL_HPP_
@@ -37,6 +37,37 @@ namespace UECda{
             MATCH_CONST bool LnCISearchInSimulation = false;
             MATCH_CONST bool MateSearchInSimulation = true;
             
+            // 打ち切りプレイアウト設定
+            // オンのとき、プレイアウトを truncationPlies 手進めた後の最初の空場で止め、
+            // 順位予測評価関数(static_eval_param.dat)から上がり順を選んで終局とする
+            MATCH_CONST bool truncatedPlayout = false;
+            MATCH_CONST int truncationPlies = 16;
+            
+            // まとめてプレイアウト設定
+            // オンのとき、各スレッドは PLAYOUT_BATCH_SIZE 個の(世界, 候補)の試行を詰めてから
+            // 1手ずつ揃えて進める(共通乱数のときは使わない)
+            MATCH_CONST bool batchPlayout = false;
+            
+            // 末端探索の予算設定
+            // オンのとき、時間制御探索では L2 探索のノード上限と LnCI 探索を行うかどうかを、
+            // スレッドごとに計測した探索時間と決定の残り時間から決める(オフなら常に固定の上限)
+            MATCH_CONST bool adaptiveLeafSearch = true;
+            MATCH_CONST double leafSearchTimeShare = 0.3; // 末端探索に使う時間の割合の目安
+            MATCH_CONST int leafL2NodeLimit = LEAF_L2_NODE_LIMIT;
+            
+            // プレイアウト結果の置換表設定
+            // オンのとき、残り outcomeCacheMaxCards 枚以下の空場の完全情報局面について
+            // 末端探索で確定した上がり順やプレイアウトの上がり順を記録し、同じ局面に来たらそこで終局とする
+            // 確定していない局面では、確率 outcomeCacheReuseRate で記録した標本を使い、残りは最後までプレイアウトする
+            MATCH_CONST bool playoutOutcomeCache = false;
+            MATCH_CONST int outcomeCacheMaxCards = 16;
+            MATCH_CONST double outcomeCacheReuseRate = 0.5;
+            
+            // ルート候補の対称性設定
+            // オンのとき、自分から見た局面を変えないスートの置換で移り合う候補を同一視し、1つだけをモンテカルロで調べる
+            // (対戦で効果を確かめるまではデフォルトはオフ)
+            MATCH_CONST bool rootSymmetryReduction = false;
+            
             MATCH_CONST double simulationTemperatureChange = SIMULATION_TEMPERATURE_CHANGE;
             MATCH_CONST double simulationTemperaturePlay = SIMULATION_TEMPERATURE_PLAY;
             
@@ -53,6 +84,58 @@ namespace UECda{
             
             MATCH_CONST DealType monteCarloDealType = MONTECARLO_DEAL_TYPE;
             
+            MATCH_CONST RootAllocatorType rootAllocator = ROOT_ALLOCATOR;
+            // PROGRESSIVE_WIDENING のとき、プレイアウト n 回で ceil(coef * n^exponent) 個の候補を対象とし、
+            // その中で PUCT (係数 rootPUCTCoef) により選ぶ
+            MATCH_CONST double rootWideningCoef = 1.0;
+            MATCH_CONST double rootWideningExponent = 0.5;
+            MATCH_CONST double rootPUCTCoef = 1.0;
+            
+            // 探索に使うメモリの大きさ
+            // 試合開始時にこの大きさで確保する
+            MATCH_CONST int NThreads = N_THREADS; // スレッドごとの道具の数
+            MATCH_CONST int NWorlds = N_WORLDS;
+            MATCH_CONST int NParticles = N_PARTICLES;
+            MATCH_CONST int NDealerThreads = N_DEALER_THREADS; // 探索開始直後に世界作成を専用に行うスレッド数
+            MATCH_CONST int threadBufferLength = THREAD_BUFFER_LENGTH;
+            MATCH_CONST int L2BookSize = L2_BOOK_SIZE;
+            
+            // 先読み設定
+            // 相手の手番中に世界を作っておく(UECdaの慣習に反するのでデフォルトはオフ)
+            MATCH_CONST bool pondering = false;
+            
+            // 世界の持ち越し設定
+            // オンのとき、試合中は世界をターンごとに作り直さず、着手で進めて尤度で選別し、足りない分だけ作る
+            // (対戦で効果を確かめるまではデフォルトはオフ)
+            MATCH_CONST bool carryWorlds = false;
+            
+            // 重点サンプリング設定
+            // オンのとき、採択棄却法の候補を1つに絞らず全て世界にし、選ばれる確率に比例した重みでプレイアウト結果を集計する
+            MATCH_CONST bool importanceSampling = false;
+            
+            // 棋譜尤度の置換表設定
+            // オンのとき、着手ごとの対数尤度を (手番, プレーヤー, 手札) ごとに覚えて、同じ試合の中で使い回す
+            MATCH_CONST bool playLikelihoodCache = true;
+            
+            // 終盤の配り方の全列挙設定
+            // オンのとき、相手の特定されていないカードの配り方が exactDealMaxPatterns 通り以下(かつ世界プールに入る数)なら
+            // 全て列挙し、棋譜の尤度で重みを付けた世界をサンプリングの代わりに使う
+            MATCH_CONST bool exactEndgameEstimation = true;
+            MATCH_CONST int exactDealMaxPatterns = N_WORLDS;
+            
+            // 共通乱数設定
+            // オンのとき、プレイアウト中の乱数を(世界, 周回)ごとに決まった種から発生させ、
+            // 全ての候補を同じ相手の選択の下で比べる。打ち切り判定には対の差の分散を使う
+            MATCH_CONST bool commonRandomNumbers = false;
+            
+            // 時間制御探索設定
+            // オンのとき、決定ごとに試合の持ち時間から探索時間を割り当て、その時刻で探索を打ち切る
+            MATCH_CONST bool timeLimitedSearch = false;
+            MATCH_CONST uint64_t matchTimeLimitMicS = 100ULL * 60 * 1000 * 1000; // 試合全体の持ち時間
+            MATCH_CONST int NGamesPerMatch = 100;
+            MATCH_CONST uint64_t minDecisionTimeMicS = 2000;
+            MATCH_CONST uint64_t maxDecisionTimeMicS = 2000000;
+            
             // シミュレーション中の相手モデル利用設定
 #ifdef MODELING_PLAY
             MATCH_CONST bool simulationPlayModel = true;
@@ -8,13 +8,17 @@
 
 // 思考用の構造体
 #include "montecarlo/playout.h"
+#include "montecarlo/rootAllocator.hpp"
 
 #include "../structure/field/clientField.hpp"
 #include "estimation/galaxy.hpp"
+#include "estimation/particleFilter.hpp"
+#include "estimation/likelihoodCache.hpp"
 #include "model/playerModel.hpp"
 
 #include "policy/changePolicy.hpp"
 #include "policy/playPolicy.hpp"
+#include "eval/staticEval.hpp"
 
 namespace UECda{
     namespace Fuji{
@@ -24,37 +28,147 @@ namespace UECda{
         // それ以外の重目のデータ構造は SharedData
         // スレッドごとのデータは ThreadTools
         
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+        struct RootStatisticsSlot{
+            // ルートのモンテカルロ統計のうち、まだ全体に反映していない自スレッド分
+            // 他スレッドのデータと同じキャッシュラインに載らないように、ThreadTools の中で前後に詰め物を置く
+            static constexpr int MERGE_INTERVAL = 8; // この回数ごとに全体に反映
+            
+            int NPending; // 未反映のシミュレーション数
+            int NTouched; // 未反映の結果がある候補数
+            int touched[MERGE_INTERVAL];
+            BetaDistribution allScore;
+            std::array<BetaDistribution, N_MAX_MOVES + 64> score;
+            std::array<uint64_t, N_MAX_MOVES + 64> simulations;
+            std::array<uint64_t, N_MAX_MOVES + 64> turnSum;
+            std::array<double, N_MAX_MOVES + 64> weightSum, weightSqSum; // 世界の重みの和と2乗和
+            
+            void feed(int idx, const BetaDistribution& sc, int turns, double weight){
+                if(simulations[idx] == 0)touched[NTouched++] = idx;
+                score[idx] += sc;
+                allScore += sc;
+                simulations[idx] += 1;
+                turnSum[idx] += turns;
+                weightSum[idx] += weight;
+                weightSqSum[idx] += weight * weight;
+                NPending += 1;
+            }
+            bool full()const noexcept{ return NPending >= MERGE_INTERVAL; }
+            void clearPending(){
+                for(int i = 0; i < NTouched; ++i){
+                    const int idx = touched[i];
+                    score[idx].set(0, 0);
+                    simulations[idx] = turnSum[idx] = 0;
+                    weightSum[idx] = weightSqSum[idx] = 0;
+                }
+                allScore.set(0, 0);
+                NPending = NTouched = 0;
+            }
+            void clear(){
+                for(auto& sc : score)sc.set(0, 0);
+                simulations.fill(0);
+                turnSum.fill(0);
+                weightSum.fill(0);
+                weightSqSum.fill(0);
+                allScore.set(0, 0);
+                NPending = NTouched = 0;
+            }
+        };
+#endif
+        
+        struct PlayoutMateStatistics{
+            // プレイアウト中の必勝判定の記録
+            uint64_t turns; // 必勝判定を行った手番
+            uint64_t filtered; // 手札単位の判定で必勝無しとわかった手番
+            uint64_t skippedMoves; // それにより省いた着手ごとの判定
+            uint64_t checkedMoves; // 着手ごとの判定を行った着手
+            uint64_t mates; // 必勝が見つかった手番
+            
+            void clear(){
+                turns = filtered = skippedMoves = checkedMoves = mates = 0;
+            }
+            PlayoutMateStatistics& operator +=(const PlayoutMateStatistics& rhs){
+                turns += rhs.turns;
+                filtered += rhs.filtered;
+                skippedMoves += rhs.skippedMoves;
+                checkedMoves += rhs.checkedMoves;
+                mates += rhs.mates;
+                return *this;
+            }
+            std::string toString()const{
+                std::ostringstream oss;
+                const double n = max(turns, (uint64_t)1);
+                oss << "PlayoutMate : " << turns << " turns";
+                oss << " filtered " << filtered / n;
+                oss << " skipped moves " << skippedMoves << " (checked " << checkedMoves << ")";
+                oss << " mate " << mates / n;
+                return oss.str();
+            }
+            PlayoutMateStatistics(){ clear(); }
+        };
+        
         struct ThreadTools{
             // 各スレッドの持ち物
             using dice64_t = XorShift64;
             using move_t = MoveInfo;
             
-#ifndef POLICY_ONLY
-            // MCしないなら世界生成なし
-            using galaxy_t = Galaxy<ImaginaryWorld>;
-            
-            // 世界生成プール
-            galaxy_t gal;
-#endif
             // サイコロ
             dice64_t dice;
             
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+            // ルート統計の未反映分
+            // ThreadTools は std::vector に並べるので、C++14 では alignas による整列が保証されない
+            // 隣のスレッドの道具とキャッシュラインを共有しないよう、前後に1ライン分の詰め物を置く
+            static constexpr int CACHE_LINE_SIZE = 64;
+            char rootSlotPaddingFront[CACHE_LINE_SIZE];
+            RootStatisticsSlot rootSlot;
+            char rootSlotPaddingBack[CACHE_LINE_SIZE];
+#endif
+            
             // 着手生成バッファ
-            static constexpr int BUFFER_LENGTH = 8192;
+            static constexpr int BUFFER_LENGTH = THREAD_BUFFER_LENGTH;
             
             // スレッド番号
             int threadIndex;
             
-            move_t buf[BUFFER_LENGTH];
+            move_t *buf;
+            int bufferLength;
+            std::unique_ptr<move_t[]> bufferMemory;
+            
+            // 世界ごとのプレイアウト開始局面の手札
+            PlayoutWorldCache worldCache;
             
-            void init(int index){
-                memset(buf, 0, sizeof(buf));
+            // まとめて進めるプレイアウト
+            PlayoutBatch playoutBatch;
+            
+            // プレイアウト中の必勝判定の記録
+            PlayoutMateStatistics mateStats;
+            
+            // プレイアウト末端探索の予算
+            LeafSearchController leafSearch;
+            
+            // プレイアウト結果の置換表
+            PlayoutOutcomeCache outcomeCache;
+            
+            // 棋譜尤度の項の置換表
+            PlayLikelihoodCache likelihoodCache;
+            
+            // 世界作成の記録
+            WorldPipelineStatistics pipelineStats;
+            
+            void init(int index, int length = BUFFER_LENGTH){
+                if(bufferMemory == nullptr || bufferLength != length){
+                    bufferLength = length;
+                    bufferMemory.reset(new move_t[bufferLength]);
+                    buf = bufferMemory.get();
+                }
+                memset(buf, 0, sizeof(move_t) * bufferLength);
                 threadIndex = index;
-#ifndef POLICY_ONLY
-                gal.clear();
-#endif
             }
             void close(){}
+            
+            ThreadTools():
+            threadIndex(0), buf(nullptr), bufferLength(0){}
         };
         
         struct SharedData{
@@ -86,14 +200,24 @@ namespace UECda{
 #endif
             
 #ifndef POLICY_ONLY
-            using galaxy_t = ThreadTools::galaxy_t;
-            GalaxyAnalyzer<galaxy_t, N_THREADS> ga;
+            // MCしないなら世界生成なし
+            using galaxy_t = Galaxy<ImaginaryWorld>;
+            
+            // 世界生成プール(全スレッドで共有)
+            galaxy_t gal;
+            GalaxyAnalyzer<galaxy_t, 1> ga;
+            // 粒子フィルタによる相手手札推定(DealType::PARTICLE のとき)
+            ParticleFilter particles;
             MyTimeAnalyzer timeAnalyzer;
+            SearchTimeManager timeManager;
             
             // 推定用方策
             ChangePolicy<policy_value_t> estimationChangePolicy;
             PlayPolicy<policy_value_t> estimationPlayPolicy;
             
+            // 打ち切りプレイアウト用の順位予測
+            StaticEvaluator<policy_value_t> staticEvaluator;
+            
             // 相手方策モデリング
             PlayerModelSpace playerModelSpace;
 #endif
@@ -233,10 +357,24 @@ namespace UECda{
             uint64_t simulations;
             std::array<std::array<int64_t, N_CLASSES>, N_PLAYERS> classDistribution;
             uint64_t turnSum;
+            // プレイアウトした世界の重みの和と2乗和(重点サンプリングのときに標準誤差に使う)
+            double weightSum, weightSqSum;
+            
+            static BetaDistribution effectiveScore(BetaDistribution sc, double wSum, double wSqSum){
+                // 重み付きの結果が入った分布を、平均はそのままで
+                // 重み付きの分の大きさ Σw を有効サンプル数 (Σw)^2 / Σw^2 に置き換えた大きさに縮める
+                // 重みが全て 1 なら変わらない
+                const double n = sc.size();
+                if(wSqSum > 0 && n > 0)sc *= (n - wSum + wSum * wSum / wSqSum) / n;
+                return sc;
+            }
+            BetaDistribution effectiveScore()const{
+                return effectiveScore(monteCarloScore, weightSum, weightSqSum);
+            }
             
             double mean()const{ return monteCarloScore.mean(); }
             double size()const{ return monteCarloScore.size(); }
-            double mean_var()const{ return monteCarloScore.var(); }
+            double mean_var()const{ return effectiveScore().var(); } // 有効サンプル数による推定平均値の分散
             double var()const{ return monteCarloScore.var() * size(); }
             double naive_mean()const{ return naiveScore.mean(); }
             
@@ -254,6 +392,7 @@ namespace UECda{
                 changeCards = CARDS_NULL;
                 simulations = 0;
                 turnSum = 0;
+                weightSum = weightSqSum = 0;
                 for(int p = 0; p < N_PLAYERS; ++p)
                     for(int cl = 0; cl < N_CLASSES; ++cl)
                         classDistribution[p][cl] = 0;
@@ -292,9 +431,25 @@ namespace UECda{
             // モンテカルロ用の情報
             bool exitFlag;
             uint64_t limitSimulations;
-            //uint64_t limitTime;
+            // 時間制御探索のとき、この時刻で打ち切る
+            bool timeLimited;
+            std::chrono::steady_clock::time_point deadline;
             BetaDistribution monteCarloAllScore;
             uint64_t allSimulations;
+            // 割り振りにより最善候補が決まった時点のシミュレーション数(決まらなかった場合は0)
+            std::atomic<uint64_t> decidedSimulations;
+            // 候補を絞る割り振り方式での、全スレッド共通の生き残りの候補
+            RootElimination elimination;
+            // 共通乱数を使うとき、世界ごとの各候補の最初(周回0)の結果
+            // 同じ世界、同じ乱数での2候補の結果の差(対の差)から、候補間の差の分散を求める
+            bool commonRandom;
+            uint64_t commonSeed;
+            int pairedWorlds;
+            std::unique_ptr<std::atomic<float>[]> pairedReward; // 未記録は負の値
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+            // 反映前のものも含めた全体のシミュレーション数(打ち切り判定用)
+            alignas(64) std::atomic<uint64_t> fedSimulations;
+#endif
 #ifdef MULTI_THREADING
             SpinLock<int> lock_;
             void lock()noexcept{ lock_.lock(); }
@@ -346,6 +501,103 @@ namespace UECda{
                 std::swap(child[m], child[--candidates]);
                 child[candidates].pruned = true;
             }
+            int pruneUnvisited(){
+                // 一度もプレイアウトしなかった候補を除外する(プレイアウトした候補が無ければ何もしない)
+                // 除外した数を返す
+                bool visited = false;
+                for(int m = 0; m < candidates; ++m){
+                    if(child[m].simulations > 0)visited = true;
+                }
+                if(!visited)return 0;
+                int pruned = 0;
+                for(int m = candidates - 1; m >= 0; --m){
+                    if(child[m].simulations == 0){
+                        prune(m);
+                        ++pruned;
+                    }
+                }
+                return pruned;
+            }
+            int pruneEliminated(){
+                // 候補を絞る割り振り方式で除かれた候補を除外する(生き残りの候補を着手とする)
+                // 除外した数を返す
+                if(!elimination.active())return 0;
+                bool survived[N_MAX_MOVES + 64];
+                for(int m = 0; m < candidates; ++m)survived[m] = elimination.survives(m);
+                int pruned = 0;
+                for(int m = candidates - 1; m >= 0; --m){
+                    if(!survived[m]){
+                        prune(m);
+                        ++pruned;
+                    }
+                }
+                return pruned;
+            }
+            template<class callback_t>
+            int mergeEquivalentCandidates(const callback_t& key){
+                // 同一視できる候補(key の値が同じもの)は最初の1つだけを候補に残す
+                // 除外した数を返す
+                int merged = 0;
+                for(int m = candidates - 1; m > 0; --m){
+                    for(int j = 0; j < m; ++j){
+                        if(key(child[j]) == key(child[m])){
+                            prune(m);
+                            ++merged;
+                            break;
+                        }
+                    }
+                }
+                return merged;
+            }
+            template<class callback_t>
+            void shareEquivalentStatistics(const callback_t& key){
+                // 除外した候補に、同一視した候補のモンテカルロ結果を写す
+                for(int k = candidates; k < actions; ++k){
+                    if(!child[k].pruned)continue;
+                    for(int j = 0; j < candidates; ++j){
+                        if(key(child[j]) == key(child[k])){
+                            RootAction& a = child[k];
+                            const RootAction& b = child[j];
+                            a.monteCarloScore = b.monteCarloScore;
+                            a.naiveScore = b.naiveScore;
+                            a.myScore = b.myScore;
+                            a.rivalScore = b.rivalScore;
+                            a.simulations = b.simulations;
+                            a.classDistribution = b.classDistribution;
+                            a.turnSum = b.turnSum;
+                            a.weightSum = b.weightSum;
+                            a.weightSqSum = b.weightSqSum;
+                            break;
+                        }
+                    }
+                }
+            }
+            int addStatistics(const RootInfo& src){
+                // 同じ局面について先に行ったモンテカルロ(先読み)の結果を、同じ着手の候補に加える
+                // 結果を加えた候補の数を返す
+                int added = 0;
+                for(int m = 0; m < candidates; ++m){
+                    for(int k = 0; k < src.candidates; ++k){
+                        const RootAction& s = src.child[k];
+                        if(s.simulations == 0 || (uint32_t)s.move.mv() != (uint32_t)child[m].move.mv())continue;
+                        RootAction& a = child[m];
+                        a.monteCarloScore += s.naiveScore;
+                        a.naiveScore += s.naiveScore;
+                        a.simulations += s.simulations;
+                        a.turnSum += s.turnSum;
+                        a.weightSum += s.weightSum;
+                        a.weightSqSum += s.weightSqSum;
+                        monteCarloAllScore += s.naiveScore;
+                        allSimulations += s.simulations;
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+                        fedSimulations += s.simulations;
+#endif
+                        ++added;
+                        break;
+                    }
+                }
+                return added;
+            }
             void addPolicyScoreToMonteCarloScore(){
                 // 方策関数の出力をモンテカルロ結果の事前分布として加算
                 // 0 ~ 1 の値にする
@@ -380,10 +632,126 @@ namespace UECda{
                     child[m].policyProb = selector.prob(m);
             }
             
+            void setDeadline(std::chrono::steady_clock::time_point t){
+                // 時間制御探索にする
+                // 打ち切りは時刻で行うので、回数制限は安全のための大きな値にしておく
+                timeLimited = true;
+                deadline = t;
+                limitSimulations = 1000000;
+            }
+            bool pastDeadline()const{
+                return timeLimited && std::chrono::steady_clock::now() >= deadline;
+            }
+            
+            void setCommonRandomNumbers(int worlds, uint64_t seed){
+                // 共通乱数を使う(モンテカルロ開始前に呼ぶ)
+                commonRandom = true;
+                commonSeed = seed;
+                pairedWorlds = worlds;
+                const int cells = worlds * max(candidates, 1);
+                pairedReward.reset(new std::atomic<float>[cells]);
+                for(int i = 0; i < cells; ++i)pairedReward[i].store(-1.0f, std::memory_order_relaxed);
+            }
+            uint64_t trialSeed(int world, int round)const{
+                // (世界, 周回)ごとのプレイアウトの乱数の種
+                // 候補によらないので、同じ世界の同じ周回では全候補が同じ乱数列でプレイアウトする
+                uint64_t z = commonSeed + (uint64_t)world * 0x9E3779B97F4A7C15ULL + (uint64_t)round * 0xD1B54A32D192ED03ULL;
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                return z ^ (z >> 31);
+            }
+            void feedPairedResult(int world, int triedIndex, const PlayouterField& field){
+                // 周回0の結果を記録する(既に記録があれば何もしない)
+                if(world < 0 || world >= pairedWorlds)return;
+                const float r = (field.infoReward[myPlayerNum] - worstReward) / (float)rewardGap;
+                std::atomic<float>& cell = pairedReward[world * candidates + triedIndex];
+                if(cell.load(std::memory_order_relaxed) < 0)cell.store(r, std::memory_order_relaxed);
+            }
+            double pairedDiffSem(int j, int b, int minPairs = 8)const{
+                // 候補 j と b の対の差の平均値の標準誤差
+                // 対が少ないときは負の値を返す
+                if(!commonRandom)return -1;
+                int n = 0;
+                double sum = 0, sum2 = 0;
+                for(int w = 0; w < pairedWorlds; ++w){
+                    const float rj = pairedReward[w * candidates + j].load(std::memory_order_relaxed);
+                    const float rb = pairedReward[w * candidates + b].load(std::memory_order_relaxed);
+                    if(rj < 0 || rb < 0)continue;
+                    const double d = rj - rb;
+                    n += 1; sum += d; sum2 += d * d;
+                }
+                if(n < minPairs)return -1;
+                // 差が全て同じだと分散0で即座に打ち切ってしまうので、大きさ1の差を1つ仮に加えておく
+                const double mean = sum / n;
+                const double var = (max(0.0, sum2 - n * mean * mean) + 1) / n;
+                return sqrt(var / n);
+            }
+            
+            void setDecided(){
+                uint64_t sims = allSimulations;
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+                sims = max(sims, fedSimulations.load());
+#endif
+                uint64_t expected = 0;
+                decidedSimulations.compare_exchange_strong(expected, max(sims, (uint64_t)1));
+            }
+            uint64_t simulationsToDecision()const{
+                const uint64_t decided = decidedSimulations;
+                return decided > 0 ? decided : allSimulations;
+            }
+            
+            bool reachedLimit(uint64_t sims)const{
+#ifdef FIXED_N_PLAYOUTS
+                return sims >= (FIXED_N_PLAYOUTS);
+#else
+                return sims >= limitSimulations;
+#endif
+            }
+            
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+            template<class shared_t>
+            void feedSimulationResult(int triedIndex, const PlayouterField& field, shared_t *const pshared,
+                                      RootStatisticsSlot *const pslot, double weight = 1){
+                // シミュレーション結果をスレッドの統計に記録
+                // MERGE_INTERVAL 回ごとに全体に反映するので、ロックを取る回数が減る
+                // weight はプレイアウトした世界の重み(重点サンプリングのとき)
+                int myRew = field.infoReward[myPlayerNum];
+                ASSERT(0 <= myRew && myRew <= bestReward, cerr << myRew << endl;);
+                
+                BetaDistribution mySc = BetaDistribution((myRew - worstReward) / (double)rewardGap,
+                                                         (bestReward - myRew) / (double)rewardGap);
+                mySc *= weight;
+                pslot->feed(triedIndex, mySc, field.getTurnNum(), weight);
+                if(pslot->full())mergeStatistics(pslot);
+                
+                if(reachedLimit(fedSimulations.fetch_add(1, std::memory_order_relaxed) + 1))exitFlag = true;
+            }
+            void mergeStatistics(RootStatisticsSlot *const pslot){
+                // スレッドの未反映の統計を全体に反映
+                if(pslot->NPending == 0)return;
+                lock();
+                for(int i = 0; i < pslot->NTouched; ++i){
+                    const int idx = pslot->touched[i];
+                    child[idx].monteCarloScore += pslot->score[idx];
+                    child[idx].naiveScore += pslot->score[idx];
+                    child[idx].simulations += pslot->simulations[idx];
+                    child[idx].turnSum += pslot->turnSum[idx];
+                    child[idx].weightSum += pslot->weightSum[idx];
+                    child[idx].weightSqSum += pslot->weightSqSum[idx];
+                }
+                monteCarloAllScore += pslot->allScore;
+                allSimulations += pslot->NPending;
+                unlock();
+                pslot->clearPending();
+            }
+#endif
+            
             template<class shared_t>
-            void feedSimulationResult(int triedIndex, const PlayouterField& field, shared_t *const pshared){
+            void feedSimulationResult(int triedIndex, const PlayouterField& field, shared_t *const pshared,
+                                      double weight = 1){
                 // シミュレーション結果を記録
                 // ロックが必要な演算とローカルでの演算が混ざっているのでこの関数内で排他制御する
+                // weight はプレイアウトした世界の重み(重点サンプリングのとき)
                 
                 // 新たに得た証拠分布
                 int myRew = field.infoReward[myPlayerNum];
@@ -392,6 +760,7 @@ namespace UECda{
                 // 自分のシミュレーション結果を分布に変換
                 BetaDistribution mySc = BetaDistribution((myRew - worstReward) / (double)rewardGap,
                                                          (bestReward - myRew) / (double)rewardGap);
+                mySc *= weight;
                 
 #ifdef DEFEAT_RIVAL_MC
                 if(rivalPlayerNum < 0){ // 自分の結果だけ考えるとき
@@ -405,6 +774,7 @@ namespace UECda{
                     
                     BetaDistribution rivalSc = BetaDistribution((rivalRew - worstReward) / (double)rewardGap,
                                                                 (bestReward - rivalRew) / (double)rewardGap);
+                    rivalSc *= weight;
                     
                     constexpr double RIVAL_RATE = 1 / 16.0; // ライバルの結果を重視する割合 0.5 で半々
                     
@@ -426,16 +796,14 @@ namespace UECda{
 #endif
                 
                 child[triedIndex].simulations += 1;
+                child[triedIndex].weightSum += weight;
+                child[triedIndex].weightSqSum += weight * weight;
                 allSimulations += 1;
                 
                 // 以下参考にする統計量
                 child[triedIndex].turnSum += field.getTurnNum();
                 
-#ifdef FIXED_N_PLAYOUTS
-                if(allSimulations >= (FIXED_N_PLAYOUTS))exitFlag = true;
-#else
-                if(allSimulations >= limitSimulations)exitFlag = true;
-#endif
+                if(reachedLimit(allSimulations))exitFlag = true;
                 unlock();
             }
             
@@ -487,7 +855,9 @@ namespace UECda{
                 std::ostringstream oss;
                 // 先にソートしておく必要あり
                 oss << "Reward Zone [ " << worstReward << " ~ " << bestReward << " ] ";
-                oss << allSimulations << " trials." << endl;
+                oss << allSimulations << " trials";
+                if(decidedSimulations > 0)oss << " (decided at " << decidedSimulations << ")";
+                oss << "." << endl;
                 for(int m = 0; m < min(actions, num); ++m){
                     const int rg = (int)(child[m].mean() * rewardGap);
                     const int rew = rg + worstReward;
@@ -536,12 +906,25 @@ namespace UECda{
             }
             
             RootInfo(){
+                init();
+                unlock();
+            }
+            void init(){
+                // 統計を全て消す(先読み用のルートを使い回すとき)
                 actions = candidates = -1;
                 monteCarloAllScore.set(0, 0);
                 allSimulations = 0;
+                decidedSimulations = 0;
+                elimination.reset();
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+                fedSimulations = 0;
+#endif
                 rivalPlayerNum = -1;
                 exitFlag = false;
-                unlock();
+                timeLimited = false;
+                commonRandom = false;
+                commonSeed = 0;
+                pairedWorlds = 0;
             }
         };
     }
@@ -61,6 +61,10 @@ namespace UECda{
     int searchHandMate(const int, MoveInfo *const, const int,
                        const Hand&, const Hand&, const Board&, const FieldAddInfo&);
     
+    template<int IS_NF = _BOTH, int IS_UNRIVALED = _BOTH>
+    int checkHandMateAll(const int, MoveInfo *const, const int, int *const,
+                         const Hand&, const Hand&, const Board&, const FieldAddInfo&);
+    
     
     // 汎用関数
     bool judgeMate_1M_NF(const Hand& myHand){
@@ -713,6 +717,82 @@ namespace UECda{
         return -1;
     }
     
+    // プレイアウト用
+    // プレイアウトでは全着手について深さ0の checkHandMate を行うが、
+    // 必勝から遠い局面がほとんどなので、手札単位で先に判定して着手ごとの判定を省く
+    
+    bool judgeNoMate_Easy(const Hand& myHand, const Hand& opsHand,
+                          const Board& argBd, const FieldAddInfo& fieldInfo){
+        // 深さ0の checkHandMate が全ての着手で false になることが確定すれば true
+        // ジョーカー、階段、4枚グループの無い手札(大部分)のみ扱う
+        // このとき着手はパスと1ランクのグループだけでオーダーは変わらず、
+        // 支配した後の空場必勝(judgeMate_Easy_NF, judgeHandPW_NF)は
+        // 8以外で相手に返されるランクが1つ以下のときのみ成り立つ
+        // 小さいグループほど返されやすいので、1つのグループを出して減る「返されるランク」は高々1つであり、
+        // 元の手札に3つ以上あればどの着手も必勝ではない
+        if(fieldInfo.isUnrivaled() || fieldInfo.isPassDom())return false;
+        if(myHand.jk || myHand.seq || (myHand.pqr & PQR_4))return false;
+        const Cards ndpqr = myHand.pqr & opsHand.nd[argBd.tmpOrder()] & ~CARDS_8;
+        return countCards(ndpqr) >= 3;
+    }
+    
+    void setDominanceFlags(MoveInfo *const buf, const int NMoves,
+                           const Hand& myHand, const Hand& opsHand,
+                           const Board& argBd, const FieldAddInfo& fieldInfo){
+        // judgeNoMate_Easy で着手ごとの判定を省いたときに、
+        // 深さ0の checkHandMate が付けるはずの支配フラグだけを付ける
+        // (プレイアウトでは支配フラグを見て場を流すので省けない)
+        for(int m = 0; m < NMoves; ++m){
+            MoveInfo& mv = buf[m];
+            if(mv.isPASS())continue;
+            if(dominatesHand(mv.mv(), opsHand, argBd)
+               || mv.qty() > fieldInfo.getMaxNCardsAwake()){
+                mv.setDO();
+            }
+        }
+    }
+    
+    template<int IS_NF, int IS_UNRIVALED>
+    int checkHandMateAll(const int depth, MoveInfo *const buf, const int NMoves, int *const mateIndex,
+                         const Hand& myHand, const Hand& opsHand,
+                         const Board& argBd, const FieldAddInfo& fieldInfo){
+        // 全着手の必勝判定をまとめて行い、必勝着手の番号を mateIndex に入れてその数を返す
+        // ジョーカー、階段、4枚グループの無い手札では、支配した後の空場必勝判定の結果は
+        // 出したランクと枚数だけで決まるので、スートの違う着手の間で使い回す
+        // (支配するかどうかはスートしばりに関わるので着手ごとに判定する)
+        const bool plain = (depth == 0) && !fieldInfo.isUnrivaled()
+        && !myHand.jk && !myHand.seq && !(myHand.pqr & PQR_4);
+        int8_t memo[16][4]; // ランク, 枚数 (4枚以上のグループは無い)
+        if(plain){
+            for(auto& row : memo)for(auto& v : row)v = -1;
+        }
+        int mates = 0;
+        for(int m = 0; m < NMoves; ++m){
+            MoveInfo& mv = buf[m];
+            bool mate;
+            if(plain && !mv.isPASS() && mv.qty() < myHand.qty){
+                if(dominatesHand(mv.mv(), opsHand, argBd)
+                   || mv.qty() > fieldInfo.getMaxNCardsAwake()){
+                    int8_t& result = memo[mv.rank()][mv.qty()];
+                    if(result < 0){
+                        result = checkHandMate<IS_NF, IS_UNRIVALED>(0, buf + NMoves, mv,
+                                                                    myHand, opsHand, argBd, fieldInfo) ? 1 : 0;
+                    }else{
+                        mv.setDO(); // 支配フラグ付加
+                    }
+                    mate = result;
+                }else{
+                    mate = false; // 深さ0では支配しない着手は必勝でない
+                }
+            }else{
+                mate = checkHandMate<IS_NF, IS_UNRIVALED>(depth, buf + NMoves, mv,
+                                                          myHand, opsHand, argBd, fieldInfo);
+            }
+            if(mate){ mateIndex[mates++] = m; }
+        }
+        return mates;
+    }
+    
     
     // ルートノード用の必勝判定関数
     // 速度度外視で丁寧に読む
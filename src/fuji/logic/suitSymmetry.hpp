@@ -0,0 +1,90 @@
+/*
+ suitSymmetry.hpp
+ Katsuki Ohto
+ */
+
+// スートの対称性の判定
+
+#ifndef UECDA_LOGIC_SUITSYMMETRY_HPP_
+#define UECDA_LOGIC_SUITSYMMETRY_HPP_
+
+namespace UECda{
+    
+    // スートの置換 perm[s] はスート s (スートのビット位置) の移り先
+    
+    inline uint32_t permuteSuits(uint32_t s, const int perm[4])noexcept{
+        uint32_t ps = 0;
+        for(int i = 0; i < 4; ++i){
+            if(s & (1U << i))ps |= 1U << perm[i];
+        }
+        return ps;
+    }
+    
+    inline Cards permuteCardsSuits(Cards c, const int perm[4])noexcept{
+        // ジョーカーはそのまま
+        Cards pc = c & ~CARDS_CDHS;
+        for(int i = 0; i < 4; ++i){
+            pc |= ((c & SuitsToCards(1U << i)) >> i) << perm[i];
+        }
+        return pc;
+    }
+    
+    inline bool fixesSuitsSet(uint32_t suitsSet, const int perm[4])noexcept{
+        // suitsSet に (1 << s) が立っている全てのスート集合 s を置換が変えないか
+        for(uint32_t s = 0; s < 16; ++s){
+            if((suitsSet & (1U << s)) && permuteSuits(s, perm) != s)return false;
+        }
+        return true;
+    }
+    
+    struct SuitSymmetry{
+        // 自分から見た局面を変えないスートの置換を列挙し、
+        // それで移り合う着手を同一視する
+        // 局面を変えないとは、自分の手札、残りの未知のカード、相手が持っていると分かっているカード、
+        // 場のスートを全て変えないことをいう
+        // スペードの3は単体ジョーカーを返せるので、残っている場合はスペードを動かさない
+        // 相手の手札推定はこの試合の棋譜を再生して尤度を計算するので、
+        // 過去の着手のスートを1つでも動かす置換では世界の分布が対称にならない
+        // (縛りやその下でのパスの尤度もスートによって変わる)
+        // playedSuits はこの試合で出された着手のスート集合 s について (1 << s) の論理和で、
+        // それらを全て変えない置換だけを使う
+        
+        int NPerms; // 恒等置換以外の数
+        int perm[24][4];
+        
+        void init(Cards myCards, Cards opsCards, Cards knownCards, Board bd, uint32_t playedSuits = 0){
+            NPerms = 0;
+            const bool S3Remains = containsS3(addCards(myCards, opsCards));
+            int p[4] = {0, 1, 2, 3};
+            do{
+                if(p[0] == 0 && p[1] == 1 && p[2] == 2 && p[3] == 3)continue;
+                if(S3Remains && p[3] != 3)continue;
+                if(bd.isRF() && permuteSuits(bd.suits(), p) != bd.suits())continue;
+                if(!fixesSuitsSet(playedSuits, p))continue;
+                if(permuteCardsSuits(myCards, p) != myCards)continue;
+                if(permuteCardsSuits(opsCards, p) != opsCards)continue;
+                if(permuteCardsSuits(knownCards, p) != knownCards)continue;
+                for(int i = 0; i < 4; ++i)perm[NPerms][i] = p[i];
+                ++NPerms;
+            }while(std::next_permutation(p, p + 4));
+        }
+        bool any()const noexcept{ return NPerms > 0; }
+        
+        uint64_t canonicalKey(Move m)const noexcept{
+            // 移り合う着手で同じになる値
+            // パスやジョーカーを含む着手は同一視しない
+            const uint32_t raw = (uint32_t)m;
+            if(m.isPASS() || m.containsJOKER())return (1ULL << 32) | raw;
+            uint32_t key = raw;
+            for(int i = 0; i < NPerms; ++i){
+                const uint32_t pkey = (raw & ~MOVE_FLAG_SUITS) | (permuteSuits(m.suits(), perm[i]) << MOVE_LCT_SUITS);
+                key = min(key, pkey);
+            }
+            return key;
+        }
+        
+        SuitSymmetry(): NPerms(0){}
+    };
+}
+
+#endif // UECDA_LOGIC_SUITSYMMETRY_HPP_
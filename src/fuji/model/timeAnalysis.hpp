@@ -32,6 +32,13 @@ namespace UECda{
             uint64_t my_play_time_lock;
             uint64_t my_play_time_sum;
             uint64_t my_plays;
+            uint64_t my_change_time_sum;
+            uint64_t my_changes;
+            
+            uint64_t usedTime()const noexcept{
+                // これまでに自分の着手決定と交換決定に使った時間(マイクロ秒)
+                return my_play_time_sum + my_change_time_sum;
+            }
             
             void modifyTimeRate(){
                 //プレーヤーの平均計算時間(自分が計測。通信の影響を受けていないもの)に合わせ、枠を調節する
@@ -58,6 +65,60 @@ namespace UECda{
                 my_play_time_lock = false;
                 my_play_time_sum = 0ULL;
                 my_plays = 0U;
+                my_change_time_sum = 0ULL;
+                my_changes = 0U;
+            }
+        };
+        
+        struct SearchTimeManager{
+            // 試合全体の持ち時間から、1回の決定に使う探索時間(マイクロ秒)を割り当てる
+            // 残り時間は MyTimeAnalyzer に記録された自分の使用時間から計算する
+            uint64_t matchTimeLimit;
+            int NGames;
+            uint64_t minTime, maxTime;
+            
+            void init(uint64_t limit, int games, uint64_t tmin, uint64_t tmax){
+                matchTimeLimit = limit;
+                NGames = max(1, games);
+                minTime = tmin;
+                maxTime = max(tmin, tmax);
+            }
+            
+            uint64_t remainingTime(const MyTimeAnalyzer& ta)const{
+                const uint64_t used = ta.usedTime();
+                return used < matchTimeLimit ? (matchTimeLimit - used) : 0ULL;
+            }
+            
+            uint64_t calcBudget(const MyTimeAnalyzer& ta, int gameNum,
+                                int myNCards, int candidates, bool isChange)const{
+                // 残り着手決定回数の見積もり
+                // 1試合あたりのプレー回数はこれまでの記録から(無ければ1枚ずつ出すとして見積もる)
+                const int games = max(1, gameNum);
+                const double playsPerGame = (ta.my_plays > 0) ? (ta.my_plays / (double)games) : 11.0;
+                const double decisionsPerGame = playsPerGame + 1; // 交換1回分
+                const double restPlaysInGame = isChange ? decisionsPerGame
+                : max(1.0, playsPerGame * myNCards / 11.0); // 手札の残り枚数に比例
+                const int restGames = max(0, NGames - 1 - (gameNum % NGames));
+                const double restDecisions = restGames * decisionsPerGame + restPlaysInGame;
+                
+                const uint64_t remaining = remainingTime(ta);
+                double budget = remaining / max(1.0, restDecisions);
+                
+                // 局面による重み付け
+                // 候補が多い局面ほど時間を掛ける(従来の打ち切り回数 pow(候補数, 0.8) と同じ形)
+                // 交換は序盤の重要な決定なので多めにする
+                double weight = pow((double)max(candidates, 2), 0.8) / 4.0;
+                weight = min(4.0, max(0.25, weight));
+                if(isChange)weight *= 1.5;
+                budget *= weight;
+                
+                // 1回で残り時間の1/4以上は使わない
+                budget = min(budget, remaining / 4.0);
+                return min(maxTime, max(minTime, (uint64_t)budget));
+            }
+            
+            SearchTimeManager(){
+                init(100ULL * 60 * 1000 * 1000, 100, 2000, 2000000);
             }
         };
         
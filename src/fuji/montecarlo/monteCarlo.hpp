@@ -8,6 +8,8 @@
 #include "../../settings.h"
 #include "../estimation/dealer.hpp"
 #include "playouter.hpp"
+#include "stoppingRule.hpp"
+#include "rootAllocator.hpp"
 
 // マルチスレッディングのときはスレッド、
 // シングルの時は関数として呼ぶ
@@ -15,9 +17,117 @@
 namespace UECda{
     namespace Fuji{
         
+        template<class field_t, class sharedData_t, class threadTools_t>
+        void ReweightThread
+        (const int threadId, const int threads,
+         const field_t *const pfield,
+         sharedData_t *const pshared,
+         threadTools_t *const ptools,
+         double *const delta){
+            // 持ち越した世界の尤度の再評価を threads 個のスレッドで分担する
+            // 世界 w の結果は delta[w] に入れる
+            auto& gal = pshared->gal;
+            RandomDealer<N_PLAYERS> estimator;
+            estimator.set(*pfield, *pshared);
+            
+            const int limit = gal.actives;
+            for(int w = threadId; w < limit; w += threads){
+                delta[w] = estimator.reweightWorld(gal.access(w), *pfield, *pshared, ptools);
+            }
+        }
+        
+        template<class field_t, class sharedData_t, class threadTools_t>
+        void EnumerationThread
+        (const int threadId, const int threads,
+         const field_t *const pfield,
+         sharedData_t *const pshared,
+         threadTools_t *const ptools,
+         const double *const logPrior,
+         const std::chrono::steady_clock::time_point *const pdeadline,
+         std::atomic<bool> *const pexpired){
+            // 列挙した世界の棋譜の尤度の計算を threads 個のスレッドで分担する
+            // 世界 w の対数の重み(尤度 + 事前の重み logPrior[w])を weight に入れる
+            // 期限 pdeadline を過ぎたら途中でやめて pexpired を立てる
+            auto& gal = pshared->gal;
+            RandomDealer<N_PLAYERS> estimator;
+            estimator.set(*pfield, *pshared);
+            
+            const int limit = gal.actives;
+            for(int w = threadId; w < limit; w += threads){
+                if(pexpired->load(std::memory_order_relaxed))return;
+                if(pdeadline != nullptr && std::chrono::steady_clock::now() >= *pdeadline){
+                    pexpired->store(true);
+                    return;
+                }
+                auto *const pw = gal.access(w);
+                Cards c[N_PLAYERS];
+                for(int p = 0; p < N_PLAYERS; ++p)c[p] = pw->getCards(p);
+                pw->logLikelihood = estimator.calcPlayLikelihood(c, *pshared, ptools);
+                pw->weight = pw->logLikelihood + logPrior[w]; // ここでは対数
+            }
+        }
+        
+        template<class field_t, class sharedData_t, class threadTools_t>
+        void ParticleThread
+        (const int threadId, const int threads, const bool redeal, const int fromTurn,
+         const field_t *const pfield,
+         sharedData_t *const pshared,
+         threadTools_t *const ptools,
+         ParticleFilterStatistics *const pstats){
+            // 粒子フィルタの粒子を棋譜の最後まで進める処理を threads 個のスレッドで分担する
+            // redeal のときは粒子を配り直してから試合の最初から進める
+            auto& particles = pshared->particles;
+            RandomDealer<N_PLAYERS> estimator;
+            estimator.set(*pfield, *pshared);
+            
+            if(redeal)particles.dealThread(threadId, threads, estimator, *pshared, ptools);
+            particles.advanceThread(threadId, threads, fromTurn, estimator, *pshared, ptools, pstats);
+        }
+        
+        template<class field_t, class sharedData_t, class threadTools_t>
+        void RejuvenationThread
+        (const int threadId, const int threads,
+         const field_t *const pfield,
+         sharedData_t *const pshared,
+         threadTools_t *const ptools,
+         ParticleFilterStatistics *const pstats){
+            // 復元抽出で重複した粒子の若返りを threads 個のスレッドで分担する
+            RandomDealer<N_PLAYERS> estimator;
+            estimator.set(*pfield, *pshared);
+            
+            pshared->particles.rejuvenateThread(threadId, threads, estimator, *pshared, ptools, pstats);
+        }
+        
+        template<class galaxy_t, class dealer_t, class field_t, class sharedData_t, class threadTools_t>
+        int CreateWorlds(galaxy_t *const pgal, typename galaxy_t::world_t *const pWorld,
+                         dealer_t *const pestimator,
+                         const field_t *const pfield,
+                         sharedData_t *const pshared,
+                         threadTools_t *const ptools){
+            // 確保済みのスロット pWorld に世界を作って登録し、登録できた世界の数を返す
+            // 重点サンプリングでは採択棄却法の候補の数までスロットを追加で確保し、
+            // 候補を1つに絞らず全て重み付きの世界にする
+            using world_t = typename galaxy_t::world_t;
+            world_t *dst[64];
+            dst[0] = pWorld;
+            int n = 1;
+            if(Settings::importanceSampling && Settings::monteCarloDealType == DealType::REJECTION){
+                const int rate = min((int)pestimator->getHARate(), 64);
+                while(n < rate && (dst[n] = pgal->searchSpace()) != nullptr)++n;
+                n = pestimator->createImportance(dst, n, *pfield, *pshared, ptools);
+            }else{
+                pestimator->create(pWorld, Settings::monteCarloDealType, *pfield, *pshared, ptools);
+            }
+            int registered = 0;
+            for(int i = 0; i < n; ++i){
+                if(pgal->regist(dst[i]) == 0)++registered;
+            }
+            return registered;
+        }
+        
         template<class root_t, class field_t, class sharedData_t, class threadTools_t>
         void MonteCarloThread
-        (const int threadId, root_t *const proot,
+        (const int threadId, const int threads, root_t *const proot,
          const field_t *const pfield,
          sharedData_t *const pshared,
          threadTools_t *const ptools){
@@ -25,11 +135,11 @@ namespace UECda{
             constexpr uint32_t MINNEC_N_TRIALS = 4; // 全体での最小限のトライ数。UCB-Rootにしたので実質不要になった
             
             // プレー用
-            using galaxy_t = ThreadTools::galaxy_t;
-            using world_t = galaxy_t::world_t;
+            using galaxy_t = typename sharedData_t::galaxy_t;
+            using world_t = typename galaxy_t::world_t;
             
             auto& dice = ptools->dice;
-            auto& gal = ptools->gal;
+            auto& gal = pshared->gal; // 全スレッドで共有する世界プール
             
             Clock clock;
             
@@ -37,6 +147,36 @@ namespace UECda{
             const int candidates = proot->candidates; // 候補数
             auto& child = proot->child;
             
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+            // 自スレッドの未反映の統計
+            auto& slot = ptools->rootSlot;
+            slot.clear();
+#endif
+            // 候補の統計(全体に反映済みのものと自スレッドの未反映分の和)
+            // 重み付きの世界の結果は有効サンプル数の大きさにして返す
+            auto candidateScore = [&](int c)->BetaDistribution{
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+                BetaDistribution sc = child[c].monteCarloScore;
+                sc += slot.score[c];
+                return RootAction::effectiveScore(sc, child[c].weightSum + slot.weightSum[c],
+                                                  child[c].weightSqSum + slot.weightSqSum[c]);
+#else
+                return child[c].effectiveScore();
+#endif
+            };
+            // まとめて進めるプレイアウトでは、詰めたが未実行のものを仮の試行数として数える
+            // (同じ候補ばかりが1つの組に詰められるのを防ぐ)
+            int batchPending[256];
+            for(int c = 0; c < candidates; ++c)batchPending[c] = 0;
+            
+            auto candidateSimulations = [&](int c)->uint64_t{
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+                return child[c].simulations + slot.simulations[c] + batchPending[c];
+#else
+                return child[c].simulations + batchPending[c];
+#endif
+            };
+            
             int threadNTrials[256]; // 当スレッドでのトライ数(候補ごと)
             int threadNTrialsSum = 0; // 当スレッドでのトライ数(合計)
             
@@ -44,10 +184,9 @@ namespace UECda{
             
             int threadMaxNTrials = 0; // 当スレッドで現時点で最大のトライ数
             
-            int threadNWorlds = 0; // 当スレッドが作成し使用している世界の数
-            const int threadMaxNWorlds = gal.size();//( gal->size() / N_THREADS ); // 当スレッドに与えられている世界作成スペースの数
+            const int maxNWorlds = gal.size(); // 世界作成スペースの数(全スレッド共通)
             
-            assert(threadMaxNWorlds > 0);
+            assert(maxNWorlds > 0);
             
             // 世界創世者
             // 連続作成のためここに置いておく
@@ -57,6 +196,27 @@ namespace UECda{
             
             Playouter po; // プレイアウタ
             
+            // 世界の中身は前の着手決定から変わっているので、展開済みの手札は全て無効にする
+            auto& worldCache = ptools->worldCache;
+            worldCache.clear();
+            
+            // 末端探索の予算
+            ptools->leafSearch.startDecision(Settings::adaptiveLeafSearch && proot->timeLimited, proot->deadline,
+                                             Settings::leafSearchTimeShare, Settings::leafL2NodeLimit);
+            
+            // プレイアウト結果の置換表は世界が変わるので着手決定ごとに消す
+            auto& outcomeCache = ptools->outcomeCache;
+            if(Settings::playoutOutcomeCache){
+                if(outcomeCache.size() != PLAYOUT_OUTCOME_CACHE_SIZE)outcomeCache.init(PLAYOUT_OUTCOME_CACHE_SIZE);
+                outcomeCache.clear();
+            }
+            
+            // 複数の世界のプレイアウトをまとめて進めるか
+            // 共通乱数では試行ごとに乱数の種を変えるので使わない
+            const bool useBatch = Settings::batchPlayout && !proot->commonRandom;
+            auto& batch = ptools->playoutBatch;
+            if(useBatch)batch.init(ptools->bufferLength);
+            
             PlayouterField pf = *pfield;
             pf.attractedPlayers.set(myPlayerNum);
             pf.dice = &ptools->dice;
@@ -66,45 +226,62 @@ namespace UECda{
                 pf.attractedPlayers.set(proot->rivalPlayerNum);
             }
             
+            StoppingRule stoppingRule; // 打ち切り判定
+            
+            // ルートでの割り振り
+            // 予算を決めて候補を絞る方式は、時間制御探索では使わない
+            RootAllocator allocator;
+            {
+                const bool budgeted = Settings::rootAllocator == RootAllocatorType::SEQUENTIAL_HALVING
+                || Settings::rootAllocator == RootAllocatorType::SUCCESSIVE_REJECTS;
+                double prior[N_MAX_MOVES + 64];
+                for(int c = 0; c < candidates; ++c)prior[c] = child[c].policyProb;
+                // 候補を絞る方式では、生き残りの候補を全スレッドで共有し予算も全体で数える
+                allocator.init((proot->timeLimited && budgeted) ? RootAllocatorType::UCB_ROOT : Settings::rootAllocator,
+                               candidates, proot->limitSimulations, prior, &proot->elimination);
+            }
+            
             uint64_t poTime = 0ULL; // プレイアウトと雑多な処理にかかった時間
             uint64_t estTime = 0ULL; // 局面推定にかかった時間
             
+            // 世界作成の分担
+            // 後ろの NDealerThreads 個のスレッドは世界作成専用とし、世界プールが埋まるまで先に世界を作り続ける
+            // 他のスレッドはできた世界から使い、世界作成を待たない。埋まったら作成専用スレッドもプレイアウトに加わる
+            // 配り方を全て列挙した世界があるときは新しく作らない
+            const int dealers = (threads > Settings::NDealerThreads && !gal.weighted) ? Settings::NDealerThreads : 0;
+            auto& pipelineStats = ptools->pipelineStats;
+            pipelineStats.clear();
+            
             // 諸々の準備が終わったので時間計測開始
             clock.start();
             
+            if(threadId >= threads - dealers){
+                while(!proot->exitFlag && !proot->pastDeadline()){
+                    world_t *const pWorld = gal.searchSpace();
+                    if(pWorld == nullptr)break; // 世界プールが埋まった
+                    pipelineStats.produced += CreateWorlds(&gal, pWorld, &estimator, pfield, pshared, ptools);
+                }
+                pipelineStats.producerTime = clock.restart();
+                estTime += pipelineStats.producerTime;
+            }
+            
             while(!proot->exitFlag){ // 最大で最高回数までプレイアウトを繰り返す
                 
                 world_t *pWorld = nullptr;
                 
                 //サンプル着手決定
-                int tryingIndex = -1;
-                if(candidates == 2){
-                    // 2つの時は同数(分布サイズ単位)に割り振る
-                    if(child[0].size() == child[1].size())
-                        tryingIndex = dice.rand() % 2;
-                    else
-                        tryingIndex = child[0].size() < child[1].size()
-                        ? 0 : 1;
-                }else{
-                    // UCB-root アルゴリズムに変更
-                    double bestScore = -DBL_MAX;
-                    const double allSize = proot->monteCarloAllScore.size();
-                    for(int c = 0; c < candidates; ++c){
-                        double tmpScore;
-                        double size = child[c].size();
-                        if(child[c].simulations < MINNEC_N_TRIALS){
-                            // 最低プレイアウト数をこなしていないものは、大きな値にする
-                            // ただし最低回数のもののうちどれかがランダムに選ばれるようにする
-                            tmpScore = (double)((1U << 16) - (child[c].simulations << 8) + (dice.rand() % (1U << 6)));
-                        }else{
-                            ASSERT(size, cerr << child[c].toString() << endl;);
-                            tmpScore = child[c].mean() + 0.7 * sqrt(sqrt(allSize) / size); // ucbr値
-                        }
-                        if(tmpScore > bestScore){
-                            bestScore = tmpScore;
-                            tryingIndex = c;
-                        }
-                    }
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+                const double allSize = proot->monteCarloAllScore.size() + slot.allScore.size();
+#else
+                const double allSize = proot->monteCarloAllScore.size();
+#endif
+                const int tryingIndex = allocator.select(candidateScore, candidateSimulations,
+                                                         allSize, MINNEC_N_TRIALS, &dice);
+                if(allocator.decided()){
+                    // 候補が1つに絞られたので決定
+                    proot->setDecided();
+                    proot->exitFlag = true;
+                    goto THREAD_EXIT;
                 }
                 ASSERT(0 <= tryingIndex && tryingIndex < candidates,
                        cerr << tryingIndex << " in " << candidates << endl;);
@@ -114,54 +291,55 @@ namespace UECda{
                 const int pastNTrials = threadNTrials[tryingIndex]++; // 選ばれたもののこれまでのトライアル数
                 threadNTrialsSum++;
                 
-                if(threadNWorlds >= threadMaxNWorlds){
-                    // このとき、世界作成は既に終わっている
-                    if(pastNTrials < threadMaxNWorlds){
-                        // まだ全ての世界でこの着手を検討していないので順番通りの世界で検討
-                        pWorld = gal.access(pastNTrials);
-                        if(!pWorld->isActive()){
-                            // 何らかの事情で世界作成スケジュールがずれている
-                            // 仕方が無いので既にある世界からランダムに選ぶ
-                            pWorld = nullptr;
-                        }
-                    }else{
-                        // 全ての世界からランダムに選ぶ
-                    }
+                // 各スレッドが同じ着手を別の世界で検討するよう、スレッド番号をずらして世界を割り当てる
+                // 世界を一巡した後は周回数を共通乱数の種に使う
+                const int w = pastNTrials * threads + threadId;
+                const int worldRound = w / maxNWorlds;
+                if(gal.weighted){
+                    // 配り方を全て列挙した世界から、重みの累積分布上で黄金比ずつずらした位置の世界を選ぶ
+                    // (候補ごとの試行が少なくても、世界の重みに近い割合で全ての世界を調べる)
+                    constexpr double GOLDEN_RATIO_FRAC = 0.6180339887498949;
+                    const double u = (w + 0.5) * GOLDEN_RATIO_FRAC;
+                    pWorld = gal.pickByWeight(u - floor(u));
                 }else{
-                    // 世界作成が終わっていない
-                    if(pastNTrials < threadNWorlds){
-                        // まだ全ての世界でこの着手を検討していないので順番通りの世界で検討
-                        //pWorld = gal->access(threadMaxNWorlds * threadId + pastNTrials);
-                        pWorld = gal.access(pastNTrials);
-                        
-                        if(!pWorld -> isActive()){
-                            // 何らかの事情で世界作成スケジュールがずれている
-                            // 仕方が無いので既にある世界からランダムに選ぶ
-                            pWorld = nullptr;
-                        }
-                    }else{
-                        // 新しい世界を作成し、そこにプレイアウトを割り振る
-                        //pWorld = gal->searchSpace(threadMaxNWorlds * threadId, threadMaxNWorlds);
-                        
-                        pWorld = gal.searchSpace(0 , threadMaxNWorlds);
-                        
-                        if(pWorld != nullptr){
-                            // 世界作成スペースが見つかった
-                            poTime += clock.restart();
-                            
-                            // 世界作成
-                            estimator.create(pWorld, Settings::monteCarloDealType,
-                                             *pfield, *pshared, ptools);
-                            
-                            estTime += clock.restart();
+                    if(w < maxNWorlds){
+                        pipelineStats.feedDepth(gal.actives - w);
+                        if(w < gal.claimed && gal.isReady(w)){
+                            // 既に作られた世界
+                            pWorld = gal.access(w);
+                        }else if(dealers > 0 && gal.actives > 0){
+                            // 作成専用スレッドが作成中なので、できている世界を使う
+                            pWorld = gal.pickRand(&dice);
+                            pipelineStats.borrowed += 1;
+                        }else{
+                            // 新しい世界を作成し、そこにプレイアウトを割り振る
+                            // (w が他スレッドで作成中の場合も、待たずに別の世界を作る)
+                            if(proot->pastDeadline()){ // 世界作成は重いので先に時刻を確認
+                                proot->exitFlag = true;
+                                goto THREAD_EXIT;
+                            }
+                            pWorld = gal.searchSpace();
                             
-                            if(gal.regist(pWorld) != 0){ // 登録失敗
-                                // 仕方が無いので既にある世界からランダムに選ぶ
-                                pWorld = nullptr;
-                            }else{
-                                ++threadNWorlds; // 当スレッドの作成世界数up
+                            if(pWorld != nullptr){
+                                // 世界作成スペースが見つかった
+                                poTime += clock.restart();
+                                
+                                // 世界作成
+                                CreateWorlds(&gal, pWorld, &estimator, pfield, pshared, ptools);
+                                
+                                const uint64_t dealTime = clock.restart();
+                                estTime += dealTime;
+                                pipelineStats.stalls += 1;
+                                pipelineStats.stallTime += dealTime;
+                                
+                                if(!gal.isReady(pWorld - gal.world)){ // 登録失敗
+                                    // 仕方が無いので既にある世界からランダムに選ぶ
+                                    pWorld = nullptr;
+                                }
                             }
                         }
+                    }else{
+                        // 全ての世界からランダムに選ぶ
                     }
                 }
                 
@@ -171,13 +349,8 @@ namespace UECda{
                 
                 // この時点で世界が決まっていない場合はランダムに選ぶ
                 if(pWorld == nullptr){
-                    if(threadNWorlds > 0){
-                        //pWorld=gal->pickRand( threadMaxNWorlds*threadId, threadNWorlds, &dice );
-                        pWorld = gal.pickRand(0, threadNWorlds, &dice);
-                        if(pWorld == nullptr){
-                            goto THREAD_EXIT; // どうしようもないのでスレッド強制終了
-                        }
-                    }else{
+                    pWorld = gal.pickRand(&dice);
+                    if(pWorld == nullptr){
                         goto THREAD_EXIT; // どうしようもないのでスレッド強制終了
                     }
                 }
@@ -187,93 +360,137 @@ namespace UECda{
                 
                 //PlayoutScore score;
                 
-                // ここでプレイアウト実行
-                // alphaカットはしない
-                PlayouterField f;
-                if(proot->isChange){
-                    copyField(pf, &f);
-                    setWorld(pf, *pWorld, &f);
-                    ASSERT(examCards(child[tryingIndex].changeCards),
-                           cerr << OutCards(child[tryingIndex].changeCards) << endl;);
-                    po.startChange(&f, myPlayerNum, child[tryingIndex].changeCards, pshared, ptools);
+                // 共通乱数のときは(世界, 周回)で決まる種でプレイアウトし、後でスレッドの乱数列に戻す
+                const int worldIndex = pWorld - gal.world;
+                
+                if(useBatch){
+                    // 組に詰め、満杯になったらまとめて実行
+                    const int l = batch.lanes++;
+                    PlayouterField *const pbf = &batch.field[l];
+                    copyField(pf, pbf);
+                    worldCache.setWorld(worldIndex, pf, *pWorld, pbf);
+                    if(proot->isChange){
+                        ASSERT(examCards(child[tryingIndex].changeCards),
+                               cerr << OutCards(child[tryingIndex].changeCards) << endl;);
+                        batch.rootChange[l] = child[tryingIndex].changeCards;
+                    }else{
+                        batch.rootMove[l] = child[tryingIndex].move;
+                    }
+                    batch.candidate[l] = tryingIndex;
+                    batch.worldIndex[l] = worldIndex;
+                    ++batchPending[tryingIndex];
+                    if(!batch.full())continue;
+                    
+                    po.startBatch(&batch, proot->isChange, myPlayerNum, pshared, ptools);
+                    
+                    for(int i = 0; i < batch.lanes; ++i){
+                        --batchPending[batch.candidate[i]];
+                        const double worldWeight = gal.weighted ? 1.0 : gal.access(batch.worldIndex[i])->weight;
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+                        proot->feedSimulationResult(batch.candidate[i], batch.field[i], pshared, &slot, worldWeight);
+#else
+                        proot->feedSimulationResult(batch.candidate[i], batch.field[i], pshared, worldWeight);
+#endif
+                    }
+                    batch.clear();
                 }else{
-                    //po.startRoot(&score,root->child[tryingIndex],*pWorld,*field);
-                    copyField(pf, &f);
-                    //CERR << f.phase << endl;
-                    setWorld(pf, *pWorld, &f);
-                    //CERR << f.phase << endl;
-                    po.startRoot(&f, child[tryingIndex].move, pshared, ptools);
-                }
-                //int r = std::rand() % 5;
+                    const auto threadDice = dice;
+                    if(proot->commonRandom)dice.srand(proot->trialSeed(worldIndex, worldRound));
+                
+                    // ここでプレイアウト実行
+                    // alphaカットはしない
+                    PlayouterField f;
+                    if(proot->isChange){
+                        copyField(pf, &f);
+                        worldCache.setWorld(worldIndex, pf, *pWorld, &f);
+                        ASSERT(examCards(child[tryingIndex].changeCards),
+                               cerr << OutCards(child[tryingIndex].changeCards) << endl;);
+                        po.startChange(&f, myPlayerNum, child[tryingIndex].changeCards, pshared, ptools);
+                    }else{
+                        //po.startRoot(&score,root->child[tryingIndex],*pWorld,*field);
+                        copyField(pf, &f);
+                        //CERR << f.phase << endl;
+                        worldCache.setWorld(worldIndex, pf, *pWorld, &f);
+                        //CERR << f.phase << endl;
+                        po.startRoot(&f, child[tryingIndex].move, pshared, ptools);
+                    }
+                    //int r = std::rand() % 5;
                 
-                //CERR << "TRIAL : " << i << " " << moves.getMoveById(tryingIndex) << " : " << r << endl;
+                    //CERR << "TRIAL : " << i << " " << moves.getMoveById(tryingIndex) << " : " << r << endl;
                 
-                proot->feedSimulationResult(tryingIndex, f, pshared); // 結果をセット(排他制御は関数内で)
+                    if(proot->commonRandom){
+                        dice = threadDice;
+                        if(worldRound == 0)proot->feedPairedResult(worldIndex, tryingIndex, f);
+                    }
+                    // 世界の重みを付けて結果を記録する(重みに比例して選んだ全列挙の世界では付けない)
+                    const double worldWeight = gal.weighted ? 1.0 : pWorld->weight;
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+                    proot->feedSimulationResult(tryingIndex, f, pshared, &slot, worldWeight); // 結果をセット(数回ごとに全体に反映)
+#else
+                    proot->feedSimulationResult(tryingIndex, f, pshared, worldWeight); // 結果をセット(排他制御は関数内で)
+#endif
+                }
                 if(proot->exitFlag){
                     goto THREAD_EXIT;
                 }
+                if(proot->pastDeadline()){ // 時間制御探索の打ち切り
+                    proot->exitFlag = true;
+                    goto THREAD_EXIT;
+                }
                 
                 poTime += clock.restart();
                 
 #ifndef FIXED_N_PLAYOUTS
+                // 時間制御探索では割り当て時間を使い切るので打ち切り判定はしない
                 if(threadId == 0
-                   && threadNTrialsSum % max(4, 32 / N_THREADS) == 0
+                   && !proot->timeLimited
+                   && threadNTrialsSum % max(4, 32 / threads) == 0
                    //root->simulations % 32 == 0
-                   && proot->allSimulations > candidates * MINNEC_N_TRIALS
+                   && proot->allSimulations > allocator.admitted() * MINNEC_N_TRIALS
                    ){
                     
                     //cerr<<"cut ";
                     
                     // Regretによる打ち切り判定
-                    struct Dist{ double mean,sem,reg; };
-                    // time
+                    // 探索を続ける時間の価値と、今決定した場合の期待後悔を比べる
                     const double tmpClock = (double)poTime;
+                    const double allowance = ((double)(2 * tmpClock * VALUE_PER_CLOCK)) / (double)proot->rewardGap;
                     
-                    const double line = -1600.0 * ((double)(2 * tmpClock * VALUE_PER_CLOCK)) / (double)proot->rewardGap;
-                    
-                    // regret check
-                    Dist d[N_MAX_MOVES + 64];
+                    // 割り振りの対象になっていない候補は考えない
+                    StoppingArm arm[N_MAX_MOVES + 64];
+                    int armIndex[N_MAX_MOVES + 64];
+                    int NArms = 0;
+                    int best = 0;
                     for(int m = 0; m < candidates; ++m){
-                        d[m].reg = 0.0;
-                        d[m].mean = child[m].mean();
-                        
+                        if(!allocator.admits(m))continue;
                         ASSERT(child[m].size(), cerr << child[m].toString() << endl;);
-                        
-                        d[m].sem = sqrt(child[m].mean_var()); // 推定平均値の分散
-                        //cerr << d[m].sem << endl;
+                        arm[NArms].mean = child[m].mean();
+                        arm[NArms].sem = sqrt(child[m].mean_var()); // 推定平均値の標準誤差
+                        arm[NArms].diffSem = -1;
+                        armIndex[NArms] = m;
+                        if(arm[NArms].mean > arm[best].mean)best = NArms;
+                        ++NArms;
                     }
-                    for(int t = 0; t < 1600; ++t){
-                        double tmpBest = -1.0;
-                        double tmpScore[256];
-                        for(int m = 0; m < candidates; ++m){
-                            const Dist& tmpD = d[m];
-                            NormalDistribution<double> norm(tmpD.mean, tmpD.sem);
-                            double tmpDBL = norm.rand(&dice);
-                            tmpScore[m] = tmpDBL;
-                            if(tmpDBL > tmpBest){
-                                tmpBest = tmpDBL;
-                            }
-                        }
-                        for(int m = 0; m < candidates; ++m){
-                            d[m].reg += (tmpScore[m] - tmpBest);
+                    if(proot->commonRandom){
+                        // 共通乱数の対の差から、最善候補との差の標準誤差を求める
+                        for(int a = 0; a < NArms; ++a){
+                            if(a != best)arm[a].diffSem = proot->pairedDiffSem(armIndex[a], armIndex[best]);
                         }
                     }
-                    
-                    for(int m = 0; m < candidates; ++m){
-                        if(d[m].reg > line){
-                            /*cerr<<"simulations = " << proot->simulations << " childs = "<<candidates<<" line = "<<line<<endl;
-                             for(int mm=0;mm<candidates;mm++){
-                             cerr<<d[mm].reg<<endl;
-                             }
-                             getchar();*/
-                            proot->exitFlag = 1;
-                            goto THREAD_EXIT;
-                        }
+                    if(stoppingRule.judge(arm, NArms, allowance, &dice)){
+                        proot->exitFlag = 1;
+                        goto THREAD_EXIT;
                     }
                 }
 #endif // FIXED_N_PLAYOUTS
             }
         THREAD_EXIT:;//終了
+            // 詰めたが実行していないプレイアウトは捨てる(探索終了時なので結果に影響しない)
+            if(useBatch)batch.clear();
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+            // 未反映の統計を全体に反映してから終わる
+            proot->mergeStatistics(&slot);
+#endif
         }
     }
 }
\ No newline at end of file
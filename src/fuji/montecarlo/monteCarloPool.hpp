@@ -0,0 +1,184 @@
+/*
+ monteCarloPool.hpp
+ Katsuki Ohto
+ */
+
+#pragma once
+
+#include "../../settings.h"
+
+// モンテカルロ用の常駐スレッドプール
+// 着手決定のたびにスレッドを生成、joinするのをやめ、
+// 試合開始時に ThreadTools のスロットごとに1つワーカーを立てておき、
+// 着手決定の間は待機させてジョブを渡して起こす
+// 同期実行(run)ではスロット0は呼び出し元スレッド自身が担当し、
+// 非同期実行(start)では全スロットをワーカーが担当する
+
+namespace UECda{
+    namespace Fuji{
+
+        struct MonteCarloPoolStatistics{
+            // 着手決定ごとのスレッド起動遅延の記録(マイクロ秒)
+            uint64_t decisions;
+            uint64_t wakeTimeSum; // ジョブ投入から全ワーカーの開始まで
+            uint64_t wakeTimeMax;
+            uint64_t joinTimeSum; // スロット0の終了から全ワーカーの終了まで
+            uint64_t joinTimeMax;
+            uint64_t decisionTimeSum; // ジョブ投入から全ワーカーの終了まで
+
+            void clear(){
+                decisions = 0;
+                wakeTimeSum = wakeTimeMax = 0;
+                joinTimeSum = joinTimeMax = 0;
+                decisionTimeSum = 0;
+            }
+            void feed(uint64_t wake, uint64_t join, uint64_t all){
+                ++decisions;
+                wakeTimeSum += wake; wakeTimeMax = max(wakeTimeMax, wake);
+                joinTimeSum += join; joinTimeMax = max(joinTimeMax, join);
+                decisionTimeSum += all;
+            }
+            std::string toString()const{
+                std::ostringstream oss;
+                const double n = max(decisions, (uint64_t)1);
+                oss << "MonteCarloPool : " << decisions << " decisions";
+                oss << " wake " << wakeTimeSum / n << " (max " << wakeTimeMax << ") us";
+                oss << " join " << joinTimeSum / n << " (max " << joinTimeMax << ") us";
+                oss << " total " << decisionTimeSum / n << " us";
+                return oss.str();
+            }
+            MonteCarloPoolStatistics(){ clear(); }
+        };
+
+        class MonteCarloWorkerPool{
+        public:
+            using job_t = std::function<void(int)>; // 引数はスロット番号
+
+        private:
+            using clock_t = std::chrono::steady_clock;
+
+            std::vector<std::thread> workers; // workers[i] がスロット i を担当
+            std::mutex mutex_;
+            std::condition_variable wakeCond, doneCond;
+
+            // 現在のジョブ
+            job_t job;
+            uint64_t epoch; // ジョブ番号。ワーカーは番号の更新で起きる
+            int firstSlot; // ワーカーが担当する最初のスロット
+            int NJobThreads; // 今回のジョブに参加するスロット数
+            int running; // 未終了のワーカー数
+            bool quit;
+
+            clock_t::time_point dispatchTime;
+            std::atomic<int64_t> lastWakeTime; // 最後に起きたワーカーの起動時刻(投入からのマイクロ秒)
+
+            MonteCarloPoolStatistics stats;
+
+            static int64_t elapsedMicS(clock_t::time_point from){
+                return std::chrono::duration_cast<std::chrono::microseconds>(clock_t::now() - from).count();
+            }
+
+            void work(const int ith){
+                uint64_t seenEpoch = 0;
+                std::unique_lock<std::mutex> lk(mutex_);
+                while(1){
+                    wakeCond.wait(lk, [&]{ return quit || epoch != seenEpoch; });
+                    if(quit)break;
+                    seenEpoch = epoch;
+                    if(ith < firstSlot || ith >= NJobThreads)continue; // 今回は不参加
+
+                    const int64_t wake = elapsedMicS(dispatchTime);
+                    lk.unlock();
+
+                    int64_t last = lastWakeTime.load();
+                    while(wake > last && !lastWakeTime.compare_exchange_weak(last, wake));
+
+                    job(ith); // ジョブは全員の終了まで書き換えられない
+
+                    lk.lock();
+                    if(--running == 0)doneCond.notify_all();
+                }
+            }
+
+            void dispatch(const job_t& j, int first, int threads){
+                {
+                    std::lock_guard<std::mutex> lk(mutex_);
+                    job = j;
+                    firstSlot = first;
+                    NJobThreads = threads;
+                    running = threads - first;
+                    lastWakeTime = 0;
+                    dispatchTime = clock_t::now();
+                    ++epoch;
+                }
+                wakeCond.notify_all();
+            }
+
+        public:
+            int size()const noexcept{ return max(1, (int)workers.size()); }
+            const MonteCarloPoolStatistics& statistics()const noexcept{ return stats; }
+
+            void init(int threads){
+                // 試合開始時に呼ぶ
+                close();
+                epoch = 0;
+                firstSlot = 0;
+                NJobThreads = 0;
+                running = 0;
+                quit = false;
+                stats.clear();
+                for(int ith = 0; ith < threads; ++ith)
+                    workers.emplace_back(std::thread(&MonteCarloWorkerPool::work, this, ith));
+            }
+
+            void run(const job_t& j, int threads){
+                // threads 個のスロットでジョブを実行し、全て終わるまで待つ
+                wait(); // 非同期ジョブが残っていれば先に終わらせる
+                threads = max(1, min(threads, size()));
+                const clock_t::time_point start = clock_t::now();
+                if(threads > 1)dispatch(j, 1, threads);
+
+                j(0);
+
+                const clock_t::time_point mainEnd = clock_t::now();
+                wait();
+                stats.feed(threads > 1 ? lastWakeTime.load() : 0, elapsedMicS(mainEnd), elapsedMicS(start));
+            }
+
+            void start(const job_t& j, int threads){
+                // threads 個のスロットでジョブを非同期に開始する
+                wait();
+                if(workers.empty())return;
+                threads = max(1, min(threads, size()));
+                dispatch(j, 0, threads);
+            }
+
+            void wait(){
+                // 実行中のジョブの終了を待つ
+                std::unique_lock<std::mutex> lk(mutex_);
+                doneCond.wait(lk, [&]{ return running == 0; });
+            }
+
+            void close(){
+                // 試合終了時に呼ぶ
+                if(!workers.empty()){
+                    wait();
+                    {
+                        std::lock_guard<std::mutex> lk(mutex_);
+                        quit = true;
+                    }
+                    wakeCond.notify_all();
+                    for(auto& th : workers)th.join();
+                    workers.clear();
+#ifdef MONITOR
+                    cerr << stats.toString() << endl;
+#endif
+                }
+            }
+
+            MonteCarloWorkerPool():
+            epoch(0), firstSlot(0), NJobThreads(0), running(0), quit(false){}
+            ~MonteCarloWorkerPool(){ close(); }
+        };
+    }
+}
@@ -49,46 +49,48 @@ namespace UECda{
     // used in playouts
     struct PlayouterField{
         
-        // tools for playout
+        // メンバの並びについて
+        // プレイアウト中に1手ごとに読み書きするもの(場、手番、プレーヤー状態、残り札)を
+        // 先頭の 128 バイト(キャッシュライン2本)に集め、その後にハッシュ値、手札、
+        // 着手決定ごとにしか使わない情報の順に置く
+        // 並びを変えた場合は simulation_test の testPlayoutLayout で確認すること
+        
+        // 1本目 : 8 バイトのもの
         MoveInfo *mv; // buffer of move
         XorShift64 *dice;
-        
-        // playout result
-        BitArray64<11, N_PLAYERS> infoReward; // rewards
-        uint32_t domFlags;
-        uint32_t NNullFields;
-        std::bitset<32> flags;
-        
-        // information for playout
-        int depth;
-        BitSet32 attractedPlayers; // players we want playout-result
-        int NMoves;
-        int NActiveMoves;
         MoveInfo playMove; // move chosen by player int playout
         FieldAddInfo fieldInfo;
+        BitArray64<11, N_PLAYERS> infoReward; // rewards
+        Cards remCards;
+        uint64_t remHash;
+        std::bitset<32> flags;
         
-        // common information
+        // 2本目 : 4 バイトのもの
         int turnNum;
         Board bd;
         PlayersState ps;
+        int NMoves;
+        int NActiveMoves;
+        uint32_t remQty;
+        BitSet32 attractedPlayers; // players we want playout-result
+        GamePhase phase;
         
         BitArray32<4> infoSpecialPlayer;
-        
-        BitArray32<4, N_PLAYERS> infoClass;
-        BitArray32<4, N_PLAYERS> infoClassPlayer;
         BitArray32<4, N_PLAYERS> infoSeat;
         BitArray32<4, N_PLAYERS> infoSeatPlayer;
+        BitArray32<4, N_PLAYERS> infoClass;
+        BitArray32<4, N_PLAYERS> infoClassPlayer;
+        
+        // playout result
+        uint32_t domFlags;
+        uint32_t NNullFields;
+        int depth;
+        
+        // ここからは1手ごとには触らないもの
         BitArray32<4, N_PLAYERS> infoNewClass;
         BitArray32<4, N_PLAYERS> infoNewClassPlayer;
-        
         BitArray32<4, N_PLAYERS> infoPosition;
         
-        GamePhase phase;
-        
-        uint32_t remQty;
-        Cards remCards;
-        uint64_t remHash;
-        
         // 局面ハッシュ値
         uint64_t originalKey; // 交換後の手札配置のハッシュ値
         uint64_t recordKey; // 着手の試合進行のハッシュ値(現在は使用済み手札集合のみ)
@@ -98,8 +100,11 @@ namespace UECda{
         uint64_t aliveKey, fullAwakeKey;
         
         // 手札
+        // 相手手札 opsHand は着手のたびには更新せず、読む時に残り札との差分で追いつかせる
+        // (枚数が remQty - hand[p].qty と合っていなければ古い)
+        // 読み出しは必ず getOpsHand() を通すこと
         Hand hand[N_PLAYERS];
-        Hand opsHand[N_PLAYERS];
+        mutable Hand opsHand[N_PLAYERS];
         // 手札情報
         Cards usedCards[N_PLAYERS];
         Cards sentCards[N_PLAYERS];
@@ -110,6 +115,39 @@ namespace UECda{
         PlayerPolicySubValue playerPolicyValue[N_PLAYERS];
         PolicySubValue policyValue;
         
+        // プレイアウト結果の置換表に終局後に登録する局面(終盤の空場)
+        static constexpr int N_OUTCOME_KEYS = 8;
+        int NOutcomeKeys;
+        int outcomeSolvedIndex; // 探索で結果が確定した局面の番号(無ければ -1)
+        uint64_t outcomeKey[N_OUTCOME_KEYS];
+        uint32_t outcomeAlive[N_OUTCOME_KEYS]; // その局面で生きていたプレーヤー
+        
+        uint64_t getFullInfoKey()const noexcept{
+            // 完全情報の局面のハッシュ値(全員の手札, 場, 誰がパスをしていて手番が誰か)
+            uint64_t handKey[N_PLAYERS];
+            for(int p = 0; p < N_PLAYERS; ++p){
+                handKey[p] = isAlive(p) ? hand[p].hash : 0ULL;
+            }
+            return knitCardsArrayHashKey<N_PLAYERS>(handKey) ^ boardKey ^ stateKey;
+        }
+        bool pushOutcomeKey(uint64_t key)noexcept{
+            if(NOutcomeKeys >= N_OUTCOME_KEYS)return false;
+            uint32_t alive = 0;
+            for(int p = 0; p < N_PLAYERS; ++p){
+                if(isAlive(p))alive |= 1U << p;
+            }
+            outcomeKey[NOutcomeKeys] = key;
+            outcomeAlive[NOutcomeKeys] = alive;
+            ++NOutcomeKeys;
+            return true;
+        }
+        void setLastOutcomeSolved()noexcept{ outcomeSolvedIndex = NOutcomeKeys - 1; }
+        void discardOutcomeKeys()noexcept{
+            // 打ち切りや置換表の標本で終局した場合は、実際の上がり順ではないので登録しない
+            NOutcomeKeys = 0;
+            outcomeSolvedIndex = -1;
+        }
+        
         bool isL2Situation()const noexcept{ return getNAlivePlayers() == 2; }
         bool isLnCISituation()const noexcept{
             return hand[getTurnPlayer()].qty > 1U // 1枚なら探索しても意味無し
@@ -192,12 +230,22 @@ namespace UECda{
         void setFirstTurnPlayer(int p)noexcept{ infoSpecialPlayer.assign(3, p); }
         
         Cards getCards(int p)const{ return hand[p].getCards(); }
-        Cards getOpsCards(int p)const{ return opsHand[p].getCards(); }
+        Cards getOpsCards(int p)const{ return andCards(opsHand[p].getCards(), remCards); }
         uint32_t getNCards(int p)const{ return hand[p].getQty(); }
         Cards getRemCards()const noexcept{ return remCards; }
         Cards getNRemCards()const noexcept{ return remQty; }
         const Hand& getHand(int p)const{ return hand[p]; }
-        const Hand& getOpsHand(int p)const{ return opsHand[p]; }
+        const Hand& getOpsHand(int p)const{
+            if(opsHand[p].qty + hand[p].qty != remQty){ refreshOpsHand(p); }
+            return opsHand[p];
+        }
+        void refreshOpsHand(int p)const noexcept{
+            // 前回の更新以降に場に出たカードを相手手札からまとめて外す
+            const Cards dc = subtrCards(opsHand[p].getCards(), remCards);
+            const int dq = opsHand[p].qty + hand[p].qty - remQty;
+            ASSERT(dq > 0, cerr << p << " " << dq << endl << toDebugString(););
+            opsHand[p].subtrAll(dc, dq, CardsToHashKey(dc));
+        }
         
         uint64_t getRemCardsHash()const noexcept{ return remHash; }
         Cards getUsedCards(int p)const{ return usedCards[p]; }
@@ -356,18 +404,9 @@ namespace UECda{
             remQty -= dq;
             remHash ^= dhash;
             
-            // 出したプレーヤーの手札とそれ以外のプレーヤーの相手手札を更新
-            for(int p = 0; p < tp; ++p){
-                if(isAlive(p)){
-                    opsHand[p].makeMoveAll(mv, dc, dq, dhash);
-                }
-            }
+            // 出したプレーヤーの手札を更新
+            // それ以外のプレーヤーの相手手札は読まれる時に更新する
             hand[tp].makeMoveAll(mv, dc, dq, dhash);
-            for(int p = tp + 1; p < N_PLAYERS; ++p){
-                if(isAlive(p)){
-                    opsHand[p].makeMoveAll(mv, dc, dq, dhash);
-                }
-            }
             procRecordHash(tp, dhash); // 棋譜ハッシュ値の更新
             procNumCardsHash(tp); // 手札枚数ハッシュ値の更新
         }
@@ -386,11 +425,6 @@ namespace UECda{
             
             assert(!isAlive(tp)); // agari player is not alive
             
-            for(int p = 0; p < N_PLAYERS; ++p){
-                if(isAlive(p)){
-                    opsHand[p].makeMoveAll(mv, dc, dq, dhash);
-                }
-            }
             procRecordHash(tp, dhash); // 棋譜ハッシュ値の更新
             procNumCardsHash(tp); // 手札枚数ハッシュ値の更新
         }
@@ -402,8 +436,29 @@ namespace UECda{
 #define IFooX(i, x) s -= pol.param(i) * (x);
         
         // policy 1から計算
+        void clearPolicySubValue()noexcept{
+            // 手札ごとの値を無効にする(手番で手札を持っているプレーヤーの手札が空になることはない)
+            for(int p = 0; p < N_PLAYERS; ++p){
+                playerPolicyValue[p].cards = CARDS_NULL;
+            }
+        }
+        template<class move_t>
+        void updatePlayerPolicySubValue(int p, move_t *const buf){
+            // 手札が前回の計算時から変わっていれば計算し直す(buf は作業領域)
+            // 着手で手札が変わってもすぐには計算せず、次にそのプレーヤーの方策を計算するときに行う
+            if(playerPolicyValue[p].cards != hand[p].getCards()){
+                playerPolicyValue[p].set(hand[p], buf);
+            }
+        }
+        
         template<class policy_t>
         void calcPolicySubValue(const policy_t& pol){
+            // 手札のみで決まる値(着手生成バッファを作業領域に使う)
+            for(int p = 0; p < N_PLAYERS; ++p){
+                if(isAlive(p)){
+                    playerPolicyValue[p].set(hand[p], mv);
+                }
+            }
             // 面倒であるが現状計算コードをここにコピーしてくるしかない
             /*for(int p = 0; p < N_PLAYERS; ++p){
              
@@ -634,6 +689,9 @@ namespace UECda{
         
         void initForPlayout()noexcept{
             flags.reset();
+            clearPolicySubValue();
+            NOutcomeKeys = 0;
+            outcomeSolvedIndex = -1;
         }
         
         void prepareForPlay(bool isRoot = false)noexcept{
@@ -662,7 +720,7 @@ namespace UECda{
                         fieldInfo.setFlushLead();
                         if(fieldInfo.isLastAwake()){
                         }else{
-                            if(dominatesHand(getBoard(), opsHand[tp])){
+                            if(dominatesHand(getBoard(), getOpsHand(tp))){
                                 // 場が全員を支配しているので、パスをすれば自分から
                                 fieldInfo.setBDO();
                                 fieldInfo.setPassDom(); // fl && bdo ならパス支配
@@ -1193,6 +1251,8 @@ namespace UECda{
         
         double weight; // この世界の存在確率比
         int builtTurn; // この世界がセットされたターン
+        int evaluatedTurn; // 最後に棋譜による尤度を評価したターン
+        double logLikelihood; // その時点での棋譜の対数尤度(未評価なら0)
         uint64_t hash; // 世界識別ハッシュ。着手検討中ターンにおいて世界を識別出来れば形式は問わない
         
         int depth;
@@ -1222,20 +1282,15 @@ namespace UECda{
                 cards[p] = argCards[p];
                 hash_cards[p] = CardsToHashKey(argCards[p]);
             }
-            builtTurn = field.getTurnNum();
+            builtTurn = evaluatedTurn = field.getTurnNum();
+            logLikelihood = 0;
         }
         
         void proc(const int p, const Move mv, const Cards dc){
             // 世界死がおきずに進行した
-            //uint64_t dhash = CardsToHashKey(dc);
-            //uint32_t dq = mv.qty();
-            
-            /*wField.rHand.makeMoveAll(mv,dc,dq,dhash);
-             
-             wField.hand[p].makeMove(mv,dc);
-             wField.hand[p].hash^=dhash;
-             wField.opsHand[p].makeMove(mv,dc);
-             wField.opsHand[p].hash^=dhash;*/
+            // 出されたカードをプレーヤーの手札から除く
+            cards[p] = subtrCards(cards[p], dc);
+            hash_cards[p] ^= CardsToHashKey(dc);
         }
         
         int checkRationality(){
@@ -1246,6 +1301,391 @@ namespace UECda{
         ImaginaryWorld(){ clear(); }
         ~ImaginaryWorld(){ clear(); }
     };
+    
+    /**************************世界ごとの開始局面の手札**************************/
+    
+    struct PlayoutWorldHands{
+        // 世界の手札をプレイアウト用の Hand 型に展開したもの
+        Hand hand[N_PLAYERS];
+        Hand opsHand[N_PLAYERS];
+        
+        void save(const PlayouterField& field)noexcept{
+            for(int p = 0; p < N_PLAYERS; ++p){
+                hand[p] = field.hand[p];
+                opsHand[p] = field.opsHand[p];
+            }
+        }
+        void load(PlayouterField *const dst)const noexcept{
+            for(int p = 0; p < N_PLAYERS; ++p){
+                dst->hand[p] = hand[p];
+                dst->opsHand[p] = opsHand[p];
+            }
+        }
+    };
+    
+    class PlayoutWorldCache{
+        // スレッドごとに、世界番号ごとの展開済みの手札を持っておく
+        // 1つの世界では候補ごと、周回ごとに何度もプレイアウトを行うので、
+        // 2回目以降は Hand::set による展開をやり直さずにコピーで済ませる
+        // 世界の中身は着手決定の間は変わらないので、着手決定ごとに clear() で全て無効にする
+    public:
+        void init(int worlds){
+            if(worlds != size_){
+                size_ = worlds;
+                hands_.reset(new PlayoutWorldHands[size_]);
+                stamps_.reset(new uint32_t[size_]);
+            }
+            for(int w = 0; w < size_; ++w)stamps_[w] = 0;
+            stamp_ = 1;
+            hits_ = misses_ = 0;
+        }
+        void clear()noexcept{
+            if(++stamp_ == 0){ // 一周したら作り直す
+                for(int w = 0; w < size_; ++w)stamps_[w] = 0;
+                stamp_ = 1;
+            }
+        }
+        
+        template<class sbjField_t, class world_t>
+        void setWorld(int w, const sbjField_t& field, const world_t& world, PlayouterField *const dst){
+            if(w < 0 || w >= size_){
+                UECda::setWorld(field, world, dst);
+                return;
+            }
+            if(stamps_[w] == stamp_){
+                hands_[w].load(dst);
+                ++hits_;
+            }else{
+                UECda::setWorld(field, world, dst);
+                hands_[w].save(*dst);
+                stamps_[w] = stamp_;
+                ++misses_;
+            }
+        }
+        
+        uint64_t hits()const noexcept{ return hits_; }
+        uint64_t misses()const noexcept{ return misses_; }
+        
+        PlayoutWorldCache():
+        size_(0), stamp_(1), hits_(0), misses_(0){}
+        
+    private:
+        int size_;
+        uint32_t stamp_;
+        std::unique_ptr<PlayoutWorldHands[]> hands_;
+        std::unique_ptr<uint32_t[]> stamps_;
+        uint64_t hits_, misses_;
+    };
+    
+    /**************************まとめて進めるプレイアウト**************************/
+    
+    struct PlayoutBatch{
+        // 1スレッドで同時に進めるプレイアウトの組 (Playouter::startBatch で使う)
+        // 局面はレーンごとに持ち、進行状況はレーン番号で引く配列にまとめる
+        // 着手生成バッファはレーンごとに別の領域を使う
+        static constexpr int N_MAX_LANES = PLAYOUT_BATCH_SIZE;
+        
+        int lanes; // 詰めたプレイアウトの数
+        PlayouterField field[N_MAX_LANES];
+        
+        // ルートでの着手(交換ならカード)と候補番号
+        MoveInfo rootMove[N_MAX_LANES];
+        Cards rootChange[N_MAX_LANES];
+        int candidate[N_MAX_LANES];
+        int worldIndex[N_MAX_LANES];
+        
+        // 進行状況
+        bool running[N_MAX_LANES];
+        int plies[N_MAX_LANES];
+        double progress[N_MAX_LANES];
+        
+        void init(int length){
+            if(bufferMemory == nullptr || bufferLength != length){
+                bufferLength = length;
+                bufferMemory.reset(new MoveInfo[N_MAX_LANES * bufferLength]);
+            }
+            clear();
+        }
+        void clear()noexcept{ lanes = 0; }
+        bool full()const noexcept{ return lanes >= N_MAX_LANES; }
+        bool empty()const noexcept{ return lanes == 0; }
+        MoveInfo *buffer(int i)const noexcept{ return bufferMemory.get() + i * bufferLength; }
+        
+        PlayoutBatch():
+        lanes(0), bufferLength(0){}
+        
+    private:
+        int bufferLength;
+        std::unique_ptr<MoveInfo[]> bufferMemory;
+    };
+    
+    /**************************プレイアウト末端探索の予算**************************/
+    
+    struct LeafSearchStatistics{
+        // プレイアウト末端探索の記録
+        uint64_t L2Searches, L2Solved, L2Aborted, L2Nodes;
+        uint64_t LnCISearches, LnCISolved, LnCISkipped;
+        uint64_t leafTime; // 末端探索にかかった時間(ナノ秒)
+        
+        void clear(){
+            L2Searches = L2Solved = L2Aborted = L2Nodes = 0;
+            LnCISearches = LnCISolved = LnCISkipped = 0;
+            leafTime = 0;
+        }
+        LeafSearchStatistics& operator +=(const LeafSearchStatistics& rhs){
+            L2Searches += rhs.L2Searches; L2Solved += rhs.L2Solved;
+            L2Aborted += rhs.L2Aborted; L2Nodes += rhs.L2Nodes;
+            LnCISearches += rhs.LnCISearches; LnCISolved += rhs.LnCISolved;
+            LnCISkipped += rhs.LnCISkipped;
+            leafTime += rhs.leafTime;
+            return *this;
+        }
+        std::string toString()const{
+            std::ostringstream oss;
+            const double l2 = max(L2Searches, (uint64_t)1);
+            const double lnci = max(LnCISearches, (uint64_t)1);
+            oss << "LeafSearch : L2 " << L2Searches << " (solved " << L2Solved / l2;
+            oss << " aborted " << L2Aborted / l2 << " nodes " << L2Nodes / l2 << ")";
+            oss << " LnCI " << LnCISearches << " (solved " << LnCISolved / lnci;
+            oss << " skipped " << LnCISkipped << ")";
+            oss << " time " << leafTime / 1000000 << " ms";
+            return oss.str();
+        }
+        LeafSearchStatistics(){ clear(); }
+    };
+    
+    class LeafSearchController{
+        // スレッドごとにプレイアウト末端探索の予算を決める
+        // 時間制御探索では、計測した L2 探索の1ノードあたりの時間と決定の残り時間から L2 のノード上限を決める
+        // また末端探索に使った時間の割合が目安を超えたら上限を下げ、目安以下で打ち切りが出ていれば上げる
+        // LnCI 探索はノード数で止められないので、1回あたりの平均時間が残り時間に比べて大きければ行わない
+        // 時間制御探索でないときは固定の上限を使う
+    public:
+        using clock_t = std::chrono::steady_clock;
+        
+        static constexpr int L2_NODES_MIN = 256;
+        static constexpr int L2_NODES_MAX = 1 << 20;
+        static constexpr double REST_SHARE = 0.01; // 1回の末端探索で決定の残り時間のこの割合まで使う
+        static constexpr int ADJUST_INTERVAL = 64; // この回数の L2 探索ごとに上限を見直す
+        
+        void startDecision(bool limited, clock_t::time_point deadline, double share, int fixedLimit){
+            // 着手決定ごとに呼ぶ
+            // 計測した時間と調整した上限は次の決定に持ち越す
+            limited_ = limited;
+            deadline_ = deadline;
+            share_ = share;
+            fixedLimit_ = fixedLimit;
+            if(L2Limit_ <= 0)L2Limit_ = fixedLimit;
+            start_ = clock_t::now();
+            decisionLeafTime_ = 0;
+            sinceAdjust_ = abortedSinceAdjust_ = 0;
+        }
+        
+        int L2NodeLimit(clock_t::time_point now)const{
+            if(!limited_)return fixedLimit_;
+            double limit = L2Limit_;
+            if(L2NsPerNode_ > 0){
+                limit = min(limit, restNs(now) * REST_SHARE / L2NsPerNode_);
+            }
+            return max(L2_NODES_MIN, (int)limit);
+        }
+        bool allowsLnCI(clock_t::time_point now)const{
+            if(!limited_ || LnCINs_ <= 0)return true;
+            return LnCINs_ <= restNs(now) * REST_SHARE;
+        }
+        
+        void feedL2(int nodes, bool solved, bool aborted, clock_t::time_point start, clock_t::time_point end){
+            const double ns = nanoseconds(end - start);
+            stats_.L2Searches += 1;
+            stats_.L2Solved += solved;
+            stats_.L2Aborted += aborted;
+            stats_.L2Nodes += nodes;
+            stats_.leafTime += (uint64_t)ns;
+            decisionLeafTime_ += ns;
+            if(nodes > 0){
+                const double perNode = ns / nodes;
+                L2NsPerNode_ = (L2NsPerNode_ > 0) ? (0.95 * L2NsPerNode_ + 0.05 * perNode) : perNode;
+            }
+            if(limited_){
+                abortedSinceAdjust_ += aborted;
+                if(++sinceAdjust_ >= ADJUST_INTERVAL)adjust(end);
+            }
+        }
+        void feedLnCI(bool solved, clock_t::time_point start, clock_t::time_point end){
+            const double ns = nanoseconds(end - start);
+            stats_.LnCISearches += 1;
+            stats_.LnCISolved += solved;
+            stats_.leafTime += (uint64_t)ns;
+            decisionLeafTime_ += ns;
+            LnCINs_ = (LnCINs_ > 0) ? (0.95 * LnCINs_ + 0.05 * ns) : ns;
+        }
+        void skipLnCI()noexcept{ stats_.LnCISkipped += 1; }
+        
+        LeafSearchStatistics& statistics()noexcept{ return stats_; }
+        const LeafSearchStatistics& statistics()const noexcept{ return stats_; }
+        
+        LeafSearchController():
+        limited_(false), share_(0), fixedLimit_(LEAF_L2_NODE_LIMIT), L2Limit_(0),
+        L2NsPerNode_(0), LnCINs_(0), decisionLeafTime_(0),
+        sinceAdjust_(0), abortedSinceAdjust_(0){}
+        
+    private:
+        bool limited_;
+        clock_t::time_point start_, deadline_;
+        double share_; // 末端探索に使う時間の割合の目安
+        int fixedLimit_;
+        int L2Limit_; // 時間の割合から調整した L2 のノード上限
+        double L2NsPerNode_; // L2 探索の1ノードあたりの時間(ナノ秒, 指数移動平均)
+        double LnCINs_; // LnCI 探索の1回あたりの時間(ナノ秒, 指数移動平均)
+        double decisionLeafTime_; // この決定で末端探索に使った時間(ナノ秒)
+        int sinceAdjust_, abortedSinceAdjust_;
+        LeafSearchStatistics stats_;
+        
+        static double nanoseconds(clock_t::duration d){
+            return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        }
+        double restNs(clock_t::time_point now)const{
+            return max(0.0, nanoseconds(deadline_ - now));
+        }
+        void adjust(clock_t::time_point now){
+            const double leafShare = decisionLeafTime_ / max(1.0, nanoseconds(now - start_));
+            if(leafShare > share_){
+                L2Limit_ = max(L2_NODES_MIN, L2Limit_ * 3 / 4);
+            }else if(abortedSinceAdjust_ > 0){
+                L2Limit_ = min(L2_NODES_MAX, L2Limit_ * 3 / 2);
+            }
+            sinceAdjust_ = abortedSinceAdjust_ = 0;
+        }
+    };
+    
+    /**************************プレイアウト結果の置換表**************************/
+    
+    struct PlayoutOutcomeStatistics{
+        // 着手決定ごとのプレイアウト結果置換表の記録
+        uint64_t probes, solvedHits, sampledHits;
+        uint64_t stores, replaced;
+        uint64_t memory; // 置換表の大きさ(バイト)
+        
+        void clear(){
+            probes = solvedHits = sampledHits = 0;
+            stores = replaced = 0;
+            memory = 0;
+        }
+        PlayoutOutcomeStatistics& operator +=(const PlayoutOutcomeStatistics& rhs){
+            probes += rhs.probes; solvedHits += rhs.solvedHits; sampledHits += rhs.sampledHits;
+            stores += rhs.stores; replaced += rhs.replaced;
+            memory += rhs.memory;
+            return *this;
+        }
+        std::string toString()const{
+            std::ostringstream oss;
+            const double n = max(probes, (uint64_t)1);
+            oss << "OutcomeCache : " << probes << " probes (solved " << solvedHits / n;
+            oss << " sampled " << sampledHits / n << ")";
+            oss << " stores " << stores << " (replaced " << replaced << ")";
+            oss << " memory " << memory / 1024 << " KiB";
+            return oss.str();
+        }
+        PlayoutOutcomeStatistics(){ clear(); }
+    };
+    
+    class PlayoutOutcomeCache{
+        // 完全情報の局面のハッシュ値から、その局面以降の上がり順を引く置換表(スレッドごと)
+        // 末端探索で結果が確定した局面はその上がり順を記録して常に返す
+        // そうでない局面はプレイアウトで実際に出た上がり順を N_SAMPLES 個の標本として記録し(reservoir sampling)、
+        // 揃っていれば確率 reuseRate でその中から1つを選んで返す(報酬が整数なので、平均の代わりに標本から選ぶ)
+        // 残りは最後までプレイアウトして標本を入れ替えるので、同じ局面の結果が少数の標本に固まらない
+        // 表は直接写像で常に上書きし、着手決定ごとに世代番号で消去する
+    public:
+        static constexpr int N_SAMPLES = 4;
+        
+        struct Entry{
+            uint64_t key;
+            uint32_t stamp;
+            uint32_t seen; // これまでに登録したプレイアウトの結果の数
+            uint16_t samples;
+            uint16_t solved;
+            uint32_t classes[N_SAMPLES]; // BitArray32<4, N_PLAYERS> の中身
+        };
+        
+        void init(int size){
+            // 大きさは2の累乗に切り上げる
+            int sz = 1;
+            while(sz < size)sz <<= 1;
+            table.reset(new Entry[sz]);
+            memset(table.get(), 0, sizeof(Entry) * sz);
+            mask = sz - 1;
+            stamp = 0;
+            stats.clear();
+        }
+        int size()const noexcept{ return table ? (mask + 1) : 0; }
+        
+        void clear(){
+            // 着手決定ごとに呼ぶ
+            stats.clear();
+            stats.memory = sizeof(Entry) * size();
+            if(++stamp == 0){ // 一周したら全部消す
+                memset(table.get(), 0, sizeof(Entry) * size());
+                stamp = 1;
+            }
+        }
+        
+        template<class dice_t>
+        bool probe(uint64_t key, double reuseRate, dice_t *const pdice,
+                   uint32_t *const pclasses, bool *const psolved){
+            ++stats.probes;
+            const Entry& e = table[key & mask];
+            if(e.stamp != stamp || e.key != key)return false;
+            *psolved = e.solved;
+            if(e.solved){
+                *pclasses = e.classes[0];
+                ++stats.solvedHits;
+                return true;
+            }
+            if(e.samples >= N_SAMPLES && pdice->drand() < reuseRate){
+                *pclasses = e.classes[pdice->rand() % N_SAMPLES];
+                ++stats.sampledHits;
+                return true;
+            }
+            return false;
+        }
+        template<class dice_t>
+        void regist(uint64_t key, uint32_t classes, bool solved, dice_t *const pdice){
+            ++stats.stores;
+            Entry& e = table[key & mask];
+            if(e.stamp != stamp || e.key != key){
+                if(e.stamp == stamp)++stats.replaced;
+                e.key = key;
+                e.stamp = stamp;
+                e.seen = 0;
+                e.samples = 0;
+                e.solved = 0;
+            }
+            if(e.solved)return;
+            if(solved){
+                e.solved = 1;
+                e.classes[0] = classes;
+            }else if(e.samples < N_SAMPLES){
+                e.classes[e.samples++] = classes;
+                ++e.seen;
+            }else{
+                // これまでの全ての結果から一様に N_SAMPLES 個を残す
+                const uint32_t i = pdice->rand() % (++e.seen);
+                if(i < N_SAMPLES)e.classes[i] = classes;
+            }
+        }
+        
+        PlayoutOutcomeStatistics& statistics()noexcept{ return stats; }
+        const PlayoutOutcomeStatistics& statistics()const noexcept{ return stats; }
+        
+        PlayoutOutcomeCache(): mask(0), stamp(0){}
+        
+    private:
+        std::unique_ptr<Entry[]> table;
+        int mask;
+        uint32_t stamp;
+        PlayoutOutcomeStatistics stats;
+    };
 }
 
 #endif // UECDA_FUJI_PLAYOUT_H_
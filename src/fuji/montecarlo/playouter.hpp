@@ -29,6 +29,8 @@
 #include "../search/lnCIJudge.hpp"
 #endif
 
+#include "../eval/staticEval.hpp"
+
 namespace UECda{
     namespace Fuji{
         
@@ -39,6 +41,37 @@ namespace UECda{
             //int mode;
             //static AtomicAnalyzer<3, 6, 2> ana;
             
+            // 1手分の処理
+            // 1つずつ進める startRoot と、複数のプレイアウトを揃えて進める startBatch の両方から使う
+            enum{
+                LEAF_NONE, // 末端判定なし、そのまま進める
+                LEAF_CLASSES, // 順位が決まったので終局処理へ
+                LEAF_REWARD, // 報酬まで決まったので終了
+            };
+            template<class sharedData_t, class threadTools_t>
+            int judgeLeaf(PlayouterField *const, int, sharedData_t *const, threadTools_t *const);
+            
+            template<class threadTools_t>
+            int searchMateMove(PlayouterField *const, threadTools_t *const);
+            
+            template<int M, class sharedData_t, class threadTools_t>
+            void choosePolicyMove(PlayouterField *const, double, sharedData_t *const, threadTools_t *const);
+            
+            template<class sharedData_t, class threadTools_t>
+            void setGameReward(PlayouterField *const pfield, sharedData_t *const pshared, threadTools_t *const ptools){
+                for(int p = 0; p < N_PLAYERS; ++p){
+                    pfield->infoReward.replace(p, pshared->gameReward[pfield->getPlayerNewClass(p)]);
+                }
+                // 途中で通った終盤の局面に上がり順を登録
+                for(int i = 0; i < pfield->NOutcomeKeys; ++i){
+                    uint32_t classes = 0;
+                    for(int p = 0; p < N_PLAYERS; ++p){
+                        if(pfield->outcomeAlive[i] & (1U << p))classes |= pfield->getPlayerNewClass(p) << (4 * p);
+                    }
+                    ptools->outcomeCache.regist(pfield->outcomeKey[i], classes, i == pfield->outcomeSolvedIndex, &ptools->dice);
+                }
+            }
+            
         public:
             using pField_t = PlayouterField;
             
@@ -54,6 +87,9 @@ namespace UECda{
             template<int M = 0, class sharedData_t, class threadTools_t>
             int startRoot(PlayouterField *const, MoveInfo, sharedData_t *const, threadTools_t *const);
             
+            template<int M = 0, class sharedData_t, class threadTools_t>
+            int startBatch(PlayoutBatch *const, bool, int, sharedData_t *const, threadTools_t *const);
+            
             constexpr Playouter()
             //:mode()
             {}
@@ -62,155 +98,248 @@ namespace UECda{
         //const std::string Playouter_name = "Playouter";
         //StaticAnalyzer<3, 6, 2> Playouter::ana(Playouter_name);
         
+        template<class sharedData_t, class threadTools_t>
+        int Playouter::judgeLeaf(PlayouterField *const pfield,
+                                 int plies,
+                                 sharedData_t *const pshared,
+                                 threadTools_t *const ptools){
+            // 着手生成前の末端判定
+            const uint32_t tp = pfield->getTurnPlayer();
+            bool outcomeKeyPushed = false;
+            
+            if(Settings::playoutOutcomeCache && ptools->outcomeCache.size() > 0
+               && pfield->isNF() && pfield->remQty <= (uint32_t)Settings::outcomeCacheMaxCards){
+                // 終盤の空場では、同じ局面のこれまでの結果を引く
+                const uint64_t key = pfield->getFullInfoKey();
+                uint32_t classes;
+                bool solved;
+                if(ptools->outcomeCache.probe(key, Settings::outcomeCacheReuseRate, &ptools->dice, &classes, &solved)){
+                    for(int p = 0; p < N_PLAYERS; ++p){
+                        if(pfield->isAlive(p))pfield->setPlayerNewClass(p, (classes >> (4 * p)) & 15U);
+                    }
+                    // 確定した結果でなければ、途中の局面の結果としては登録しない
+                    if(!solved)pfield->discardOutcomeKeys();
+                    return LEAF_CLASSES;
+                }
+                outcomeKeyPushed = pfield->pushOutcomeKey(key);
+            }
+            
+            if(Settings::truncatedPlayout && plies >= Settings::truncationPlies
+               && pfield->isNF() && pfield->getNAlivePlayers() > 2){
+                // 打ち切り
+                // 規定手数の後の最初の空場で、順位予測から上がり順を選んで終局とする
+                // 2人になったら L2 判定の方が正確なので最後まで進める
+                // 予測した上がり順は置換表に登録しない
+                pfield->discardOutcomeKeys();
+                simulateClassesByStaticEval(pfield, pfield->mv, pshared->staticEvaluator, &ptools->dice);
+                return LEAF_CLASSES;
+            }
+            
+            if(Settings::L2SearchInSimulation && pfield->isL2Situation()){ // L2
+#ifdef SEARCH_LEAF_L2
+                const uint32_t blackPlayer = tp;
+                const uint32_t whitePlayer = pfield->ps.searchOpsPlayer(blackPlayer);
+                
+                ASSERT(pfield->isAlive(blackPlayer) && pfield->isAlive(whitePlayer),);
+                
+                // ノード上限はスレッドごとの予算から決める
+                auto& leafSearch = ptools->leafSearch;
+                const auto start = LeafSearchController::clock_t::now();
+                L2Judge l2(leafSearch.L2NodeLimit(start), pfield->mv);
+                int l2Result = l2.start_judge(pfield->hand[blackPlayer], pfield->hand[whitePlayer], pfield->bd, pfield->fieldInfo);
+                leafSearch.feedL2(l2.getNodes(), l2Result == L2_WIN || l2Result == L2_LOSE, l2.isFailed(),
+                                  start, LeafSearchController::clock_t::now());
+                
+                //std::swap(blackPlayer, whitePlayer); <- for debug
+                
+                if(l2Result == L2_WIN){
+                    pfield->setPlayerNewClass(blackPlayer, pfield->getWorstClass() - 1);
+                    pfield->setPlayerNewClass(whitePlayer, pfield->getWorstClass());
+                    if(outcomeKeyPushed)pfield->setLastOutcomeSolved();
+                    return LEAF_CLASSES;
+                }else if(l2Result == L2_LOSE){
+                    pfield->setPlayerNewClass(whitePlayer, pfield->getWorstClass() - 1);
+                    pfield->setPlayerNewClass(blackPlayer, pfield->getWorstClass());
+                    if(outcomeKeyPushed)pfield->setLastOutcomeSolved();
+                    return LEAF_CLASSES;
+                }
+#endif // SEARCH_LEAF_L2
+            }else if(Settings::LnCISearchInSimulation && pfield->isLnCISituation()){
+                //ana.restart(mode, 1);
+                
+#ifdef SEARCH_LEAF_LNCI
+                // 1回あたりの時間が残り時間に比べて大きければ行わない
+                auto& leafSearch = ptools->leafSearch;
+                const auto start = LeafSearchController::clock_t::now();
+                if(!leafSearch.allowsLnCI(start)){
+                    leafSearch.skipLnCI();
+                    return LEAF_NONE;
+                }
+                
+                // Ln完全情報探索に入る
+                LnCIJudge cij(pfield->mv);
+                BitArray64<11, N_PLAYERS> reward(0);
+                
+                BitSet32 attractedPlayers = pfield->attractedPlayers;
+                
+                attractedPlayers.set(pfield->getTurnPlayer());
+                
+                cij.start(&reward, *pfield, attractedPlayers); // ここでCI探索開始
+                
+                //cerr<<pfield->toDebugString();
+                
+                uint32_t bestReward = pshared->gameReward[pfield->getBestClass()];
+                
+                const bool solved = search(pfield->attractedPlayers, [reward, bestReward](uint32_t pn)->bool{
+                    if (reward[pn] > bestReward){
+                        //cerr<<"reward = "<<reward<<" bestReward = "<<bestReward<<endl;getchar();
+                        return true; // continue playout due to wrong reward
+                    }else{
+                        return false;
+                    }
+                }) == -1;
+                leafSearch.feedLnCI(solved, start, LeafSearchController::clock_t::now());
+                
+                if(solved){
+                    // rewards might be OK
+                    //cerr<<pfield->toDebugString();
+                    
+                    //cerr<<reward<<endl;getchar();
+                    iterate(pfield->attractedPlayers, [reward, pfield](uint32_t pn)->void{
+                        pfield->infoReward.assign(pn, reward[pn]);
+                    });
+                    return LEAF_REWARD;
+                }
+#endif // SEARCH_LEAF_LNCI
+            }
+            return LEAF_NONE;
+        }
+        
+        template<class threadTools_t>
+        int Playouter::searchMateMove(PlayouterField *const pfield,
+                                      threadTools_t *const ptools){
+            // 必勝着手を探す。無ければ -1
+            //int idxMate = searchHandMate(0, pfield->mv, pfield->NActiveMoves, pfield->hand[tp], pfield->opsHand[tp], pfield->bd, 1, 1);
+            int idxMate = -1;
+#ifdef SEARCH_LEAF_MATE
+            if(Settings::MateSearchInSimulation){
+                const uint32_t tp = pfield->getTurnPlayer();
+                const Hand& myHand = pfield->hand[tp];
+                const Hand& opsHand = pfield->getOpsHand(tp);
+                auto& stats = ptools->mateStats;
+                stats.turns += 1;
+                // 手札単位でどの着手も必勝でないとわかれば着手ごとの判定を省く
+                if(judgeNoMate_Easy(myHand, opsHand, pfield->bd, pfield->fieldInfo)){
+                    stats.filtered += 1;
+                    stats.skippedMoves += pfield->NActiveMoves;
+                    setDominanceFlags(pfield->mv, pfield->NActiveMoves,
+                                      myHand, opsHand, pfield->bd, pfield->fieldInfo);
+                    return -1;
+                }
+                stats.checkedMoves += pfield->NActiveMoves;
+                int mateIndex[N_MAX_MOVES];
+                const int mates = checkHandMateAll(0, pfield->mv, pfield->NActiveMoves, mateIndex,
+                                                   myHand, opsHand, pfield->bd, pfield->fieldInfo);
+                if(mates > 0)stats.mates += 1;
+                if(mates == 1){
+                    idxMate = mateIndex[0];
+                }else if(mates > 1){ // 探索順バイアス回避のために必勝全部の中からランダムに選ぶ
+                    idxMate = mateIndex[ptools->dice.rand() % mates];
+                }
+            }
+#endif // SEARCH_LEAF_MATE
+            return idxMate;
+        }
+        
+        template<int M, class sharedData_t, class threadTools_t>
+        void Playouter::choosePolicyMove(PlayouterField *const pfield,
+                                         double progress,
+                                         sharedData_t *const pshared,
+                                         threadTools_t *const ptools){
+            // 方策に従って着手を選ぶ
+            if (pfield->NActiveMoves <= 1){
+                pfield->setPlayMove(pfield->mv[0]);
+                return;
+            }
+            const uint32_t tp = pfield->getTurnPlayer();
+            double score[N_MAX_MOVES + 1];
+            
+            // 行動評価関数を計算
+            // 手札ごとの値は手札が変わったときだけ計算し直す
+            pfield->updatePlayerPolicySubValue(tp, pfield->mv + pfield->NActiveMoves);
+            calcPlayPolicyScoreFast<M>(score, *pfield, pshared->basePlayPolicy);
+            
+            // 行動評価関数からの着手の選び方は複数パターン用意して実験できるようにする
+            int idx;
+            if(Settings::simulationSelector == Selector::EXP_BIASED){
+                // 点差の指数増幅
+                ExpBiasedSoftmaxSelector selector(score, pfield->NActiveMoves,
+                                                  Settings::simulationTemperaturePlay,
+                                                  Settings::simulationAmplifyCoef,
+                                                  1 / log(Settings::simulationAmplifyExponent));
+                if(Settings::simulationPlayModel){
+#ifdef MODELING_PLAY
+                    addPlayerPlayBias(score, pfield->mv, pfield->NActiveMoves, *pfield, pshared->playerModelSpace.model(tp), Settings::playerBiasCoef * progress);
+#endif
+                }
+                selector.amplify();
+                selector.to_prob();
+                idx = selector.select(ptools->dice.drand());
+            }else if(Settings::simulationSelector == Selector::POLY_BIASED){
+                // 点差の多項式増幅
+                BiasedSoftmaxSelector selector(score, pfield->NActiveMoves,
+                                               Settings::simulationTemperaturePlay,
+                                               Settings::simulationAmplifyCoef,
+                                               Settings::simulationAmplifyExponent);
+                if(Settings::simulationPlayModel){
+#ifdef MODELING_PLAY
+                    addPlayerPlayBias(score, pfield->mv, pfield->NActiveMoves, *pfield, pshared->playerModelSpace.model(tp), Settings::playerBiasCoef * progress);
+#endif
+                }
+                selector.amplify();
+                selector.to_prob();
+                idx = selector.select(ptools->dice.drand());
+            }else if(Settings::simulationSelector == Selector::THRESHOLD){
+                // 閾値ソフトマックス
+                idx = selectByThresholdSoftmax(score, pfield->NActiveMoves, Settings::simulationTemperaturePlay, 0.02, &ptools->dice);
+            }else{
+                // 単純ソフトマックス
+                idx = selectBySoftmax(score, pfield->NActiveMoves, Settings::simulationTemperaturePlay, &ptools->dice);
+            }
+            pfield->setPlayMove(pfield->mv[idx]);
+        }
+        
         template<int M, class sharedData_t, class threadTools_t>
         int Playouter::startRoot(PlayouterField *const pfield,
                                  sharedData_t *const pshared,
                                  threadTools_t *const ptools){
             double progress = 1;
+            int plies = 0;
             pfield->initForPlayout();
             while(1){
                 DERR << pfield->toString();
                 DERR << "turn : " << pfield->getTurnPlayer() << endl;
                 uint32_t tp = pfield->getTurnPlayer();
-
+                
                 pfield->prepareForPlay();
-
-                if(Settings::L2SearchInSimulation && pfield->isL2Situation()){ // L2
-#ifdef SEARCH_LEAF_L2
-                    const uint32_t blackPlayer = tp;
-                    const uint32_t whitePlayer = pfield->ps.searchOpsPlayer(blackPlayer);
-
-                    ASSERT(pfield->isAlive(blackPlayer) && pfield->isAlive(whitePlayer),);
-
-                    L2Judge l2(65536, pfield->mv);
-                    int l2Result = l2.start_judge(pfield->hand[blackPlayer], pfield->hand[whitePlayer], pfield->bd, pfield->fieldInfo);
-
-                    //std::swap(blackPlayer, whitePlayer); <- for debug
-
-                    if(l2Result == L2_WIN){
-                        pfield->setPlayerNewClass(blackPlayer, pfield->getWorstClass() - 1);
-                        pfield->setPlayerNewClass(whitePlayer, pfield->getWorstClass());
-                        goto GAME_END;
-                    }else if(l2Result == L2_LOSE){
-                        pfield->setPlayerNewClass(whitePlayer, pfield->getWorstClass() - 1);
-                        pfield->setPlayerNewClass(blackPlayer, pfield->getWorstClass());
-                        goto GAME_END;
-                    }
-#endif // SEARCH_LEAF_L2
-                }else if(Settings::LnCISearchInSimulation && pfield->isLnCISituation()){
-                    //ana.restart(mode, 1);
-
-#ifdef SEARCH_LEAF_LNCI
-                    // Ln完全情報探索に入る
-                    LnCIJudge cij(pfield->mv);
-                    BitArray64<11, N_PLAYERS> reward(0);
-
-                    BitSet32 attractedPlayers = pfield->attractedPlayers;
-                    
-                    attractedPlayers.set(pfield->getTurnPlayer());
-                    
-                    cij.start(&reward, *pfield, attractedPlayers); // ここでCI探索開始
-
-                    //cerr<<pfield->toDebugString();
-                    
-                    uint32_t bestReward = pshared->gameReward[pfield->getBestClass()];
-                    
-                    if(search(pfield->attractedPlayers, [reward, bestReward](uint32_t pn)->bool{
-                        if (reward[pn] > bestReward){
-                            //cerr<<"reward = "<<reward<<" bestReward = "<<bestReward<<endl;getchar();
-                            return true; // continue playout due to wrong reward
-                        }else{
-                            return false;
-                        }
-                    }) == -1){
-                        // rewards might be OK
-                        //cerr<<pfield->toDebugString();
-                        
-                        //cerr<<reward<<endl;getchar();
-                        iterate(pfield->attractedPlayers, [reward, pfield](uint32_t pn)->void{
-                            pfield->infoReward.assign(pn, reward[pn]);
-                        });
-                        return 0;
-                    }
-#endif // SEARCH_LEAF_LNCI
-                }
-
+                
+                const int leaf = judgeLeaf(pfield, plies, pshared, ptools);
+                if(leaf == LEAF_CLASSES){ goto GAME_END; }
+                if(leaf == LEAF_REWARD){ return 0; }
+                
                 // 合法着手生成
                 pfield->NMoves = pfield->NActiveMoves = genMove(pfield->mv, pfield->hand[tp].cards, pfield->bd);
                 if(pfield->NMoves == 1){
                     pfield->setPlayMove(pfield->mv[0]);
                 }else{
                     // search mate-move
-                    //int idxMate = searchHandMate(0, pfield->mv, pfield->NActiveMoves, pfield->hand[tp], pfield->opsHand[tp], pfield->bd, 1, 1);
-                    int idxMate = -1;
-#ifdef SEARCH_LEAF_MATE
-                    if(Settings::MateSearchInSimulation){
-                        int mateIndex[N_MAX_MOVES];
-                        int mates = 0;
-                        for(int m = 0; m < pfield->NActiveMoves; ++m){
-                            bool mate = checkHandMate(0, pfield->mv + pfield->NActiveMoves, pfield->mv[m],
-                                                      pfield->hand[tp], pfield->opsHand[tp], pfield->bd, pfield->fieldInfo);
-                            if(mate){ mateIndex[mates++] = m; }
-                        }
-                        if(mates == 1){
-                            idxMate = mateIndex[0];
-                        }else if(mates > 1){ // 探索順バイアス回避のために必勝全部の中からランダムに選ぶ
-                            idxMate = mateIndex[ptools->dice.rand() % mates];
-                        }
-                    }
-#endif // SEARCH_LEAF_MATE
+                    const int idxMate = searchMateMove(pfield, ptools);
                     if(idxMate != -1){ // mate
                         pfield->setPlayMove(pfield->mv[idxMate]);
                         pfield->playMove.setMPMate();
                         pfield->fieldInfo.setMPMate();
                     }else{
-                        if (pfield->NActiveMoves <= 1){
-                            pfield->setPlayMove(pfield->mv[0]);
-                        }else{
-                            double score[N_MAX_MOVES + 1];
-
-                            // 行動評価関数を計算
-                            calcPlayPolicyScoreSlow<M>(score, *pfield, pshared->basePlayPolicy);
-
-                            // 行動評価関数からの着手の選び方は複数パターン用意して実験できるようにする
-                            int idx;
-                            if(Settings::simulationSelector == Selector::EXP_BIASED){
-                                // 点差の指数増幅
-                                ExpBiasedSoftmaxSelector selector(score, pfield->NActiveMoves,
-                                                                  Settings::simulationTemperaturePlay,
-                                                                  Settings::simulationAmplifyCoef,
-                                                                  1 / log(Settings::simulationAmplifyExponent));
-                                if(Settings::simulationPlayModel){
-#ifdef MODELING_PLAY
-                                    addPlayerPlayBias(score, pfield->mv, pfield->NActiveMoves, *pfield, pshared->playerModelSpace.model(tp), Settings::playerBiasCoef * progress);
-#endif
-                                }
-                                selector.amplify();
-                                selector.to_prob();
-                                idx = selector.select(ptools->dice.drand());
-                            }else if(Settings::simulationSelector == Selector::POLY_BIASED){
-                                // 点差の多項式増幅
-                                BiasedSoftmaxSelector selector(score, pfield->NActiveMoves,
-                                                               Settings::simulationTemperaturePlay,
-                                                               Settings::simulationAmplifyCoef,
-                                                               Settings::simulationAmplifyExponent);
-                                if(Settings::simulationPlayModel){
-#ifdef MODELING_PLAY
-                                    addPlayerPlayBias(score, pfield->mv, pfield->NActiveMoves, *pfield, pshared->playerModelSpace.model(tp), Settings::playerBiasCoef * progress);
-#endif
-                                }
-                                selector.amplify();
-                                selector.to_prob();
-                                idx = selector.select(ptools->dice.drand());
-                            }else if(Settings::simulationSelector == Selector::THRESHOLD){
-                                // 閾値ソフトマックス
-                                idx = selectByThresholdSoftmax(score, pfield->NActiveMoves, Settings::simulationTemperaturePlay, 0.02, &ptools->dice);
-                            }else{
-                                // 単純ソフトマックス
-                                idx = selectBySoftmax(score, pfield->NActiveMoves, Settings::simulationTemperaturePlay, &ptools->dice);
-                            }
-                            pfield->setPlayMove(pfield->mv[idx]);
-                        }
+                        choosePolicyMove<M>(pfield, progress, pshared, ptools);
                     }
                 }
                 DERR << tp << " : " << pfield->playMove << " (" << pfield->hand[tp].qty << ")" << endl;
@@ -227,12 +356,11 @@ namespace UECda{
                 pfield->procPolicySubValue(tp, pfield->playMove.mv(), pshared->basePlayPolicy);
                 
                 progress *= 0.95;
+                ++plies;
             }
         GAME_END:
             //getchar();
-            for(int p = 0; p < N_PLAYERS; ++p){
-                pfield->infoReward.replace(p, pshared->gameReward[pfield->getPlayerNewClass(p)]);
-            }
+            setGameReward(pfield, pshared, ptools);
             return 0;
         }
 
@@ -296,6 +424,98 @@ namespace UECda{
             //cerr << pfield->toString();
             return startRoot(pfield, pshared, ptools);
         }
+        
+        template<int M, class sharedData_t, class threadTools_t>
+        int Playouter::startBatch(PlayoutBatch *const pbatch,
+                                  bool isChange, int p,
+                                  sharedData_t *const pshared,
+                                  threadTools_t *const ptools){
+            // 詰めた複数のプレイアウトを1手ずつ揃えて進める
+            // 末端判定、着手生成、必勝判定、着手選択、盤面更新をそれぞれ全レーン続けて行い、
+            // 同じ処理を続けて実行することで命令キャッシュと分岐予測を効かせる
+            // 各レーンの手順は startRoot, startChange と同じ
+            const int lanes = pbatch->lanes;
+            int running = 0;
+            for(int i = 0; i < lanes; ++i){
+                PlayouterField *const pfield = &pbatch->field[i];
+                pfield->mv = pbatch->buffer(i);
+                pbatch->plies[i] = 0;
+                pbatch->progress[i] = 1;
+                pbatch->running[i] = false;
+                if(isChange){
+                    int changePartner = pfield->getClassPlayer(getChangePartnerClass(pfield->getPlayerClass(p)));
+                    pfield->makeChange(p, changePartner, pbatch->rootChange[i]);
+                    pfield->prepareAfterChange();
+                }else{
+                    if(pfield->procSlowest(pbatch->rootMove[i]) == -1){
+                        continue;
+                    }
+                }
+                pfield->initForPlayout();
+                pbatch->running[i] = true;
+                ++running;
+            }
+            
+            int mateIndex[PlayoutBatch::N_MAX_LANES];
+            while(running > 0){
+                // 末端判定
+                for(int i = 0; i < lanes; ++i){
+                    if(!pbatch->running[i])continue;
+                    PlayouterField *const pfield = &pbatch->field[i];
+                    pfield->prepareForPlay();
+                    const int leaf = judgeLeaf(pfield, pbatch->plies[i], pshared, ptools);
+                    if(leaf != LEAF_NONE){
+                        if(leaf == LEAF_CLASSES){ setGameReward(pfield, pshared, ptools); }
+                        pbatch->running[i] = false;
+                        --running;
+                    }
+                }
+                // 合法着手生成
+                for(int i = 0; i < lanes; ++i){
+                    if(!pbatch->running[i])continue;
+                    PlayouterField *const pfield = &pbatch->field[i];
+                    const uint32_t tp = pfield->getTurnPlayer();
+                    pfield->NMoves = pfield->NActiveMoves = genMove(pfield->mv, pfield->hand[tp].cards, pfield->bd);
+                }
+                // 必勝判定
+                for(int i = 0; i < lanes; ++i){
+                    if(!pbatch->running[i])continue;
+                    PlayouterField *const pfield = &pbatch->field[i];
+                    mateIndex[i] = (pfield->NMoves == 1) ? -1 : searchMateMove(pfield, ptools);
+                }
+                // 着手選択
+                for(int i = 0; i < lanes; ++i){
+                    if(!pbatch->running[i])continue;
+                    PlayouterField *const pfield = &pbatch->field[i];
+                    if(pfield->NMoves == 1){
+                        pfield->setPlayMove(pfield->mv[0]);
+                    }else if(mateIndex[i] != -1){ // mate
+                        pfield->setPlayMove(pfield->mv[mateIndex[i]]);
+                        pfield->playMove.setMPMate();
+                        pfield->fieldInfo.setMPMate();
+                    }else{
+                        choosePolicyMove<M>(pfield, pbatch->progress[i], pshared, ptools);
+                    }
+                }
+                // 盤面更新
+                for(int i = 0; i < lanes; ++i){
+                    if(!pbatch->running[i])continue;
+                    PlayouterField *const pfield = &pbatch->field[i];
+                    const uint32_t tp = pfield->getTurnPlayer();
+                    if(pfield->proc(tp, pfield->playMove) == -1){
+                        setGameReward(pfield, pshared, ptools);
+                        pbatch->running[i] = false;
+                        --running;
+                    }else{
+                        // 方策計算用のパラメータ更新
+                        pfield->procPolicySubValue(tp, pfield->playMove.mv(), pshared->basePlayPolicy);
+                        pbatch->progress[i] *= 0.95;
+                        ++pbatch->plies[i];
+                    }
+                }
+            }
+            return 0;
+        }
 
     }
 }
@@ -0,0 +1,53 @@
+/*
+ ponder.hpp
+ Katsuki Ohto
+ */
+
+#pragma once
+
+#include "../../settings.h"
+#include "../estimation/dealer.hpp"
+#include "monteCarlo.hpp"
+
+// 相手の手番中の先読み
+// 次の自分の着手決定で使う仮想世界を作っておく
+// 作った世界は相手の着手が届いた時点で矛盾するものが消され(Galaxy::proceed)、
+// 生き残ったものが次の探索で新しく作る世界より先に使われる
+// 次の自分の着手決定の局面が予測できる場合は、その局面の候補についてプレイアウトも行い、
+// 予測が当たったときはその結果を次のルートの統計に加える
+
+namespace UECda{
+    namespace Fuji{
+        
+        template<class root_t, class field_t, class sharedData_t, class threadTools_t>
+        void PonderThread
+        (const int threadId, const int threads,
+         root_t *const proot,
+         const field_t *const pfield,
+         sharedData_t *const pshared,
+         threadTools_t *const ptools,
+         const std::atomic<bool> *const pstop){
+            
+            if(proot != nullptr){
+                // 予測した局面 pfield をルートとしてモンテカルロを行う
+                // 世界作成も含めて通常の探索と同じで、止めるときは proot->exitFlag を立てる
+                MonteCarloThread(threadId, threads, proot, pfield, pshared, ptools);
+                return;
+            }
+            
+            auto& gal = pshared->gal; // 全スレッドで共有する世界プール
+            
+            // 世界創世者
+            RandomDealer<N_PLAYERS> estimator;
+            estimator.set(*pfield, *pshared);
+            
+            while(!pstop->load(std::memory_order_relaxed)){
+                auto *const pWorld = gal.searchSpace();
+                if(pWorld == nullptr)break; // 世界プールが埋まった
+                estimator.create(pWorld, Settings::monteCarloDealType,
+                                 *pfield, *pshared, ptools);
+                if(gal.regist(pWorld) != 0)break;
+            }
+        }
+    }
+}
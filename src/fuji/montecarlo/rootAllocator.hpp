@@ -0,0 +1,316 @@
+/*
+ rootAllocator.hpp
+ Katsuki Ohto
+ */
+
+#pragma once
+
+#include <atomic>
+
+#include "../../settings.h"
+
+// ルートでのプレイアウトの割り振り
+// Settings::rootAllocator で選ぶ
+// UCB_ROOT : UCB-root (候補が2つの時は同数ずつ)
+// SEQUENTIAL_HALVING : 予算を各段で均等に使い、段ごとに候補を半分にする
+// SUCCESSIVE_REJECTS : 段ごとに最悪の候補を1つずつ除く
+// PROGRESSIVE_WIDENING : 方策の確率の高い順に、プレイアウト数に応じて候補を増やし、その中で PUCT により選ぶ
+// SEQUENTIAL_HALVING と SUCCESSIVE_REJECTS は予算(打ち切り回数)が決まっている探索のためのもので、
+// 生き残りの候補は全スレッドで共有し(RootElimination)、順位付けには全スレッドの統計を使う
+// 候補が1つに絞られた時点で決定とし、探索を打ち切る。着手はその生き残りの候補とする
+
+namespace UECda{
+    namespace Fuji{
+        
+        struct RootAllocatorStatistics{
+            // 決定までに使ったプレイアウト数の記録
+            uint64_t decisions;
+            uint64_t decidedSimulationsSum; // 最善候補が決まるまで
+            uint64_t simulationsSum; // 打ち切りまで
+            uint64_t candidatesSum, unvisitedSum; // 候補数と、割り振りの後で除外した候補数
+            
+            void clear(){
+                decisions = 0;
+                decidedSimulationsSum = simulationsSum = 0;
+                candidatesSum = unvisitedSum = 0;
+            }
+            void feed(uint64_t decided, uint64_t all, int candidates = 0, int unvisited = 0){
+                ++decisions;
+                decidedSimulationsSum += decided;
+                simulationsSum += all;
+                candidatesSum += candidates;
+                unvisitedSum += unvisited;
+            }
+            std::string toString()const{
+                std::ostringstream oss;
+                const double n = max(decisions, (uint64_t)1);
+                oss << "RootAllocator : " << decisions << " decisions";
+                oss << " playouts to decision " << decidedSimulationsSum / n;
+                oss << " playouts " << simulationsSum / n;
+                if(unvisitedSum > 0){
+                    oss << " pruned candidates " << unvisitedSum / n << " / " << candidatesSum / n;
+                }
+                return oss.str();
+            }
+            RootAllocatorStatistics(){ clear(); }
+        };
+        
+        class RootElimination{
+            // 候補を絞る方式の、全スレッドで共有する状態
+            // 割り当ての通し番号 pulls を全スレッドで数え、段の終わり phaseEnd に達したスレッドが
+            // 全体の統計で評価の低い候補を除いて次の段を始める
+        public:
+            void reset()noexcept{ status = 0; }
+            
+            void setup(RootAllocatorType atype, int candidates, uint64_t abudget){
+                // 最初に来たスレッドが設定し、他のスレッドはそれを待つ
+                int expected = 0;
+                if(!status.compare_exchange_strong(expected, 1)){
+                    while(status.load(std::memory_order_acquire) != 2){}
+                    return;
+                }
+                type = atype;
+                NCandidates = candidates;
+                for(int c = 0; c < candidates; ++c){
+                    survivor[c] = c;
+                }
+                budget = max(abudget, (uint64_t)candidates);
+                rounds = 0;
+                for(int n = candidates; n > 1; n = (n + 1) / 2)++rounds;
+                logBar = 0.5;
+                for(int k = 2; k <= candidates; ++k)logBar += 1.0 / k;
+                phase = 0;
+                lastTarget = 0;
+                pulls = 0;
+                transition.clear();
+                NSurvivors = candidates;
+                phaseEnd = (candidates > 1) ? phaseTrials(candidates) * candidates : 0;
+                status.store(2, std::memory_order_release);
+            }
+            
+            bool active()const noexcept{
+                // 候補を絞る方式で探索したか
+                return status.load() == 2
+                && (type == RootAllocatorType::SEQUENTIAL_HALVING || type == RootAllocatorType::SUCCESSIVE_REJECTS);
+            }
+            int survivors()const noexcept{ return NSurvivors.load(std::memory_order_acquire); }
+            bool survives(int c)const noexcept{
+                const int n = survivors();
+                for(int i = 0; i < n; ++i){
+                    if(survivor[i].load(std::memory_order_relaxed) == c)return true;
+                }
+                return false;
+            }
+            
+            template<class score_t>
+            int select(const score_t& score){
+                const int n = survivors();
+                if(n <= 1)return survivor[0].load(std::memory_order_relaxed);
+                
+                const uint64_t k = pulls.fetch_add(1);
+                const int c = survivor[k % n].load(std::memory_order_relaxed);
+                if(k + 1 >= phaseEnd.load(std::memory_order_acquire) && !transition.test_and_set()){
+                    // この段の割り当てを終えたので、全体の統計で評価の低い候補を除く
+                    // 他のスレッドが先に段を進めていたら何もしない
+                    const uint64_t end = phaseEnd.load(std::memory_order_acquire);
+                    const int ns = survivors();
+                    if(k + 1 >= end && ns > 1){
+                        int tmp[N_MAX_MOVES + 64];
+                        for(int i = 0; i < ns; ++i)tmp[i] = survivor[i].load(std::memory_order_relaxed);
+                        std::sort(tmp, tmp + ns, [&](int a, int b)->bool{
+                            return score(a).mean() > score(b).mean();
+                        });
+                        const int next = (type == RootAllocatorType::SEQUENTIAL_HALVING) ? ((ns + 1) / 2) : (ns - 1);
+                        for(int i = 0; i < next; ++i)survivor[i].store(tmp[i], std::memory_order_relaxed);
+                        ++phase;
+                        if(next > 1)phaseEnd.store(end + phaseTrials(next) * next, std::memory_order_release);
+                        NSurvivors.store(next, std::memory_order_release);
+                    }
+                    transition.clear(std::memory_order_release);
+                }
+                return c;
+            }
+            
+            RootElimination(){ reset(); }
+            
+        private:
+            std::atomic<int> status; // 0 : 未設定 1 : 設定中 2 : 設定済み
+            RootAllocatorType type;
+            int NCandidates;
+            std::atomic<int> survivor[N_MAX_MOVES + 64];
+            std::atomic<int> NSurvivors;
+            std::atomic<uint64_t> pulls; // 全スレッドで割り当てた数
+            std::atomic<uint64_t> phaseEnd; // この段が終わる pulls の値
+            std::atomic_flag transition = ATOMIC_FLAG_INIT; // 段を進めているスレッドがあるか
+            
+            // 以下は段を進めるスレッドだけが書き換える
+            uint64_t budget;
+            int rounds; // 逐次半減の段数
+            double logBar; // 逐次棄却の正規化定数
+            int phase;
+            uint64_t lastTarget; // 逐次棄却で前の段までに各候補に割り当てた数
+            
+            uint64_t phaseTrials(int n){
+                // 生き残り n 個の段で各候補に割り当てる数
+                if(type == RootAllocatorType::SEQUENTIAL_HALVING){
+                    return max((uint64_t)1, budget / ((uint64_t)n * rounds));
+                }else{
+                    // 段 k (1から) までに各候補に割り当てる数は (n - K) / (logBar * (K + 1 - k)) の切り上げ
+                    const int k = phase + 1;
+                    const uint64_t target = (uint64_t)ceil((budget - NCandidates) / (logBar * (NCandidates + 1 - k)));
+                    const uint64_t trials = max((uint64_t)1, target - min(target, lastTarget));
+                    lastTarget = max(lastTarget, target);
+                    return trials;
+                }
+            }
+        };
+        
+        class RootAllocator{
+        public:
+            void init(RootAllocatorType atype, int candidates, uint64_t budget,
+                      const double *const prior = nullptr, RootElimination *const pel = nullptr){
+                // prior は候補ごとの方策の確率(PROGRESSIVE_WIDENING のとき使う)
+                // pel は候補を絞る方式で全スレッドが共有する状態(無ければこの割り振りだけで使う)
+                // 共有するときの budget は全スレッド合わせた予算
+                type = atype;
+                NCandidates = candidates;
+                NAdmitted = candidates;
+                if(type == RootAllocatorType::UCB_ROOT || candidates <= 1)return;
+                if(type == RootAllocatorType::PROGRESSIVE_WIDENING){
+                    initWidening(prior);
+                    return;
+                }
+                if(pel == nullptr){
+                    ownElimination.reset();
+                    elimination = &ownElimination;
+                }else{
+                    elimination = pel;
+                }
+                elimination->setup(type, candidates, budget);
+            }
+            
+            bool decided()const{
+                // 候補が1つに絞られたか
+                return type != RootAllocatorType::UCB_ROOT && type != RootAllocatorType::PROGRESSIVE_WIDENING
+                && NCandidates > 1 && elimination->survivors() <= 1;
+            }
+            
+            int admitted()const noexcept{ return NAdmitted; } // 割り振りの対象にしている候補の数
+            bool admits(int c)const noexcept{
+                // 候補 c を割り振りの対象にしているか
+                if(type != RootAllocatorType::PROGRESSIVE_WIDENING)return true;
+                return rankOf[c] < NAdmitted;
+            }
+            
+            template<class score_t, class simulations_t, class dice_t>
+            int select(const score_t& score, const simulations_t& simulations,
+                       double allSize, uint32_t minTrials, dice_t *const pdice){
+                // score(c) は候補 c の評価分布、simulations(c) はシミュレーション数
+                if(type == RootAllocatorType::UCB_ROOT || NCandidates <= 1){
+                    return selectUCB(score, simulations, allSize, minTrials, pdice);
+                }
+                if(type == RootAllocatorType::PROGRESSIVE_WIDENING){
+                    return selectPUCT(score, simulations, pdice);
+                }
+                return elimination->select(score);
+            }
+            
+        private:
+            RootAllocatorType type;
+            int NCandidates;
+            int NAdmitted;
+            
+            // 候補を増やしていく方式の状態
+            // survivor に方策の確率の高い順の候補を入れ、rankOf をその逆引きとする
+            double prior[N_MAX_MOVES + 64];
+            int rankOf[N_MAX_MOVES + 64];
+            int survivor[N_MAX_MOVES + 64];
+            int NSurvivors;
+            
+            // 候補を絞る方式の状態
+            RootElimination *elimination = nullptr;
+            RootElimination ownElimination;
+            
+            void initWidening(const double *const p){
+                double sum = 0;
+                for(int c = 0; c < NCandidates; ++c){
+                    // 方策計算に含めなかった候補は負の値になっている
+                    prior[c] = (p != nullptr) ? max(0.0, p[c]) : 0.0;
+                    sum += prior[c];
+                }
+                for(int c = 0; c < NCandidates; ++c){
+                    prior[c] = (sum > 0) ? (prior[c] / sum) : (1.0 / NCandidates);
+                    survivor[c] = c;
+                }
+                std::stable_sort(survivor, survivor + NCandidates, [&](int a, int b)->bool{
+                    return prior[a] > prior[b];
+                });
+                for(int i = 0; i < NCandidates; ++i)rankOf[survivor[i]] = i;
+                NSurvivors = NCandidates;
+                NAdmitted = min(NCandidates, 2);
+            }
+            
+            template<class score_t, class simulations_t, class dice_t>
+            int selectPUCT(const score_t& score, const simulations_t& simulations, dice_t *const pdice){
+                // 全体のプレイアウト数 n に対して ceil(coef * n^exponent) 個(2個以上)の候補を対象とする
+                uint64_t n = 0;
+                for(int c = 0; c < NCandidates; ++c)n += simulations(c);
+                const int widened = (int)ceil(Settings::rootWideningCoef * pow((double)n, Settings::rootWideningExponent));
+                NAdmitted = min(NCandidates, max(NAdmitted, widened));
+                
+                // PUCT 値 mean + c * prior * sqrt(n) / (1 + n_c) が最大のものを選ぶ
+                const double sqrtN = sqrt((double)max(n, (uint64_t)1));
+                int tryingIndex = survivor[0];
+                double bestScore = -DBL_MAX;
+                for(int i = 0; i < NAdmitted; ++i){
+                    const int c = survivor[i];
+                    const double u = Settings::rootPUCTCoef * prior[c] * sqrtN / (1 + simulations(c));
+                    // 同点のときはランダムに選ぶ
+                    const double tmpScore = score(c).mean() + u + (pdice->rand() % (1U << 6)) * 1e-9;
+                    if(tmpScore > bestScore){
+                        bestScore = tmpScore;
+                        tryingIndex = c;
+                    }
+                }
+                return tryingIndex;
+            }
+            
+            template<class score_t, class simulations_t, class dice_t>
+            int selectUCB(const score_t& score, const simulations_t& simulations,
+                          double allSize, uint32_t minTrials, dice_t *const pdice)const{
+                int tryingIndex = -1;
+                if(NCandidates == 2){
+                    // 2つの時は同数(分布サイズ単位)に割り振る
+                    const double size0 = score(0).size(), size1 = score(1).size();
+                    if(size0 == size1)
+                        tryingIndex = pdice->rand() % 2;
+                    else
+                        tryingIndex = size0 < size1
+                        ? 0 : 1;
+                }else{
+                    // UCB-root アルゴリズム
+                    double bestScore = -DBL_MAX;
+                    for(int c = 0; c < NCandidates; ++c){
+                        double tmpScore;
+                        const BetaDistribution sc = score(c);
+                        const uint64_t sims = simulations(c);
+                        double size = sc.size();
+                        if(sims < minTrials){
+                            // 最低プレイアウト数をこなしていないものは、大きな値にする
+                            // ただし最低回数のもののうちどれかがランダムに選ばれるようにする
+                            tmpScore = (double)((1U << 16) - (sims << 8) + (pdice->rand() % (1U << 6)));
+                        }else{
+                            ASSERT(size, cerr << sc << endl;);
+                            tmpScore = sc.mean() + 0.7 * sqrt(sqrt(allSize) / size); // ucbr値
+                        }
+                        if(tmpScore > bestScore){
+                            bestScore = tmpScore;
+                            tryingIndex = c;
+                        }
+                    }
+                }
+                return tryingIndex;
+            }
+        };
+    }
+}
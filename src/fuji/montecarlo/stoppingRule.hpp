@@ -0,0 +1,114 @@
+/*
+ stoppingRule.hpp
+ Katsuki Ohto
+ */
+
+#pragma once
+
+#include "../../settings.h"
+
+// モンテカルロ探索の打ち切り判定
+// 各候補の推定平均値とその標準誤差から、今の時点で決定した場合の期待後悔
+// (真の最善候補との価値の差の期待値)を見積もり、
+// それが探索を続ける時間の価値 allowance を下回れば打ち切る
+// 推定平均値は互いに独立な正規分布に従うとみなす
+// ただし共通乱数で対の差の標準誤差 diffSem が得られている候補は、最善候補との差にそれを使う
+
+namespace UECda{
+    namespace Fuji{
+        
+        struct StoppingArm{
+            double mean; // 推定平均値
+            double sem; // 推定平均値の標準誤差
+            double diffSem; // 推定平均値最大の候補との対の差の標準誤差(無ければ負)
+        };
+        
+        class SampledRegretStoppingRule{
+            // 従来の判定
+            // 推定平均値の分布から全候補の価値を SAMPLES 回同時にサンプリングし、
+            // 候補ごとに後悔の平均を求める
+            // 1回の判定で SAMPLES * 候補数 回の正規乱数を使う
+        public:
+            static constexpr int SAMPLES = 1600;
+            
+            template<class dice_t>
+            bool judge(const StoppingArm *const arm, const int n, const double allowance, dice_t *const pdice)const{
+                const double line = -SAMPLES * allowance;
+                double reg[N_MAX_MOVES + 64];
+                for(int m = 0; m < n; ++m){
+                    reg[m] = 0.0;
+                }
+                for(int t = 0; t < SAMPLES; ++t){
+                    double tmpBest = -1.0;
+                    double tmpScore[N_MAX_MOVES + 64];
+                    for(int m = 0; m < n; ++m){
+                        NormalDistribution<double> norm(arm[m].mean, arm[m].sem);
+                        double tmpDBL = norm.rand(pdice);
+                        tmpScore[m] = tmpDBL;
+                        if(tmpDBL > tmpBest){
+                            tmpBest = tmpDBL;
+                        }
+                    }
+                    for(int m = 0; m < n; ++m){
+                        reg[m] += (tmpScore[m] - tmpBest);
+                    }
+                }
+                for(int m = 0; m < n; ++m){
+                    if(reg[m] > line){
+                        return true;
+                    }
+                }
+                return false;
+            }
+        };
+        
+        class AnalyticRegretStoppingRule{
+            // 閉形式による判定
+            // 推定平均値最大の候補 b を選んだときの後悔 max_j(X_j) - X_b は
+            // sum_{j != b} max(X_j - X_b, 0) で上から抑えられ、
+            // X_j - X_b ~ N(mu, sigma^2) の正の部分の期待値は mu * Phi(mu / sigma) + sigma * phi(mu / sigma)
+            // 従来の判定より少し慎重(打ち切りが遅め)になるが、乱数を使わず候補数に比例する時間で済む
+        public:
+            static double expectedPositivePart(const double mu, const double sigma){
+                // N(mu, sigma^2) の正の部分の期待値
+                if(sigma <= 0){
+                    return max(mu, 0.0);
+                }
+                const double z = mu / sigma;
+                const double cdf = 0.5 * std::erfc(-z / std::sqrt(2.0));
+                const double pdf = std::exp(-0.5 * z * z) / std::sqrt(2.0 * M_PI);
+                return mu * cdf + sigma * pdf;
+            }
+            
+            static double expectedRegret(const StoppingArm *const arm, const int n, const int b){
+                // 候補 b を選んだときの期待後悔の上界
+                double regret = 0.0;
+                for(int j = 0; j < n; ++j){
+                    if(j == b)continue;
+                    const double mu = arm[j].mean - arm[b].mean;
+                    const double sigma = (arm[j].diffSem >= 0) ? arm[j].diffSem
+                    : std::sqrt(arm[j].sem * arm[j].sem + arm[b].sem * arm[b].sem);
+                    regret += expectedPositivePart(mu, sigma);
+                }
+                return regret;
+            }
+            
+            template<class dice_t>
+            bool judge(const StoppingArm *const arm, const int n, const double allowance, dice_t *const pdice)const{
+                int best = 0;
+                for(int m = 1; m < n; ++m){
+                    if(arm[m].mean > arm[best].mean){
+                        best = m;
+                    }
+                }
+                return expectedRegret(arm, n, best) < allowance;
+            }
+        };
+        
+#ifdef SAMPLED_REGRET_STOPPING
+        using StoppingRule = SampledRegretStoppingRule;
+#else
+        using StoppingRule = AnalyticRegretStoppingRule;
+#endif
+    }
+}
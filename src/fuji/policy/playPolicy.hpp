@@ -256,6 +256,59 @@ for (int i = 0;;){os(base + i); ++i; if(i >= num)break; if(i % (x) == 0){ out <<
     struct PlayerPolicySubValue{
         // 方策計算を行うために予め計算しておく値(プレーヤーごと)
         double twoMeldsValue[2]; // 2役スコア(オーダー通常, 反転)
+        
+        // 手札のみで決まる値
+        // 手札が変わったときだけ計算し直す。cards が今の手札と違えば使えない
+        Cards cards;
+        double rankScore[2]; // 階級平均点(オーダー通常, 反転)
+        int8_t NParty; // 最小分割数
+        int8_t lowRank, highRank; // 最低、最高ランク
+        bool hasSeq; // 階段を作れるか(作れなければ着手後の手札でも作れないので、最小分割数は単純に数えられる)
+        
+        template<class move_t>
+        void set(const Hand& hand, move_t *const buf){
+            const Cards c = hand.getCards();
+            cards = c;
+            const int jk = containsJOKER(c) ? 1 : 0;
+            rankScore[ORDER_NORMAL] = calcRankScore(hand.pqr, jk, ORDER_NORMAL);
+            rankScore[ORDER_REVERSED] = calcRankScore(hand.pqr, jk, ORDER_REVERSED);
+            hasSeq = genAllSeq(buf, c) > 0;
+            NParty = hasSeq ? calcMinNMelds(buf, c) : countCards(CardsToER(c));
+            if(anyCards(c)){
+                lowRank = IntCardToRank(pickIntCardLow(c));
+                highRank = IntCardToRank(pickIntCardHigh(c));
+            }else{
+                lowRank = highRank = 0;
+            }
+        }
+        template<class move_t>
+        int calcAfterNParty(move_t *const buf, const Cards afterCards)const{
+            // 着手後の手札の最小分割数
+            return hasSeq ? calcMinNMelds(buf, afterCards) : countCards(CardsToER(afterCards));
+        }
+    };
+    
+    template<int PRECALC>
+    struct PlayerPolicySubValueAccessor{
+        // 事前計算なし : その場で計算
+        template<class field_t, class move_t>
+        static const PlayerPolicySubValue& get(const field_t& field, int p, move_t *const buf,
+                                               PlayerPolicySubValue *const ptmp){
+            ptmp->set(field.getHand(p), buf);
+            return *ptmp;
+        }
+    };
+    template<>
+    struct PlayerPolicySubValueAccessor<1>{
+        // 事前計算あり : 局面が持っている値が今の手札のものならそれを使う
+        template<class field_t, class move_t>
+        static const PlayerPolicySubValue& get(const field_t& field, int p, move_t *const buf,
+                                               PlayerPolicySubValue *const ptmp){
+            const PlayerPolicySubValue& sub = field.playerPolicyValue[p];
+            if(sub.cards == field.getCards(p))return sub;
+            ptmp->set(field.getHand(p), buf);
+            return *ptmp;
+        }
     };
     struct PolicySubValue{
         // 方策計算を行うために予め計算しておく値(全体)
@@ -271,7 +324,7 @@ for (int i = 0;;){os(base + i); ++i; if(i >= num)break; if(i % (x) == 0){ out <<
     template<
     int M = 1, // 0 通常系計算, 1 学習のため特徴ベクトル記録, 2 強化学習のためデータ保存
     int MODELING = 0, // 相手モデル化項追加
-    int PRECALC = 0, // 計算高速化のための事前計算を行っている
+    int PRECALC = 0, // 計算高速化のための事前計算を行っている(局面の playerPolicyValue を使う)
     class move_t, class field_t, class policy_t>
     int calcPlayPolicyScoreSlow(double *const dst,
                                 move_t *const buf,
@@ -296,15 +349,19 @@ for (int i = 0;;){os(base + i); ++i; if(i >= num)break; if(i % (x) == 0){ out <<
         const uint32_t oq = myHand.qty;
         const Cards curPqr = myHand.pqr;
         const FieldAddInfo& fieldInfo = field.fieldInfo;
-        const int NParty = calcMinNMelds(buf + NMoves, myCards);
+        
+        // 手札のみで決まる値
+        PlayerPolicySubValue tmpSub;
+        const PlayerPolicySubValue& sub = PlayerPolicySubValueAccessor<PRECALC>::get(field, tp, buf + NMoves, &tmpSub);
+        const int NParty = sub.NParty;
         
         // 元々の手札の最低、最高ランク
-        const int myLR = IntCardToRank(pickIntCardLow(myCards));
-        const int myHR = IntCardToRank(pickIntCardHigh(myCards));
+        const int myLR = sub.lowRank;
+        const int myHR = sub.highRank;
         
         const int order = bd.tmpOrder();
         
-        const double nowRS = calcRankScore(curPqr, containsJOKER(myCards) ? 1 : 0, bd.tmpOrder());
+        const double nowRS = sub.rankScore[bd.tmpOrder()];
         
         // 場役主から自分が何人目か数える
         int distanceToOwner = 0;
@@ -525,12 +582,14 @@ for (int i = 0;;){os(base + i); ++i; if(i >= num)break; if(i % (x) == 0){ out <<
                      Foo(i);
                      }*/
                     const int base = FEA_IDX(POL_HAND_NF_PARTY);
+                    const int afterNParty = PRECALC ? sub.calcAfterNParty(buf + NMoves, afterCards)
+                    : calcMinNMelds(buf + NMoves, afterCards);
                     if(bd.isNF()){
                         i = base;
-                        FooX(i, calcMinNMelds(buf + NMoves, afterCards) - NParty);
+                        FooX(i, afterNParty - NParty);
                     }else{
                         i = base + 1;
-                        FooX(i, calcMinNMelds(buf + NMoves, afterCards) - NParty);
+                        FooX(i, afterNParty - NParty);
                     }
                 }
                 FASSERT(s,);
@@ -1085,6 +1144,17 @@ for (int i = 0;;){os(base + i); ++i; if(i >= num)break; if(i % (x) == 0){ out <<
                                 ){
         return calcPlayPolicyScoreSlow<M>(dst, field.mv, field.NActiveMoves, field, pol);
     }
+    template<int M = 1, class field_t, class policy_t>
+    int calcPlayPolicyScoreFast(
+                                double *const dst,
+                                const field_t& field,
+                                const policy_t& pol
+                                ){
+        // シミュレーション用
+        // 局面が持っている手札ごとの事前計算値(calcPolicySubValue, procPolicySubValue で更新)を使う
+        // 結果は calcPlayPolicyScoreSlow と完全に一致する
+        return calcPlayPolicyScoreSlow<M, 0, 1>(dst, field.mv, field.NActiveMoves, field, pol);
+    }
     template<int M = 1, class move_t, class field_t, class policy_t>
     double calcPlayPolicyExpScoreSlow(double *const dst,
                                       move_t *const buf,
@@ -39,8 +39,44 @@ namespace UECda{
             // L2関連
             
             //#ifdef USE_L2BOOK
-            constexpr int BOOK_SIZE = (1 << 18);
-            TwoValueBook<BOOK_SIZE> book("L2Book");
+            constexpr int BOOK_SIZE = L2_BOOK_SIZE; // 既定の大きさ
+            
+            class Book{
+                // 結果(2ビット)とハッシュ値の残りのビットを1語に詰めて登録する置換表
+                // 大きさは起動時に決める(2の累乗に切り上げる)
+                // 複数スレッドから読み書きされるが、1語単位で読み書きするので壊れた結果は読まない
+            public:
+                void resize(uint64_t size){
+                    uint64_t n = 4;
+                    while(n < size)n <<= 1;
+                    mask = n - 1;
+                    table.reset(new std::atomic<uint64_t>[n]);
+                    clear();
+                }
+                void clear(){
+                    for(uint64_t i = 0; i <= mask; ++i)table[i].store(0, std::memory_order_relaxed);
+                }
+                uint64_t size()const noexcept{ return mask + 1; }
+                
+                int read(uint64_t hash)const{
+                    // 登録されていなければ -1
+                    const uint64_t e = table[hash & mask].load(std::memory_order_relaxed);
+                    if((e & ~3ULL) != (hash & ~3ULL))return -1;
+                    return (int)(e & 3ULL) - 1;
+                }
+                void regist(int value, uint64_t hash){
+                    assert(0 <= value && value < 3);
+                    table[hash & mask].store((hash & ~3ULL) | (uint64_t)(value + 1), std::memory_order_relaxed);
+                }
+                
+                Book(uint64_t size){ resize(size); }
+                
+            private:
+                uint64_t mask;
+                std::unique_ptr<std::atomic<uint64_t>[]> table;
+            };
+            
+            Book book(BOOK_SIZE);
             //#endif
         }
         
@@ -312,6 +348,9 @@ namespace UECda{
             
             ~L2Judge(){}
             
+            int getNodes()const noexcept{ return nodes; }
+            bool isFailed()const noexcept{ return failed != 0; }
+            
             // IS_NF 空場
             // DOM_PROC 支配進行
             
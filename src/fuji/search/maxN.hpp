@@ -16,10 +16,8 @@ namespace UECda{
         void iterateAllHandPatternsSub(int p, Cards dst[],
                                        const Cards c, const int nsum, int n[],
                                        const callback_t& callback){
+            // c の nsum 枚を、プレーヤー p 以降に n[p] 枚ずつ配る全ての組み合わせ
             if(p == N_PLAYERS){
-                for(int p = 0; p < N_PLAYERS; ++p){
-                    cerr << OutCards(dst[p]) << BitSet64(dst[p]) << endl;
-                }
                 callback(dst);
             }else{
                 if(n[p] > 0){
@@ -32,9 +30,13 @@ namespace UECda{
                         dst[p] = dealt;
                         iterateAllHandPatternsSub(p + 1, dst, subtrCards(c, dealt),
                                                   nextNsum, n, callback);
-                        
+                        // 立っているビット数が同じ次の数に進める
+                        const uint64_t lowest = x & -x;
+                        const uint64_t carried = x + lowest;
+                        x = carried | (((x ^ carried) >> 2) / lowest);
                     }
                     n[p] = nsum - nextNsum;
+                    dst[p] = CARDS_NULL;
                 }else{
                     iterateAllHandPatternsSub(p + 1, dst, c, nsum, n, callback);
                 }
@@ -50,6 +52,18 @@ namespace UECda{
             iterateAllHandPatternsSub(0, dst, c, nsum, n, callback);
         }
         
+        inline double countHandPatterns(const int nsum, const int n[]){
+            // iterateAllHandPatterns が列挙する組み合わせの数(多項係数)
+            double patterns = 1;
+            int rest = nsum;
+            for(int p = 0; p < N_PLAYERS; ++p){
+                if(n[p] <= 0)continue;
+                patterns *= dCombination(rest, n[p]);
+                rest -= n[p];
+            }
+            return patterns;
+        }
+        
         struct MaxNResult : public BitArray64<8, 8>{
             using base_t = BitArray64<8, 8>;
             ComparableBitSet64 operator [](int p)const noexcept{
@@ -62,8 +76,6 @@ namespace UECda{
                         MoveInfo *const pbuffer){
             const int turnPlayer = field.getTurnPlayer();
             const int moves = genLegal(pbuffer, field.hand[turnPlayer], field.getBoard());
-            cerr << field.toDebugString();
-            cerr << "moves = " << moves << endl;
             ASSERT(moves > 0,);
             if(moves <= 1){
                 int next = field.procSlowest(pbuffer[0]);
@@ -95,14 +107,12 @@ namespace UECda{
                             continue; // 千日手回避
                         }
                         PlayouterField tfield = field;
-                        cerr << tfield.toDebugString();
                         for(int p = 0; p < N_PLAYERS; ++p){
                             if(anyCards(c[p])){
                                 tfield.setHand(p, c[p]);
                                 tfield.setOpsHand(p, subtrCards(field.getRemCards(), c[p]));
                             }
                         }
-                        cerr << tfield.toDebugString();
                         int next = tfield.procSlowest(pbuffer[i]);
                         if(next < 0){ // 試合終了
                             for(int p = 0; p < N_PLAYERS; ++p){
@@ -21,6 +21,10 @@
 #include <cassert>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <atomic>
 #include <array>
 #include <vector>
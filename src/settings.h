@@ -41,10 +41,23 @@
 #define THINKING_LEVEL (9)
 
 // 並列化
-// スレッド数(ビルド時決定)
+// スレッド数(既定値。起動時にオプションで変更可能)
 // 0以下を設定すると勝手に1になります
 #define N_THREADS (8)
 
+// モンテカルロ中に世界作成を専用に行うスレッド数(全スレッド数より少ないときのみ使う)
+#define N_DEALER_THREADS (1)
+
+// 探索に使うメモリの大きさ(既定値。起動時にオプションで変更可能)
+#define N_WORLDS (128) // 世界プールの大きさ
+#define N_PARTICLES (256) // 相手手札推定の粒子数(DealType::PARTICLE のとき)
+#define THREAD_BUFFER_LENGTH (8192) // スレッドごとの着手生成バッファの長さ
+#define L2_BOOK_SIZE (1 << 18) // ラスト2人置換表の大きさ
+#define PLAYOUT_BATCH_SIZE (8) // まとめて進めるプレイアウトの数(batchPlayout オンのとき)
+#define LEAF_L2_NODE_LIMIT (65536) // プレイアウト末端のラスト2人探索のノード上限(固定時)
+#define PLAYOUT_OUTCOME_CACHE_SIZE (1 << 16) // スレッドごとのプレイアウト結果置換表の大きさ(playoutOutcomeCache オンのとき)
+#define PLAY_LIKELIHOOD_CACHE_SIZE (1 << 14) // スレッドごとの棋譜尤度の項の置換表の大きさ(playLikelihoodCache オンのとき)
+
 // 末端報酬を階級リセットから何試合前まで計算するか
 constexpr int N_REWARD_CALCULATED_GAMES = 32;
 
@@ -80,6 +93,12 @@ constexpr int N_REWARD_CALCULATED_GAMES = 32;
 // ルートでの方策関数利用設定
 #define USE_POLICY_TO_ROOT
 
+// ルートのモンテカルロ統計をスレッドごとに貯め、数回ごとにまとめて反映する(ロック競合の削減)
+#define THREAD_LOCAL_ROOT_STATISTICS
+
+// モンテカルロの打ち切り判定に従来のサンプリングによる後悔の推定を使う(オフなら閉形式の上界)
+//#define SAMPLED_REGRET_STOPPING
+
 // 自分以外で通算順位の最高のプレーヤーの結果も考慮
 //#define DEFEAT_RIVAL_MC // MCにて
 #define DEFEAT_RIVAL_MATE // 必勝着手がある場合
@@ -116,9 +135,19 @@ enum DealType{
     SBJINFO,
     BIAS,
     REJECTION,
+    PARTICLE,
+};
+
+// ルートでのプレイアウトの割り振り方
+enum RootAllocatorType{
+    UCB_ROOT,
+    SEQUENTIAL_HALVING,
+    SUCCESSIVE_REJECTS,
+    PROGRESSIVE_WIDENING,
 };
 
 constexpr Selector SIMULATION_SELECTOR = Selector::POLY_BIASED;
+constexpr RootAllocatorType ROOT_ALLOCATOR = RootAllocatorType::UCB_ROOT;
 constexpr DealType MONTECARLO_DEAL_TYPE = DealType::REJECTION;
 
 // プレーヤー人数
@@ -247,6 +276,13 @@ constexpr DealType MONTECARLO_DEAL_TYPE = DealType::REJECTION;
 #define MULTI_THREADING
 #endif
 
+// シングルスレッドやライバル考慮MCではスレッド別統計は使わない
+#if !defined(MULTI_THREADING) || defined(DEFEAT_RIVAL_MC)
+#ifdef THREAD_LOCAL_ROOT_STATISTICS
+#undef THREAD_LOCAL_ROOT_STATISTICS
+#endif
+#endif
+
 #define N_PLAY_THREADS (N_THREADS)
 #define N_CHANGE_THREADS std::max(1, (N_THREADS) / 2)
 
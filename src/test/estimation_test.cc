@@ -6,16 +6,20 @@
 // オンラインでの相手手札推定のテスト
 
 #include "../include.h"
+#include "../fuji/fuji.h"
+#include "../fuji/fujiStructure.hpp"
 #include "../structure/log/minLog.hpp"
 #include "../generator/changeGenerator.hpp"
 #include "../generator/moveGenerator.hpp"
 #include "../fuji/montecarlo/playout.h"
 #include "../fuji/policy/changePolicy.hpp"
 #include "../fuji/policy/playPolicy.hpp"
+#include "../fuji/estimation/dealer.hpp"
 
 #include "../fuji/model/playerModel.hpp"
 #include "../fuji/model/playerBias.hpp"
 
+#if 0 // 作成中(推定手法ごとの一致率の比較)
 struct ThreadTools{
     MoveInfo buffer[8192];
     XorShift64 dice;
@@ -36,6 +40,7 @@ struct SubjectivePlayouterField : public PlayouterField{
     SubjectivePlayouterField(const PlayouterField& objField, consy int ap):
     PlayouterField(objField), myPlayerNum(ap){}
 };
+#endif
 
 std::string DIRECTORY_PARAMS_IN(""), DIRECTORY_PARAMS_OUT(""), DIRECTORY_LOGS("");
 
@@ -43,6 +48,175 @@ using namespace UECda;
 using namespace UECda::Fuji;
 
 Clock cl;
+
+SharedData shared;
+ThreadTools threadTools[2]; // 1番は棋譜尤度の項の置換表を使う
+
+template<class gameLog_t>
+int selectObserver(const gameLog_t& gLog){
+    // 推定を行うプレーヤー
+    // 交換で渡したカードは棋譜から主観情報として作らないので、交換に関わらないプレーヤーにする
+    if(gLog.isInitGame())return 0;
+    for(int p = 0; p < N_PLAYERS; ++p){
+        if(gLog.infoClass().at(p) == MIDDLE)return p;
+    }
+    return -1;
+}
+
+template<class gameLog_t>
+void setSubjectiveGameLog(const gameLog_t& gLog, int myPlayerNum, int turns,
+                          SharedData *const pshared){
+    // 客観的な棋譜から、myPlayerNum から見た turns 手目までの試合記録を作る
+    auto& sLog = pshared->gameLog;
+    sLog.init();
+    if(gLog.isInitGame())sLog.setInitGame();
+    for(int p = 0; p < N_PLAYERS; ++p){
+        sLog.setPlayerClass(p, gLog.infoClass().at(p));
+        sLog.setPlayerSeat(p, gLog.infoSeat().at(p));
+        sLog.setNOrgCards(p, countCards(gLog.orgCards(p)));
+    }
+    sLog.setDealtCards(myPlayerNum, gLog.dealtCards(myPlayerNum));
+    sLog.setOrgCards(myPlayerNum, gLog.orgCards(myPlayerNum));
+    for(int t = 0; t < turns; ++t){
+        const auto& play = gLog.play(t);
+        sLog.push_play(MinClientPlayLog(play.move(), play.time(), play.time()));
+    }
+}
+
+bool isConsistentParticle(const ParticleFilter::Particle& pt,
+                          const PlayouterField& field, int myPlayerNum){
+    // 粒子の手札が公開情報と矛盾しないか
+    if(!pt.alive)return false;
+    if(pt.field.getTurnPlayer() != field.getTurnPlayer())return false;
+    if(pt.field.getCards(myPlayerNum) != field.getCards(myPlayerNum))return false;
+    Cards sum = CARDS_NULL;
+    for(int p = 0; p < N_PLAYERS; ++p){
+        const Cards c = pt.field.getCards(p);
+        if(countCards(c) != field.getNCards(p))return false;
+        if(anyCards(andCards(sum, c)))return false;
+        addCards(&sum, c);
+    }
+    return sum == field.getRemCards();
+}
+
+template<class logs_t>
+int testParticleFilter(const logs_t& mLog){
+    // 粒子フィルタを自分の手番ごとに更新し、
+    // 選ばれる粒子が全て生きていて、公開情報と矛盾しない手札を持つか確認する
+    constexpr int NParticles = 256;
+    constexpr int NSamples = 1024;
+    uint64_t decisions = 0, errors = 0;
+    ParticleFilter particles;
+    particles.init(NParticles);
+    ParticleFilterStatistics stats;
+    ThreadTools *const ptools = &threadTools[0];
+    
+    for(int g = 0; g < mLog.games(); ++g){
+        const auto& gLog = mLog.game(g);
+        const int myPlayerNum = selectObserver(gLog);
+        if(myPlayerNum < 0)continue;
+        shared.setMyPlayerNum(myPlayerNum);
+        particles.clear();
+        int turn = 0;
+        PlayouterField field;
+        iterateGameLogAfterChange
+        (field, gLog,
+         [](const auto& field)->void{}, // first callback
+         [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+             if((int)field.getTurnPlayer() == myPlayerNum){
+                 setSubjectiveGameLog(gLog, myPlayerNum, turn, &shared);
+                 RandomDealer<N_PLAYERS> dealer;
+                 dealer.set(field, shared);
+                 
+                 // FujiGokoro::updateParticles と同じ手順を1スレッドで行う
+                 const bool redeal = !particles.ready();
+                 const int fromTurn = redeal ? 0 : particles.getProcessedTurn();
+                 if(redeal)particles.dealThread(0, 1, dealer, shared, ptools);
+                 particles.advanceThread(0, 1, fromTurn, dealer, shared, ptools, &stats);
+                 if(particles.resample(&ptools->dice)){
+                     particles.rejuvenateThread(0, 1, dealer, shared, ptools, &stats);
+                 }
+                 particles.finish(turn);
+                 stats.decisions += 1;
+                 decisions += 1;
+                 
+                 if(particles.ready()){
+                     for(int i = 0; i < NSamples; ++i){
+                         const auto& pt = particles.sample(&ptools->dice);
+                         if(!isConsistentParticle(pt, field, myPlayerNum)){
+                             errors += 1;
+                             cerr << "inconsistent particle (alive " << pt.alive << ")" << endl;
+                             cerr << field.toString();
+                             break;
+                         }
+                     }
+                 }
+             }
+             turn += 1;
+             return 0;
+         },
+         [](const auto& field)->void{}); // last callback
+    }
+    cerr << stats.toString() << endl;
+    cerr << errors << " errors in " << decisions << " decisions." << endl;
+    return errors > 0 ? -1 : 0;
+}
+
+template<class logs_t>
+int testPlayLikelihoodCache(const logs_t& mLog){
+    // 棋譜尤度の項の置換表を使った計算が、使わない計算と一致するか確認
+    // 棋譜の各局面で主観情報から手札をランダムに配り、両方で棋譜の尤度を計算する
+    // 置換表は試合中ずっと使い回すので、前の手番までに登録された項も確かめられる
+    constexpr int NDeals = 16;
+    uint64_t trials = 0, errors = 0;
+    uint64_t time[2] = {0};
+    
+    for(int g = 0; g < mLog.games(); ++g){
+        const auto& gLog = mLog.game(g);
+        const int myPlayerNum = selectObserver(gLog);
+        if(myPlayerNum < 0)continue;
+        shared.setMyPlayerNum(myPlayerNum);
+        threadTools[1].likelihoodCache.clear(); // 棋譜が変わるので項は使えない
+        int turn = 0;
+        PlayouterField field;
+        iterateGameLogAfterChange
+        (field, gLog,
+         [](const auto& field)->void{}, // first callback
+         [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+             setSubjectiveGameLog(gLog, myPlayerNum, turn, &shared);
+             RandomDealer<N_PLAYERS> dealer;
+             dealer.set(field, shared);
+             for(int i = 0; i < NDeals; ++i){
+                 Cards c[N_PLAYERS];
+                 dealer.dealWithAbsSbjInfo(c, &threadTools[0].dice);
+                 Clock clock;
+                 clock.start();
+                 const double lhs = dealer.calcPlayLikelihood(c, shared, &threadTools[0]);
+                 time[0] += clock.restart();
+                 const double cachedLhs = dealer.calcPlayLikelihood(c, shared, &threadTools[1]);
+                 time[1] += clock.stop();
+                 
+                 // 置換表には項の差分を入れるので、足し合わせの丸め誤差の分だけずれうる
+                 if(fabs(lhs - cachedLhs) > 1e-9 * max(1.0, fabs(lhs))){
+                     errors += 1;
+                     cerr << "turn " << turn << " likelihood " << lhs << " <-> cached " << cachedLhs << endl;
+                     for(int p = 0; p < N_PLAYERS; ++p)cerr << OutCards(c[p]) << endl;
+                 }
+                 trials += 1;
+             }
+             turn += 1;
+             return 0;
+         },
+         [](const auto& field)->void{}); // last callback
+    }
+    cerr << threadTools[1].likelihoodCache.statistics().toString() << endl;
+    cerr << errors << " errors in " << trials << " trials." << endl;
+    cerr << "no cache " << time[0] / (double)max(trials, (uint64_t)1) << " clock";
+    cerr << " cache " << time[1] / (double)max(trials, (uint64_t)1) << " clock" << endl;
+    return errors > 0 ? -1 : 0;
+}
+
+#if 0 // 作成中(推定手法ごとの一致率の比較と相手モデリングの実験)
 ThreadTools threadTools;
 PlayerModelSpace playerModelSpace;
 
@@ -213,6 +387,7 @@ int testEstimationWithModeling(const logs_t& mLog){
     }
     return 0;
 }
+#endif
 
 int main(int argc, char* argv[]){
     
@@ -224,19 +399,43 @@ int main(int argc, char* argv[]){
     }
     std::vector<std::string> logFileNames;
     
-    threadTools.dice.srand((unsigned int)time(NULL));
-    
     for(int c = 1; c < argc; ++c){
         if(!strcmp(argv[c], "-i")){ // input directory
             DIRECTORY_PARAMS_IN = std::string(argv[c + 1]);
         }else if(!strcmp(argv[c], "-l")){ // log path
             logFileNames.push_back(std::string(argv[c + 1]));
+        }else if(!strcmp(argv[c], "-ld")){ // log directory path
+            std::vector<std::string> tmpLogFileNames = getFilePathVectorRecursively(std::string(argv[c + 1]), ".dat");
+            logFileNames.insert(logFileNames.end(), tmpLogFileNames.begin(), tmpLogFileNames.end());
         }
     }
     
+    // 推定に使うデータを準備
+    shared.initMatch();
+    shared.estimationPlayPolicy.fin(DIRECTORY_PARAMS_IN + "play_policy_param.dat");
+    shared.estimationPlayPolicy.setTemperature(Settings::simulationTemperaturePlay);
+    XorShift64 tdice;
+    tdice.srand((unsigned int)time(NULL));
+    for(int th = 0; th < 2; ++th){
+        threadTools[th].init(th);
+        threadTools[th].dice.srand(tdice.rand() * (th + 111));
+    }
+    threadTools[1].likelihoodCache.init(PLAY_LIKELIHOOD_CACHE_SIZE);
+    
     for(const std::string& log : logFileNames){
-        MinMatchLog<MinGameLog<MinPlayLog<N_PLAYERS>>> mLog(log);
-        testPlayPolicyModeling(mLog);
+        MinMatchLog<MinGameLog<MinPlayLog>> mLog(log);
+        
+        if(testParticleFilter(mLog)){
+            cerr << "failed particle filter test." << endl;
+            return -1;
+        }
+        cerr << "passed particle filter test." << endl;
+        
+        if(testPlayLikelihoodCache(mLog)){
+            cerr << "failed play likelihood cache test." << endl;
+            return -1;
+        }
+        cerr << "passed play likelihood cache test." << endl;
     }
     
     return 0;
@@ -14,6 +14,7 @@
 using namespace UECda;
 
 MoveInfo buffer[8192];
+MoveInfo bulkBuffer[8192];
 MoveGenerator<MoveInfo, Cards> mgCards;
 MoveGenerator<MoveInfo, Hand> mgHand;
 Clock cl;
@@ -336,6 +337,83 @@ int testRecordMoveMate(const logs_t& mLogs){
     return 0;
 }
 
+template<class logs_t>
+int testPlayoutMateFilter(const logs_t& mLogs){
+    // プレイアウト用の必勝判定(手札単位の前処理とまとめての判定)が
+    // 着手ごとの判定と同じ結果(必勝の数と支配フラグ)になるかのテストと、前処理の的中率と時間の計測
+    uint64_t turns = 0, filtered = 0, mates = 0;
+    uint64_t loopTime = 0, filterTime = 0;
+    int failures = 0;
+    PlayouterField field;
+    
+    iterateGameLogAfterChange<PlayouterField>
+    (field, mLogs,
+     [&](const auto& field){}, // first callback
+     [&](const auto& field, const auto move, const uint64_t time)->int{ // play callback
+         int turnPlayer = field.getTurnPlayer();
+         const Hand& myHand = field.getHand(turnPlayer);
+         const Hand& opsHand = field.getOpsHand(turnPlayer);
+         Board bd = field.getBoard();
+         
+         const int moves = mgHand.genMove(buffer, myHand, bd);
+         if(moves <= 1){ return 0; }
+         turns += 1;
+         std::copy(buffer, buffer + moves, bulkBuffer);
+         
+         // 着手ごとの判定
+         cl.start();
+         int loopMates = 0;
+         for(int m = 0; m < moves; ++m){
+             if(checkHandMate(0, buffer + moves, buffer[m], myHand, opsHand, bd, field.fieldInfo)){
+                 loopMates += 1;
+             }
+         }
+         loopTime += cl.stop();
+         
+         // 前処理とまとめての判定
+         cl.start();
+         int bulkMates = 0;
+         const bool noMate = judgeNoMate_Easy(myHand, opsHand, bd, field.fieldInfo);
+         if(!noMate){
+             int mateIndex[N_MAX_MOVES];
+             bulkMates = checkHandMateAll(0, bulkBuffer, moves, mateIndex, myHand, opsHand, bd, field.fieldInfo);
+         }else{
+             setDominanceFlags(bulkBuffer, moves, myHand, opsHand, bd, field.fieldInfo);
+         }
+         filterTime += cl.stop();
+         
+         // 支配フラグの比較
+         for(int m = 0; m < moves; ++m){
+             if(!buffer[m].isDO() != !bulkBuffer[m].isDO()){
+                 cerr << "dominance flag of " << buffer[m] << " : loop " << bool(buffer[m].isDO());
+                 cerr << " <-> filter " << bool(bulkBuffer[m].isDO()) << " (no mate " << noMate << ")" << endl;
+                 cerr << bd << " " << field.fieldInfo << endl;
+                 failures += 1;
+                 break;
+             }
+         }
+         
+         if(noMate)filtered += 1;
+         if(loopMates > 0)mates += 1;
+         if(noMate ? (loopMates != 0) : (bulkMates != loopMates)){
+             cerr << "mate filter " << bulkMates << " (no mate " << noMate << ")";
+             cerr << " <-> loop " << loopMates << endl;
+             cerr << bd << " " << field.fieldInfo << endl;
+             cerr << Out2CardTables(myHand.getCards(), opsHand.getCards()) << endl;
+             failures += 1;
+         }
+         return 0;
+     },
+     [&](const auto& field){} // last callback
+     );
+    
+    const double n = max(turns, (uint64_t)1);
+    cerr << "playout mate filter : turns " << turns << " filtered " << filtered / n << " mate " << mates / n << endl;
+    cerr << "check time (loop)   = " << loopTime / n << endl;
+    cerr << "check time (filter) = " << filterTime / n << endl;
+    return failures;
+}
+
 template<class logs_t>
 int analyzeMateDistribution(const logs_t& mLogs){
     
@@ -390,6 +468,12 @@ int main(int argc, char* argv[]){
     }
     cerr << "passed record move mate judge test." << endl;
     
+    if(testPlayoutMateFilter(mLogs)){
+        cerr << "failed playout mate filter test." << endl;
+        return -1;
+    }
+    cerr << "passed playout mate filter test." << endl;
+    
     analyzeMateDistribution(mLogs);
     cerr << "finished analyzing mate moves distribution." << endl;
     
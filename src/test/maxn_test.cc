@@ -19,6 +19,38 @@ Clock cl;
 std::mt19937 mt;
 XorShift64 dice;
 
+int testHandPatterns(){
+    // 全ての手札組み合わせの列挙が、重複なく多項係数の数だけ行われるか確認する
+    const Cards c = StringToCards("c3 d5 h7 s9 ct cj dq hk");
+    int n[N_PLAYERS] = {0};
+    n[1] = 3; n[2] = 2; n[4] = 3;
+    const int nsum = countCards(c);
+    
+    std::set<std::array<Cards, N_PLAYERS>> patterns;
+    bool valid = true;
+    iterateAllHandPatterns(c, nsum, n, [&](const Cards *const dst)->void{
+        std::array<Cards, N_PLAYERS> pattern;
+        Cards all = CARDS_NULL;
+        for(int p = 0; p < N_PLAYERS; ++p){
+            pattern[p] = dst[p];
+            if((int)countCards(dst[p]) != n[p])valid = false;
+            if(anyCards(andCards(all, dst[p])))valid = false;
+            all = addCards(all, dst[p]);
+        }
+        if(all != c)valid = false;
+        patterns.insert(pattern);
+    });
+    const double expected = countHandPatterns(nsum, n);
+    cerr << "hand patterns : " << patterns.size() << " (expected " << expected << ")" << endl;
+    if(!valid){
+        cerr << "invalid hand pattern." << endl; return -1;
+    }
+    if((double)patterns.size() != expected){
+        cerr << "wrong number of hand patterns." << endl; return -1;
+    }
+    return 0;
+}
+
 int outputMateJudgeResult(){
     // 気になるケースやコーナーケース、代表的なケースでの支配性判定の結果を出力する
     
@@ -80,6 +112,11 @@ int main(int argc, char* argv[]){
     mt.seed(1);
     dice.srand((unsigned int)time(NULL));
     
+    if(testHandPatterns()){
+        cerr << "failed hand pattern test." << endl; return -1;
+    }
+    cerr << "passed hand pattern test." << endl;
+    
     if(outputMateJudgeResult()){
         cerr << "failed case test." << endl; return -1;
     }
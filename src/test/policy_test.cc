@@ -153,6 +153,64 @@ int testPlayPolicyWithRecord(const logs_t& mLog){
     return 0;
 }
 
+template<class logs_t>
+int testPlayPolicyPrecalc(const logs_t& mLog){
+    // シミュレーション用の方策計算(手札ごとの値を局面に持って使い回す)が
+    // その場で全て計算する方策計算と完全に一致するか確認
+    // 棋譜の各局面から方策に従って最後まで進め、全ての手番で比較する
+    uint64_t trials = 0, errors = 0;
+    uint64_t time[2] = {0};
+    
+    cerr << "play policy precalc : " << endl;
+    
+    PlayouterField field;
+    iterateGameLogAfterChange
+    (field, mLog,
+     [](const auto& field)->void{}, // first callback
+     [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+         MoveInfo buffer[8192];
+         PlayouterField tfield = field;
+         tfield.mv = buffer;
+         tfield.clearPolicySubValue();
+         while(1){
+             const int tp = tfield.getTurnPlayer();
+             tfield.prepareForPlay();
+             const int moves = genMove(buffer, tfield.hand[tp].cards, tfield.bd);
+             tfield.NMoves = tfield.NActiveMoves = moves;
+             int index = 0;
+             if(moves > 1){
+                 double slowScore[N_MAX_MOVES + 1], fastScore[N_MAX_MOVES + 1];
+                 Clock clock;
+                 clock.start();
+                 calcPlayPolicyScoreSlow<0>(slowScore, buffer, moves, tfield, playPolicy);
+                 time[0] += clock.restart();
+                 tfield.updatePlayerPolicySubValue(tp, buffer + moves);
+                 calcPlayPolicyScoreFast<0>(fastScore, tfield, playPolicy);
+                 time[1] += clock.stop();
+                 
+                 // 計算順序まで同じなので、ビット単位で一致するはず
+                 if(memcmp(slowScore, fastScore, sizeof(double) * moves)){
+                     errors += 1;
+                     cerr << tfield.toString();
+                     for(int m = 0; m < moves; ++m){
+                         cerr << buffer[m] << " " << slowScore[m] << " " << fastScore[m] << endl;
+                     }
+                 }
+                 trials += 1;
+                 index = selectBySoftmax(slowScore, moves, 1.0, &dice);
+             }
+             if(tfield.proc(tp, buffer[index]) == -1)break;
+         }
+         return 0;
+     },
+     [](const auto& field)->void{}); // last callback
+    
+    cerr << errors << " errors in " << trials << " trials." << endl;
+    cerr << "slow " << time[0] / (double)max(trials, (uint64_t)1) << " clock";
+    cerr << " precalc " << time[1] / (double)max(trials, (uint64_t)1) << " clock" << endl;
+    return errors > 0 ? -1 : 0;
+}
+
 template<class logs_t>
 int testSelector(const logs_t& mLog){
     // 方策の最終段階の実験
@@ -346,6 +404,10 @@ int main(int argc, char* argv[]){
         
         testChangePolicyWithRecord(mLog);
         testPlayPolicyWithRecord(mLog);
+        if(testPlayPolicyPrecalc(mLog)){
+            cerr << "failed play policy precalc test." << endl;
+            return -1;
+        }
         testSelector(mLog);
     }
     
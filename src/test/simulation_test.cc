@@ -5,6 +5,13 @@
 
 // シミュレーションの性能諸々チェック
 
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
 #include "../include.h"
 #include "../fuji/fuji.h"
 //#include "../fuji/fujiStructure.hpp"
@@ -15,6 +22,8 @@
 #include "../fuji/montecarlo/playout.h"
 #include "../fuji/policy/changePolicy.hpp"
 #include "../fuji/policy/playPolicy.hpp"
+#include "../fuji/eval/staticEval.hpp"
+#include "../fuji/search/l2Judge.hpp"
 
 #include "../fuji/model/playerModel.hpp"
 #include "../fuji/model/playerBias.hpp"
@@ -24,6 +33,7 @@ struct ThreadTools{
     XorShift64 dice;
 };
 
+#if 0 // 作成中(推定手法ごとのシミュレーションの比較と相手モデリングの実験)
 struct SubjectivePlayouterField : public PlayouterField{
     // シミュレーション用局面情報の主観化
     int myPlayerNum;
@@ -39,6 +49,7 @@ struct SubjectivePlayouterField : public PlayouterField{
     SubjectivePlayouterField(const PlayouterField& objField, consy int ap):
     PlayouterField(objField), myPlayerNum(ap){}
 };
+#endif
 
 std::string DIRECTORY_PARAMS_IN(""), DIRECTORY_PARAMS_OUT(""), DIRECTORY_LOGS("");
 
@@ -47,6 +58,7 @@ using namespace UECda::Fuji;
 
 Clock cl;
 ThreadTools threadTools;
+#if 0 // 作成中(推定手法ごとのシミュレーションの比較と相手モデリングの実験)
 PlayerModelSpace playerModelSpace;
 
 int testSimulations(const logs_t& mLog){
@@ -207,6 +219,475 @@ int testEstimationWithModeling(const logs_t& mLog){
     }
     return 0;
 }
+#endif
+
+template<int PRECALC>
+void policyPlayout(PlayouterField *const pfield, const PlayPolicy<policy_value_t>& pol){
+    // 方策に従って最後まで進める
+    // PRECALC ならシミュレーション用の方策計算(手札ごとの値を使い回す)を使う
+    MoveInfo *const buffer = threadTools.buffer;
+    pfield->mv = buffer;
+    pfield->clearPolicySubValue();
+    while(1){
+        const int tp = pfield->getTurnPlayer();
+        pfield->prepareForPlay();
+        const int moves = genMove(buffer, pfield->hand[tp].cards, pfield->bd);
+        pfield->NMoves = pfield->NActiveMoves = moves;
+        int index = 0;
+        if(moves > 1){
+            double score[N_MAX_MOVES + 1];
+            if(PRECALC){
+                pfield->updatePlayerPolicySubValue(tp, buffer + moves);
+                calcPlayPolicyScoreFast<0>(score, *pfield, pol);
+            }else{
+                calcPlayPolicyScoreSlow<0>(score, buffer, moves, *pfield, pol);
+            }
+            index = selectBySoftmax(score, moves, 1.0, &threadTools.dice);
+        }
+        if(pfield->proc(tp, buffer[index]) == -1)break;
+    }
+}
+
+template<class logs_t>
+int testTruncatedPlayoutSpeed(const logs_t& mLog){
+    // 打ち切りプレイアウト(規定手数後の最初の空場で順位予測から上がり順を選ぶ)と
+    // 最後まで進めるプレイアウトの速度比較
+    constexpr int PLAYOUTS = 10;
+    PlayPolicy<policy_value_t> playPolicy;
+    playPolicy.fin(DIRECTORY_PARAMS_IN + "play_policy_param.dat");
+    StaticEvaluator<policy_value_t> evaluator;
+    evaluator.fin(DIRECTORY_PARAMS_IN + "static_eval_param.dat");
+    
+    for(int plies : {-1, 32, 16, 8}){
+        double time = 0;
+        uint64_t count = 0, truncated = 0;
+        PlayouterField field;
+        iterateGameLogAfterChange
+        (field, mLog,
+         [](const auto& field)->void{}, // first callback
+         [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+             const auto start = std::chrono::steady_clock::now();
+             for(int i = 0; i < PLAYOUTS; ++i){
+                 PlayouterField tfield = field;
+                 MoveInfo *const buffer = threadTools.buffer;
+                 tfield.mv = buffer;
+                 tfield.clearPolicySubValue();
+                 for(int t = 0;; ++t){
+                     const int tp = tfield.getTurnPlayer();
+                     tfield.prepareForPlay();
+                     if(plies >= 0 && t >= plies && tfield.isNF() && tfield.getNAlivePlayers() > 2){
+                         simulateClassesByStaticEval(&tfield, buffer, evaluator, &threadTools.dice);
+                         ++truncated;
+                         break;
+                     }
+                     const int moves = genMove(buffer, tfield.hand[tp].cards, tfield.bd);
+                     int index = 0;
+                     if(moves > 1){
+                         double score[N_MAX_MOVES + 1];
+                         tfield.NMoves = tfield.NActiveMoves = moves;
+                         tfield.updatePlayerPolicySubValue(tp, buffer + moves);
+                         calcPlayPolicyScoreFast<0>(score, tfield, playPolicy);
+                         index = selectBySoftmax(score, moves, 1.0, &threadTools.dice);
+                     }
+                     if(tfield.proc(tp, buffer[index]) == -1)break;
+                 }
+             }
+             time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+             count += PLAYOUTS;
+             return 0;
+         },
+         [](const auto& field)->void{}); // last callback
+        cerr << "truncation plies " << plies << " : playouts/sec " << count / max(time, 1e-9);
+        cerr << " truncated " << truncated / (double)max(count, (uint64_t)1) << endl;
+    }
+    return 0;
+}
+
+template<class logs_t>
+int testBatchPlayoutSpeed(const logs_t& mLog){
+    // 複数の世界のプレイアウトを1手ずつ揃えて進めた場合の速度比較
+    // 1レーンは従来の1つずつのプレイアウトと同じ
+    constexpr int PLAYOUTS = 16;
+    PlayPolicy<policy_value_t> playPolicy;
+    playPolicy.fin(DIRECTORY_PARAMS_IN + "play_policy_param.dat");
+    static PlayoutBatch batch;
+    batch.init(8192);
+    
+    for(int lanes : {1, 4, PlayoutBatch::N_MAX_LANES}){
+        double time = 0;
+        uint64_t count = 0;
+        PlayouterField field;
+        iterateGameLogAfterChange
+        (field, mLog,
+         [](const auto& field)->void{}, // first callback
+         [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+             const auto start = std::chrono::steady_clock::now();
+             for(int done = 0; done < PLAYOUTS; done += lanes){
+                 const int n = min(lanes, PLAYOUTS - done);
+                 int running = n;
+                 int index[PlayoutBatch::N_MAX_LANES];
+                 for(int l = 0; l < n; ++l){
+                     batch.field[l] = field;
+                     batch.field[l].mv = batch.buffer(l);
+                     batch.field[l].clearPolicySubValue();
+                     batch.running[l] = true;
+                 }
+                 while(running > 0){
+                     for(int l = 0; l < n; ++l){
+                         if(!batch.running[l])continue;
+                         PlayouterField& tfield = batch.field[l];
+                         tfield.prepareForPlay();
+                         const int tp = tfield.getTurnPlayer();
+                         tfield.NMoves = tfield.NActiveMoves = genMove(tfield.mv, tfield.hand[tp].cards, tfield.bd);
+                     }
+                     for(int l = 0; l < n; ++l){
+                         if(!batch.running[l])continue;
+                         PlayouterField& tfield = batch.field[l];
+                         index[l] = 0;
+                         if(tfield.NMoves > 1){
+                             double score[N_MAX_MOVES + 1];
+                             tfield.updatePlayerPolicySubValue(tfield.getTurnPlayer(), tfield.mv + tfield.NMoves);
+                             calcPlayPolicyScoreFast<0>(score, tfield, playPolicy);
+                             index[l] = selectBySoftmax(score, tfield.NMoves, 1.0, &threadTools.dice);
+                         }
+                     }
+                     for(int l = 0; l < n; ++l){
+                         if(!batch.running[l])continue;
+                         PlayouterField& tfield = batch.field[l];
+                         if(tfield.proc(tfield.getTurnPlayer(), tfield.mv[index[l]]) == -1){
+                             batch.running[l] = false;
+                             --running;
+                         }
+                     }
+                 }
+             }
+             time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+             count += PLAYOUTS;
+             return 0;
+         },
+         [](const auto& field)->void{}); // last callback
+        cerr << "batch lanes " << lanes << " : playouts/sec " << count / max(time, 1e-9) << endl;
+    }
+    return 0;
+}
+
+template<class logs_t>
+int testLeafL2Budget(const logs_t& mLog){
+    // プレイアウト末端のラスト2人探索のノード上限ごとの解決率と時間
+    // (末端探索の予算と、プレイアウト回数との兼ね合いを見る)
+    for(int limit : {1024, 8192, 65536, 1 << 20}){
+        LeafSearchController leafSearch;
+        leafSearch.startDecision(false, LeafSearchController::clock_t::now(), 1, limit);
+        PlayouterField field;
+        iterateGameLogAfterChange
+        (field, mLog,
+         [](const auto& field)->void{}, // first callback
+         [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+             if(field.getNAlivePlayers() != 2)return 0;
+             PlayouterField tfield = field;
+             tfield.prepareForPlay();
+             const uint32_t blackPlayer = tfield.getTurnPlayer();
+             const uint32_t whitePlayer = tfield.ps.searchOpsPlayer(blackPlayer);
+             L2::book.clear();
+             const auto start = LeafSearchController::clock_t::now();
+             L2Judge l2(leafSearch.L2NodeLimit(start), threadTools.buffer);
+             const int result = l2.start_judge(tfield.hand[blackPlayer], tfield.hand[whitePlayer], tfield.bd, tfield.fieldInfo);
+             leafSearch.feedL2(l2.getNodes(), result == L2_WIN || result == L2_LOSE, l2.isFailed(),
+                               start, LeafSearchController::clock_t::now());
+             return 0;
+         },
+         [](const auto& field)->void{}); // last callback
+        const auto& stats = leafSearch.statistics();
+        cerr << "L2 node limit " << limit << " : " << stats.toString();
+        cerr << " time/search " << stats.leafTime / (double)max(stats.L2Searches, (uint64_t)1) << " ns" << endl;
+    }
+    return 0;
+}
+
+template<class logs_t>
+int testPlayoutOutcomeCache(const logs_t& mLog){
+    // 終盤の空場の完全情報局面の結果を置換表に記録した場合の的中率
+    // 棋譜の同じ局面から何度もプレイアウトを行うので、同じ終盤局面を通ることが多いはず
+    constexpr int PLAYOUTS = 64;
+    static PlayoutOutcomeCache cache;
+    cache.init(PLAYOUT_OUTCOME_CACHE_SIZE);
+    
+    for(int maxCards : {8, 12, 16}){
+        PlayoutOutcomeStatistics stats;
+        PlayouterField field;
+        iterateGameLogAfterChange
+        (field, mLog,
+         [](const auto& field)->void{}, // first callback
+         [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+             cache.clear();
+             for(int i = 0; i < PLAYOUTS; ++i){
+                 PlayouterField tfield = field;
+                 tfield.mv = threadTools.buffer;
+                 tfield.initForPlayout();
+                 while(1){
+                     tfield.prepareForPlay();
+                     if(tfield.isNF() && tfield.remQty <= (uint32_t)maxCards){
+                         const uint64_t key = tfield.getFullInfoKey();
+                         uint32_t classes;
+                         bool solved;
+                         if(cache.probe(key, Settings::outcomeCacheReuseRate, &threadTools.dice, &classes, &solved))break;
+                         tfield.pushOutcomeKey(key);
+                     }
+                     const int tp = tfield.getTurnPlayer();
+                     const int moves = genMove(tfield.mv, tfield.hand[tp].cards, tfield.bd);
+                     if(tfield.proc(tp, tfield.mv[threadTools.dice.rand() % moves]) == -1){
+                         for(int k = 0; k < tfield.NOutcomeKeys; ++k){
+                             uint32_t classes = 0;
+                             for(int p = 0; p < N_PLAYERS; ++p){
+                                 if(tfield.outcomeAlive[k] & (1U << p))classes |= tfield.getPlayerNewClass(p) << (4 * p);
+                             }
+                             cache.regist(tfield.outcomeKey[k], classes, false, &threadTools.dice);
+                         }
+                         break;
+                     }
+                 }
+             }
+             stats += cache.statistics();
+             return 0;
+         },
+         [](const auto& field)->void{}); // last callback
+        cerr << "max cards " << maxCards << " : " << stats.toString() << endl;
+    }
+    return 0;
+}
+
+template<int PRECALC, class logs_t>
+double policyPlayoutsPerSec(const logs_t& mLog, const PlayPolicy<policy_value_t>& pol, int playouts){
+    // 棋譜の各局面から方策に従ったプレイアウトを playouts 回ずつ行い、1秒あたりの回数を返す
+    double time = 0; // 秒
+    uint64_t count = 0;
+    PlayouterField field;
+    iterateGameLogAfterChange
+    (field, mLog,
+     [](const auto& field)->void{}, // first callback
+     [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+         const auto start = std::chrono::steady_clock::now();
+         for(int i = 0; i < playouts; ++i){
+             PlayouterField tfield = field;
+             policyPlayout<PRECALC>(&tfield, pol);
+         }
+         time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+         count += playouts;
+         return 0;
+     },
+     [](const auto& field)->void{}); // last callback
+    return count / max(time, 1e-9);
+}
+
+template<class logs_t>
+int testPolicyPlayoutSpeed(const logs_t& mLog){
+    // 方策計算の違いによるプレイアウト速度の比較
+    PlayPolicy<policy_value_t> playPolicy;
+    playPolicy.fin(DIRECTORY_PARAMS_IN + "play_policy_param.dat");
+    
+    const double slow = policyPlayoutsPerSec<0>(mLog, playPolicy, 10);
+    const double precalc = policyPlayoutsPerSec<1>(mLog, playPolicy, 10);
+    cerr << "policy playouts/sec : slow " << slow << " precalc " << precalc;
+    cerr << " (x" << precalc / slow << ")" << endl;
+    return 0;
+}
+
+template<class logs_t>
+int testPlayoutSetup(const logs_t& mLog){
+    // プレイアウト開始局面の準備方法の比較
+    // 構造体全体のコピー、共通部分のコピー + 世界の手札の展開(Hand::set)、
+    // 共通部分のコピー + 展開済みの手札のコピー(世界ごとのキャッシュ)について
+    // 準備1回あたりの時間と、準備込みのプレイアウト速度を調べる
+    constexpr int SETUPS = 100;
+    constexpr int PLAYOUTS = 10;
+    
+    PlayPolicy<policy_value_t> playPolicy;
+    playPolicy.fin(DIRECTORY_PARAMS_IN + "play_policy_param.dat");
+    
+    PlayoutWorldCache cache;
+    cache.init(1);
+    
+    double setupTime[3] = {0}, playoutTime[3] = {0}; // 秒
+    uint64_t setups = 0, playouts = 0;
+    
+    PlayouterField field;
+    iterateGameLogAfterChange
+    (field, mLog,
+     [](const auto& field)->void{}, // first callback
+     [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+         // 棋譜の本当の手札を世界とする
+         ImaginaryWorld world;
+         for(int p = 0; p < N_PLAYERS; ++p){
+             world.cards[p] = field.getCards(p);
+             world.hash_cards[p] = CardsToHashKey(world.cards[p]);
+         }
+         cache.clear();
+         
+         auto setup = [&](int type, PlayouterField *const dst)->void{
+             if(type == 0){
+                 *dst = field;
+             }else{
+                 copyField(field, dst);
+                 if(type == 1)setWorld(field, world, dst);
+                 else cache.setWorld(0, field, world, dst);
+             }
+         };
+         for(int type = 0; type < 3; ++type){
+             PlayouterField f;
+             auto start = std::chrono::steady_clock::now();
+             for(int i = 0; i < SETUPS; ++i)setup(type, &f);
+             setupTime[type] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+             
+             start = std::chrono::steady_clock::now();
+             for(int i = 0; i < PLAYOUTS; ++i){
+                 setup(type, &f);
+                 policyPlayout<1>(&f, playPolicy);
+             }
+             playoutTime[type] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+         }
+         setups += SETUPS;
+         playouts += PLAYOUTS;
+         return 0;
+     },
+     [](const auto& field)->void{}); // last callback
+    
+    const char *name[3] = {"full copy", "copy + set hands", "copy + cached hands"};
+    cerr << "sizeof(PlayouterField) = " << sizeof(PlayouterField) << " bytes";
+    cerr << " hands = " << sizeof(PlayoutWorldHands) << " bytes" << endl;
+    for(int type = 0; type < 3; ++type){
+        cerr << name[type] << " : setup " << setupTime[type] * 1e9 / max(setups, (uint64_t)1) << " ns";
+        cerr << " playouts/sec " << playouts / max(playoutTime[type], 1e-9) << endl;
+    }
+    cerr << "cache hits " << cache.hits() << " misses " << cache.misses() << endl;
+    return 0;
+}
+
+class L1DMissCounter{
+    // perf_event_open による L1 データキャッシュの読み込みミス数の計測
+    // Linux 以外や、権限等で使えない場合は available() が false になる
+public:
+    bool available()const noexcept{ return fd_ >= 0; }
+#ifdef __linux__
+    void start(){
+        if(!available())return;
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t stop(){
+        if(!available())return 0;
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t count = 0;
+        if(read(fd_, &count, sizeof(count)) != sizeof(count))return 0;
+        return count;
+    }
+    L1DMissCounter(){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_L1D
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~L1DMissCounter(){ if(available())close(fd_); }
+#else
+    void start(){}
+    uint64_t stop(){ return 0; }
+    L1DMissCounter(): fd_(-1){}
+#endif
+private:
+    int fd_;
+};
+
+bool examOpsHands(const PlayouterField& field){
+    // 遅延更新される相手手札が、残り札から一括で計算したものと一致するか
+    for(int p = 0; p < N_PLAYERS; ++p){
+        if(!field.isAlive(p))continue;
+        const Hand& ops = field.getOpsHand(p);
+        Hand ans;
+        ans.setAll(subtrCards(field.getRemCards(), field.getCards(p)));
+        if(ops.cards != ans.cards || ops.qty != ans.qty || ops.hash != ans.hash || !ops.exam()){
+            cerr << "player " << p << endl << ops << endl << ans << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+template<class logs_t>
+int testPlayoutLayout(const logs_t& mLog){
+    // プレイアウト用局面構造体の配置の確認
+    // 1手ごとに触るメンバが先頭のキャッシュライン2本に収まっているかと、
+    // プレイアウト中の L1 データキャッシュミス数を調べる
+    // あわせて、遅延更新される相手手札が毎手正しく読めるかを確かめる
+    constexpr int PLAYOUTS = 10;
+    
+    PlayPolicy<policy_value_t> playPolicy;
+    playPolicy.fin(DIRECTORY_PARAMS_IN + "play_policy_param.dat");
+    
+    {
+        PlayouterField f;
+        const char *const base = (const char*)&f;
+        cerr << "sizeof(PlayouterField) = " << sizeof(PlayouterField) << " bytes" << endl;
+        cerr << "hot members end at " << ((const char*)&f.depth + sizeof(f.depth) - base) << " bytes";
+        cerr << ", hands start at " << ((const char*)&f.hand - base) << " bytes" << endl;
+    }
+    
+    // 相手手札の遅延更新の確認
+    int errors = 0;
+    PlayouterField field;
+    iterateGameLogAfterChange
+    (field, mLog,
+     [](const auto& field)->void{}, // first callback
+     [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+         PlayouterField tfield = field;
+         MoveInfo *const buffer = threadTools.buffer;
+         while(1){
+             if(!examOpsHands(tfield)){ ++errors; break; }
+             const int tp = tfield.getTurnPlayer();
+             tfield.prepareForPlay();
+             const int moves = genMove(buffer, tfield.hand[tp].cards, tfield.bd);
+             const int index = threadTools.dice.rand() % moves;
+             if(tfield.proc(tp, buffer[index]) == -1)break;
+         }
+         return 0;
+     },
+     [](const auto& field)->void{}); // last callback
+    cerr << "lazy ops hand errors : " << errors << endl;
+    
+    // キャッシュミス数
+    L1DMissCounter counter;
+    uint64_t misses = 0, playouts = 0;
+    double time = 0;
+    iterateGameLogAfterChange
+    (field, mLog,
+     [](const auto& field)->void{}, // first callback
+     [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+         const auto start = std::chrono::steady_clock::now();
+         counter.start();
+         for(int i = 0; i < PLAYOUTS; ++i){
+             PlayouterField tfield = field;
+             policyPlayout<1>(&tfield, playPolicy);
+         }
+         misses += counter.stop();
+         time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+         playouts += PLAYOUTS;
+         return 0;
+     },
+     [](const auto& field)->void{}); // last callback
+    
+    cerr << "policy playouts/sec " << playouts / max(time, 1e-9);
+    if(counter.available()){
+        cerr << " L1D read misses/playout " << misses / (double)max(playouts, (uint64_t)1) << endl;
+    }else{
+        cerr << " (L1D miss counter unavailable)" << endl;
+    }
+    return errors;
+}
 
 int main(int argc, char* argv[]){
     
@@ -229,8 +710,14 @@ int main(int argc, char* argv[]){
     }
     
     for(const std::string& log : logFileNames){
-        MinMatchLog<MinGameLog<MinPlayLog<N_PLAYERS>>> mLog(log);
-        testPlayPolicyModeling(mLog);
+        MinMatchLog<MinGameLog<MinPlayLog>> mLog(log);
+        testPolicyPlayoutSpeed(mLog);
+        testTruncatedPlayoutSpeed(mLog);
+        testBatchPlayoutSpeed(mLog);
+        testLeafL2Budget(mLog);
+        testPlayoutOutcomeCache(mLog);
+        testPlayoutSetup(mLog);
+        testPlayoutLayout(mLog);
     }
     
     return 0;
@@ -0,0 +1,408 @@
+/*
+ stopping_test.cc
+ Katsuki Ohto
+ */
+
+// モンテカルロ探索の打ち切り判定の比較
+// 真の価値が分かっている人工的な候補集合について、プレイアウトと打ち切り判定を繰り返し、
+// 判定1回あたりの計算時間、打ち切りまでのプレイアウト数、選んだ候補の後悔を比べる
+// 共通乱数(全候補が周回ごとに同じ一様乱数で報酬を決める)の場合には、対の差の標準誤差を使ったときも比べる
+// また、ルートでの割り振り方(UCB-root と方策の確率による候補の段階的追加)ごとに、
+// 同じ回数のプレイアウトで選んだ候補の後悔を比べる
+// 棋譜を与えた場合は、棋譜の局面で十分な回数の UCB-root 探索の結果をラベルとして同じ比較を行う
+
+#include "../include.h"
+#include "../fuji/fuji.h"
+#include "../structure/log/minLog.hpp"
+#include "../generator/moveGenerator.hpp"
+#include "../fuji/montecarlo/playout.h"
+#include "../fuji/policy/playPolicy.hpp"
+#include "../fuji/montecarlo/stoppingRule.hpp"
+#include "../fuji/montecarlo/rootAllocator.hpp"
+
+std::string DIRECTORY_PARAMS_IN(""), DIRECTORY_PARAMS_OUT(""), DIRECTORY_LOGS("");
+
+using namespace UECda;
+using namespace UECda::Fuji;
+
+Clock cl;
+XorShift64 dice;
+MoveInfo buffer[8192];
+PlayPolicy<policy_value_t> playPolicy;
+
+constexpr int MAX_PLAYOUTS = 1 << 16;
+
+struct StoppingResult{
+    uint64_t trials;
+    uint64_t checks;
+    uint64_t checkTime;
+    uint64_t playouts;
+    double regret;
+    uint64_t wrongs;
+    
+    void clear(){
+        trials = checks = checkTime = playouts = 0;
+        regret = 0;
+        wrongs = 0;
+    }
+    std::string toString()const{
+        std::ostringstream oss;
+        const double t = max(trials, (uint64_t)1);
+        oss << "playouts " << playouts / t;
+        oss << " regret " << regret / t;
+        oss << " wrong " << wrongs / t;
+        oss << " time/check " << checkTime / (double)max(checks, (uint64_t)1);
+        oss << " checks " << checks / t;
+        return oss.str();
+    }
+    StoppingResult(){ clear(); }
+};
+
+constexpr int MAX_PAIRED_CANDIDATES = 64;
+double pairSum[MAX_PAIRED_CANDIDATES][MAX_PAIRED_CANDIDATES];
+double pairSum2[MAX_PAIRED_CANDIDATES][MAX_PAIRED_CANDIDATES];
+
+template<class rule_t>
+void runTrial(const rule_t& rule, const double *const value, const int n,
+              const double valuePerPlayout, StoppingResult *const pres,
+              const bool common = false, const bool paired = false){
+    // 報酬は平均 value[m] のベルヌーイ分布とし、各候補に順番にプレイアウトを割り振る
+    // common のとき、同じ周回の全候補が同じ一様乱数で報酬を決める(共通乱数)
+    // paired のとき、最善候補との対の差の標準誤差を打ち切り判定に渡す
+    // 本体と同様に32回ごとに打ち切り判定を行う
+    double sum[N_MAX_MOVES];
+    uint64_t cnt[N_MAX_MOVES];
+    StoppingArm arm[N_MAX_MOVES];
+    double roundReward[N_MAX_MOVES];
+    for(int m = 0; m < n; ++m){
+        sum[m] = 0;
+        cnt[m] = 0;
+        for(int j = 0; j < n; ++j)pairSum[m][j] = pairSum2[m][j] = 0;
+    }
+    int playouts = 0;
+    double u = 0;
+    while(playouts < MAX_PLAYOUTS){
+        const int m = playouts % n;
+        if(!common || m == 0)u = dice.drand();
+        const double r = (u < value[m]) ? 1 : 0;
+        sum[m] += r;
+        cnt[m] += 1;
+        roundReward[m] = r;
+        ++playouts;
+        if(paired && m == n - 1){
+            // 周回が終わったので対の差を記録
+            for(int i = 0; i < n; ++i){
+                for(int j = 0; j < n; ++j){
+                    const double d = roundReward[i] - roundReward[j];
+                    pairSum[i][j] += d;
+                    pairSum2[i][j] += d * d;
+                }
+            }
+        }
+        if(playouts % 32 == 0 && playouts >= 4 * n){
+            int best = 0;
+            for(int c = 0; c < n; ++c){
+                // ベータ分布(事前分布 Beta(1, 1))の平均と、その分散
+                const double a = sum[c] + 1, b = cnt[c] - sum[c] + 1;
+                arm[c].mean = a / (a + b);
+                arm[c].sem = sqrt(a * b / ((a + b) * (a + b) * (a + b + 1)));
+                arm[c].diffSem = -1;
+                if(arm[c].mean > arm[best].mean)best = c;
+            }
+            const int rounds = playouts / n;
+            if(paired && rounds >= 8){
+                for(int c = 0; c < n; ++c){
+                    if(c == best)continue;
+                    const double mean = pairSum[c][best] / rounds;
+                    const double var = (max(0.0, pairSum2[c][best] - rounds * mean * mean) + 1) / rounds; // 本体と同じ補正
+                    arm[c].diffSem = sqrt(var / rounds);
+                }
+            }
+            const double allowance = 2 * playouts * valuePerPlayout;
+            cl.start();
+            const bool stop = rule.judge(arm, n, allowance, &dice);
+            pres->checkTime += cl.stop();
+            pres->checks += 1;
+            if(stop)break;
+        }
+    }
+    int best = 0, trueBest = 0;
+    for(int m = 1; m < n; ++m){
+        if(sum[m] / max(cnt[m], (uint64_t)1) > sum[best] / max(cnt[best], (uint64_t)1))best = m;
+        if(value[m] > value[trueBest])trueBest = m;
+    }
+    pres->trials += 1;
+    pres->playouts += playouts;
+    pres->regret += value[trueBest] - value[best];
+    pres->wrongs += (best != trueBest) ? 1 : 0;
+}
+
+int testStoppingRules(int trials){
+    const int candidates[] = {2, 5, 10, 30, 60};
+    const double costs[] = {1e-6, 1e-5, 1e-4};
+    
+    SampledRegretStoppingRule sampled;
+    AnalyticRegretStoppingRule analytic;
+    
+    for(int n : candidates){
+        for(double cost : costs){
+            StoppingResult sampledResult, analyticResult, commonResult, pairedResult;
+            for(int t = 0; t < trials; ++t){
+                double value[N_MAX_MOVES];
+                for(int m = 0; m < n; ++m){
+                    value[m] = 0.2 + 0.6 * dice.drand();
+                }
+                runTrial(sampled, value, n, cost, &sampledResult);
+                runTrial(analytic, value, n, cost, &analyticResult);
+                runTrial(analytic, value, n, cost, &commonResult, true, false);
+                runTrial(analytic, value, n, cost, &pairedResult, true, true);
+            }
+            cerr << "candidates " << n << " cost " << cost << endl;
+            cerr << " sampled  : " << sampledResult.toString() << endl;
+            cerr << " analytic : " << analyticResult.toString() << endl;
+            cerr << " common   : " << commonResult.toString() << endl;
+            cerr << " paired   : " << pairedResult.toString() << endl;
+        }
+    }
+    return 0;
+}
+
+template<class pull_t>
+int allocate(RootAllocatorType type, const pull_t& pull, const double *const prior,
+             const int n, const int budget, double *const mean = nullptr){
+    // pull(m) で候補 m の報酬(0 ~ 1)を得るとして、budget 回のプレイアウトを割り振って選んだ候補を返す
+    // mean があれば候補ごとの平均報酬(事前分布 Beta(1, 1))を入れる
+    double sum[N_MAX_MOVES];
+    uint64_t cnt[N_MAX_MOVES];
+    for(int m = 0; m < n; ++m){
+        sum[m] = 0;
+        cnt[m] = 0;
+    }
+    auto score = [&](int c)->BetaDistribution{
+        return BetaDistribution(sum[c] + 1, cnt[c] - sum[c] + 1);
+    };
+    auto simulations = [&](int c)->uint64_t{ return cnt[c]; };
+    RootAllocator allocator;
+    allocator.init(type, n, budget, prior);
+    for(int playouts = 0; playouts < budget; ++playouts){
+        const double allSize = playouts + 2 * n;
+        const int m = allocator.select(score, simulations, allSize, 4, &dice);
+        sum[m] += pull(m);
+        cnt[m] += 1;
+    }
+    // 一度もプレイアウトしなかった候補は選ばない
+    int best = -1;
+    for(int m = 0; m < n; ++m){
+        if(cnt[m] > 0 && (best < 0 || score(m).mean() > score(best).mean()))best = m;
+        if(mean != nullptr)mean[m] = score(m).mean();
+    }
+    return best;
+}
+
+double runAllocation(RootAllocatorType type, const double *const value, const double *const prior,
+                     const int n, const int budget){
+    // 報酬は平均 value[m] のベルヌーイ分布とし、budget 回のプレイアウトを割り振って選んだ候補の後悔を返す
+    const int best = allocate(type, [&](int m)->double{
+        return (dice.drand() < value[m]) ? 1 : 0;
+    }, prior, n, budget);
+    int trueBest = 0;
+    for(int m = 0; m < n; ++m){
+        if(value[m] > value[trueBest])trueBest = m;
+    }
+    return value[trueBest] - value[best];
+}
+
+int testRootAllocators(int trials){
+    // 方策の確率は真の価値に雑音を加えたものの softmax とする
+    const int candidates[] = {10, 30, 60};
+    const int budgetRates[] = {4, 8, 16, 32, 64}; // 候補1つあたりのプレイアウト数
+    constexpr int N_BUDGETS = sizeof(budgetRates) / sizeof(budgetRates[0]);
+    
+    for(int n : candidates){
+        double ucbRegret[N_BUDGETS] = {0}, pwRegret[N_BUDGETS] = {0};
+        for(int t = 0; t < trials; ++t){
+            double value[N_MAX_MOVES], prior[N_MAX_MOVES];
+            double priorSum = 0;
+            for(int m = 0; m < n; ++m){
+                value[m] = 0.2 + 0.6 * dice.drand();
+                prior[m] = exp(8 * value[m] + 2 * (dice.drand() - 0.5));
+                priorSum += prior[m];
+            }
+            for(int m = 0; m < n; ++m)prior[m] /= priorSum;
+            for(int b = 0; b < N_BUDGETS; ++b){
+                ucbRegret[b] += runAllocation(RootAllocatorType::UCB_ROOT, value, prior, n, n * budgetRates[b]);
+                pwRegret[b] += runAllocation(RootAllocatorType::PROGRESSIVE_WIDENING, value, prior, n, n * budgetRates[b]);
+            }
+        }
+        cerr << "candidates " << n << endl;
+        for(int b = 0; b < N_BUDGETS; ++b){
+            cerr << " playouts " << n * budgetRates[b];
+            cerr << " : ucb regret " << ucbRegret[b] / trials;
+            cerr << " pw regret " << pwRegret[b] / trials << endl;
+        }
+        // UCB-root の各予算での後悔に届く最小の予算から、節約できたプレイアウト数を求める
+        for(int b = 0; b < N_BUDGETS; ++b){
+            for(int pb = 0; pb <= b; ++pb){
+                if(pwRegret[pb] <= ucbRegret[b]){
+                    cerr << " ucb " << n * budgetRates[b] << " playouts ~ pw " << n * budgetRates[pb];
+                    cerr << " playouts (saved " << n * (budgetRates[b] - budgetRates[pb]) << ")" << endl;
+                    break;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+void policyPlayout(PlayouterField *const pfield){
+    // 方策に従って最後まで進める
+    pfield->mv = buffer;
+    pfield->clearPolicySubValue();
+    while(1){
+        const int tp = pfield->getTurnPlayer();
+        pfield->prepareForPlay();
+        const int moves = genMove(buffer, pfield->hand[tp].cards, pfield->bd);
+        int index = 0;
+        if(moves > 1){
+            double score[N_MAX_MOVES + 1];
+            calcPlayPolicyScoreSlow<0>(score, buffer, moves, *pfield, playPolicy);
+            index = selectBySoftmax(score, moves, 1.0, &dice);
+        }
+        if(pfield->proc(tp, buffer[index]) == -1)break;
+    }
+}
+
+template<class logs_t>
+int testRootAllocatorsWithRecord(const logs_t& mLog, int maxPositions){
+    // 棋譜の局面(3つ以上の候補があるもの)を、候補1つあたり LABEL_RATE 回の UCB-root 探索でラベル付けする
+    // ラベルの探索での各候補の平均報酬を真の価値とみなし、より少ない予算の UCB-root と
+    // 方策の確率による候補の段階的追加の後悔と、ラベルの最善候補との一致率を比べる
+    // プレイアウトは完全情報の局面から方策に従って最後まで進め、報酬は順位を 0 ~ 1 にしたもの
+    constexpr int LABEL_RATE = 256;
+    constexpr int STRIDE = 8; // 棋譜の局面を何手おきに使うか
+    const int budgetRates[] = {4, 8, 16, 32, 64}; // 候補1つあたりのプレイアウト数
+    constexpr int N_BUDGETS = sizeof(budgetRates) / sizeof(budgetRates[0]);
+    
+    int positions = 0, plies = 0;
+    uint64_t candidatesSum = 0;
+    double ucbRegret[N_BUDGETS] = {0}, pwRegret[N_BUDGETS] = {0};
+    int ucbAgree[N_BUDGETS] = {0}, pwAgree[N_BUDGETS] = {0};
+    PlayouterField field;
+    iterateGameLogAfterChange
+    (field, mLog,
+     [](const auto& field)->void{}, // first callback
+     [&](const auto& field, Move pl, uint32_t tm)->int{ // play callback
+         if(positions >= maxPositions)return -1;
+         if(plies++ % STRIDE != 0)return 0;
+         MoveInfo play[N_MAX_MOVES];
+         const int tp = field.getTurnPlayer();
+         const int n = genMove(play, field.hand[tp].cards, field.bd);
+         if(n < 3)return 0;
+         
+         // 方策の確率
+         double score[N_MAX_MOVES + 1], prior[N_MAX_MOVES];
+         calcPlayPolicyScoreSlow<0>(score, play, n, field, playPolicy);
+         double maxScore = -DBL_MAX, priorSum = 0;
+         for(int m = 0; m < n; ++m)maxScore = max(maxScore, score[m]);
+         for(int m = 0; m < n; ++m){
+             prior[m] = exp(score[m] - maxScore);
+             priorSum += prior[m];
+         }
+         for(int m = 0; m < n; ++m)prior[m] /= priorSum;
+         
+         auto pull = [&](int m)->double{
+             PlayouterField tfield = field;
+             tfield.mv = buffer;
+             if(tfield.proc(tp, play[m]) != -1)policyPlayout(&tfield);
+             return (N_PLAYERS - 1 - (int)tfield.getPlayerNewClass(tp)) / (double)(N_PLAYERS - 1);
+         };
+         double value[N_MAX_MOVES];
+         const int label = allocate(RootAllocatorType::UCB_ROOT, pull, prior, n, n * LABEL_RATE, value);
+         for(int b = 0; b < N_BUDGETS; ++b){
+             const int ucb = allocate(RootAllocatorType::UCB_ROOT, pull, prior, n, n * budgetRates[b]);
+             const int pw = allocate(RootAllocatorType::PROGRESSIVE_WIDENING, pull, prior, n, n * budgetRates[b]);
+             ucbRegret[b] += value[label] - value[ucb];
+             pwRegret[b] += value[label] - value[pw];
+             ucbAgree[b] += (ucb == label) ? 1 : 0;
+             pwAgree[b] += (pw == label) ? 1 : 0;
+         }
+         candidatesSum += n;
+         ++positions;
+         return 0;
+     },
+     [](const auto& field)->void{}); // last callback
+    
+    const double np = max(positions, 1);
+    cerr << "record positions " << positions << " (candidates " << candidatesSum / np << ")" << endl;
+    for(int b = 0; b < N_BUDGETS; ++b){
+        cerr << " playouts/candidate " << budgetRates[b];
+        cerr << " : ucb regret " << ucbRegret[b] / np << " agree " << ucbAgree[b] / np;
+        cerr << " pw regret " << pwRegret[b] / np << " agree " << pwAgree[b] / np << endl;
+    }
+    // UCB-root の各予算での後悔に届く最小の予算から、同じ判断の質で節約できたプレイアウト数を求める
+    for(int b = 0; b < N_BUDGETS; ++b){
+        for(int pb = 0; pb <= b; ++pb){
+            if(pwRegret[pb] <= ucbRegret[b]){
+                cerr << " ucb " << budgetRates[b] << " playouts/candidate ~ pw " << budgetRates[pb];
+                cerr << " (saved " << (budgetRates[b] - budgetRates[pb]) * candidatesSum / np << " playouts)" << endl;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+    
+    {
+        std::ifstream ifs("blauweregen_config.txt");
+        if(ifs){ ifs >> DIRECTORY_PARAMS_IN; }
+        if(ifs){ ifs >> DIRECTORY_PARAMS_OUT; }
+        if(ifs){ ifs >> DIRECTORY_LOGS; }
+    }
+    std::vector<std::string> logFileNames;
+    
+    int trials = 100;
+    int positions = 100;
+    
+    dice.srand((unsigned int)time(NULL));
+    
+    for(int c = 1; c < argc; ++c){
+        if(!strcmp(argv[c], "-t")){ // num of trials
+            trials = atoi(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-i")){ // input directory
+            DIRECTORY_PARAMS_IN = std::string(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-l")){ // log path
+            logFileNames.push_back(std::string(argv[c + 1]));
+        }else if(!strcmp(argv[c], "-p")){ // max num of record positions
+            positions = atoi(argv[c + 1]);
+        }
+    }
+    
+    if(testStoppingRules(trials)){
+        cerr << "failed stopping rule test." << endl;
+        return -1;
+    }
+    cerr << "passed stopping rule test." << endl;
+    
+    if(testRootAllocators(trials)){
+        cerr << "failed root allocator test." << endl;
+        return -1;
+    }
+    cerr << "passed root allocator test." << endl;
+    
+    // 棋譜の局面での比較(例 : -l testdata/braux5.dat)
+    if(!logFileNames.empty()){
+        playPolicy.fin(DIRECTORY_PARAMS_IN + "play_policy_param.dat");
+    }
+    for(const std::string& log : logFileNames){
+        MinMatchLog<MinGameLog<MinPlayLog>> mLog(log);
+        if(testRootAllocatorsWithRecord(mLog, positions)){
+            cerr << "failed root allocator test with record." << endl;
+            return -1;
+        }
+        cerr << "passed root allocator test with record." << endl;
+    }
+    
+    return 0;
+}
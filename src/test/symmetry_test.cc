@@ -0,0 +1,176 @@
+/*
+ symmetry_test.cc
+ Katsuki Ohto
+ */
+
+// スートの置換と、それによるルート候補の同一視のテスト
+
+#include "../include.h"
+#include "../generator/moveGenerator.hpp"
+#include "../fuji/logic/suitSymmetry.hpp"
+
+using namespace UECda;
+
+MoveInfo buffer[8192];
+MoveGenerator<MoveInfo, Cards> mgCards;
+XorShift64 dice;
+
+void invertPerm(const int perm[4], int inv[4]){
+    for(int i = 0; i < 4; ++i)inv[perm[i]] = i;
+}
+
+int testPermuteCardsSuits(const std::vector<Cards>& sample){
+    // 全ての置換について、各ランクのスート集合が permuteSuits の通りに移り、
+    // 逆置換で元に戻ることを確かめる
+    int p[4] = {0, 1, 2, 3};
+    do{
+        int inv[4];
+        invertPerm(p, inv);
+        for(Cards c : sample){
+            const Cards pc = permuteCardsSuits(c, p);
+            if(countCards(pc) != countCards(c) || containsJOKER(pc) != containsJOKER(c)){
+                cerr << "inconsistent number of cards. " << OutCards(c) << " -> " << OutCards(pc) << endl;
+                return -1;
+            }
+            for(int r = RANK_MIN; r <= RANK_MAX; ++r){
+                uint32_t s = 0, ps = 0;
+                for(int i = 0; i < 4; ++i){
+                    if(containsCard(c, RankSuitsToCards(r, 1U << i)))s |= 1U << i;
+                    if(containsCard(pc, RankSuitsToCards(r, 1U << i)))ps |= 1U << i;
+                }
+                if(ps != permuteSuits(s, p)){
+                    cerr << "inconsistent suits of rank " << r << ". " << OutCards(c) << " -> " << OutCards(pc) << endl;
+                    return -1;
+                }
+            }
+            if(permuteCardsSuits(pc, inv) != c){
+                cerr << "inverse permutation failed. " << OutCards(c) << " -> " << OutCards(pc) << endl;
+                return -1;
+            }
+        }
+    }while(std::next_permutation(p, p + 4));
+    return 0;
+}
+
+int testSymmetryInit(){
+    // 局面を変えない置換だけが列挙されることを確かめる
+    const Board bd = OrderToNullBoard(0);
+    SuitSymmetry symmetry;
+    
+    // 全てのスートが対称な場合(スペードの3が残っているのでスペードは固定)
+    const Cards allRanks = RankSuitsToCards(RANK_3, SUITS_CDHS) | RankSuitsToCards(RANK_7, SUITS_CDHS);
+    symmetry.init(RankSuitsToCards(RANK_7, SUITS_CDHS), RankSuitsToCards(RANK_3, SUITS_CDHS), CARDS_NULL, bd);
+    if(symmetry.NPerms != 5){
+        cerr << "expected 5 permutations but " << symmetry.NPerms << endl;
+        return -1;
+    }
+    for(int i = 0; i < symmetry.NPerms; ++i){
+        if(symmetry.perm[i][3] != 3){
+            cerr << "spade moved while S3 remains." << endl;
+            return -1;
+        }
+        if(permuteCardsSuits(allRanks, symmetry.perm[i]) != allRanks){
+            cerr << "permutation changes the cards." << endl;
+            return -1;
+        }
+    }
+    // 自分の手札がクラブだけ非対称な場合、ダイヤとハートの入れ替えだけが残る
+    symmetry.init(RankSuitsToCards(RANK_7, SUITS_CDHS) | RankSuitsToCards(RANK_9, SUIT_C),
+                  RankSuitsToCards(RANK_3, SUITS_CDHS), CARDS_NULL, bd);
+    if(symmetry.NPerms != 1 || symmetry.perm[0][0] != 0 || symmetry.perm[0][1] != 2 || symmetry.perm[0][2] != 1){
+        cerr << "expected only D <-> H but " << symmetry.NPerms << " permutations" << endl;
+        return -1;
+    }
+    // この試合でダイヤが単独で出されていれば、ダイヤを動かす置換は使えない
+    symmetry.init(RankSuitsToCards(RANK_7, SUITS_CDHS) | RankSuitsToCards(RANK_9, SUIT_C),
+                  RankSuitsToCards(RANK_3, SUITS_CDHS), CARDS_NULL, bd, 1U << SUIT_D);
+    if(symmetry.any()){
+        cerr << "permutation moves a suit played in the game." << endl;
+        return -1;
+    }
+    // ダイヤとハートのペアとして出された場合は入れ替えてよい
+    symmetry.init(RankSuitsToCards(RANK_7, SUITS_CDHS) | RankSuitsToCards(RANK_9, SUIT_C),
+                  RankSuitsToCards(RANK_3, SUITS_CDHS), CARDS_NULL, bd, 1U << (SUIT_D | SUIT_H));
+    if(symmetry.NPerms != 1){
+        cerr << "D <-> H should be kept for a played DH pair." << endl;
+        return -1;
+    }
+    return 0;
+}
+
+int testCanonicalKey(const std::vector<Cards>& sample){
+    // 対称な手札から生成した着手について、canonicalKey が同じになるのは
+    // ある置換で使うカードが移り合うときに限ることを確かめる
+    const Board bd = OrderToNullBoard(0);
+    for(Cards c : sample){
+        // ランクごとにスートを揃えて、全ての置換で変わらない手札にする
+        Cards myCards = CARDS_NULL;
+        for(int r = RANK_MIN; r <= RANK_MAX; ++r){
+            if(anyCards(andCards(c, RankToCards(r))))myCards |= RankSuitsToCards(r, SUITS_CDHS);
+        }
+        const Cards opsCards = subtrCards(CARDS_ALL, myCards);
+        SuitSymmetry symmetry;
+        symmetry.init(myCards, opsCards, CARDS_NULL, bd);
+        
+        const int moves = mgCards.genMove(buffer, myCards, bd);
+        for(int i = 0; i < moves; ++i){
+            const Move mi = buffer[i].mv();
+            if(mi.isPASS() || mi.containsJOKER())continue;
+            for(int j = 0; j < moves; ++j){
+                const Move mj = buffer[j].mv();
+                if(mj.isPASS() || mj.containsJOKER())continue;
+                bool equivalent = mi.cards() == mj.cards();
+                for(int k = 0; k < symmetry.NPerms; ++k){
+                    if(permuteCardsSuits(mi.cards(), symmetry.perm[k]) == mj.cards())equivalent = true;
+                }
+                if(equivalent != (symmetry.canonicalKey(mi) == symmetry.canonicalKey(mj))){
+                    cerr << "inconsistent key. " << mi << " " << mj << " (equivalent = " << equivalent << ")" << endl;
+                    return -1;
+                }
+            }
+        }
+        // ジョーカーを含む着手とパスは他と同一視しない
+        for(int i = 0; i < moves; ++i){
+            const Move mi = buffer[i].mv();
+            if(!mi.isPASS() && !mi.containsJOKER())continue;
+            for(int j = 0; j < moves; ++j){
+                if(i != j && symmetry.canonicalKey(mi) == symmetry.canonicalKey(buffer[j].mv())){
+                    cerr << "special move merged. " << mi << " " << buffer[j].mv() << endl;
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+    
+    dice.srand((unsigned int)time(NULL));
+    
+    std::vector<Cards> sample;
+    for(int i = 0; i < 2000; ++i){
+        int n = dice.rand() % N_MAX_OWNED_CARDS_CHANGE;
+        sample.push_back(pickNBits64(CARDS_ALL, n, N_CARDS - n, &dice));
+    }
+    
+    if(testPermuteCardsSuits(sample)){
+        cerr << "failed suit permutation test." << endl;
+        return -1;
+    }
+    cerr << "passed suit permutation test." << endl;
+    
+    if(testSymmetryInit()){
+        cerr << "failed symmetry init test." << endl;
+        return -1;
+    }
+    cerr << "passed symmetry init test." << endl;
+    
+    if(testCanonicalKey(sample)){
+        cerr << "failed canonical key test." << endl;
+        return -1;
+    }
+    cerr << "passed canonical key test." << endl;
+    
+    return 0;
+}
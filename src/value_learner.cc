@@ -1,18 +1,18 @@
 /*
- pglearner.cc
+ value_learner.cc
  Katsuki Ohto
  */
 
-// 方策関数の学習
+// 順位予測評価関数の学習
+// 棋譜の空場局面から、残っているプレーヤーの実際の上がり順が選ばれやすいように
+// 上がり順を1人ずつの softmax 分類の連続として学習する
 
 #include "include.h"
 #include "structure/log/minLog.hpp"
 
 #include "fuji/fuji.h"
-#include "fuji/policy/changePolicy.hpp"
-#include "fuji/policy/playPolicy.hpp"
-
-#include "fuji/learning/policyGradient.hpp"
+#include "fuji/montecarlo/playout.h"
+#include "fuji/eval/staticEval.hpp"
 
 struct ThreadTools{
     MoveInfo buf[8192];
@@ -28,54 +28,82 @@ using namespace UECda::Fuji;
 
 enum{
     MODE_FLAG_TEST = 1,
-    MODE_FLAG_CHANGE = 2,
-    MODE_FLAG_PLAY = 4,
     MODE_FLAG_SHUFFLE = 8,
 };
 
+using matchRecords_t = MinMatchLogAccessor<MinMatchLog<MinGameLog<MinPlayLog>>, 4096>;
+
 namespace LearningSettings{
     // 学習用パラメータの設定
     constexpr double temperature = 1;
     double learningRate = 0.00005;
-    double attenuatingRate = 0.05;
+    double attenuationRate = 0.00000000005; // 局面数あたり
     double L1Rate = 0;
     double L2Rate = 0.0000001;
-    int batchSize = 8192;
-    int iterations = 200;
+    int batchSize = 1;
+    int iterations = 100;
+    double testRate = 0.77;
+    int minPlies = 0; // この手数より前の局面は使わない
 }
 
-class LearningSpace{
-private:
-    PlayPolicy playPolicy_;
-    ChangePolicy changePolicy_;
-    
-    PlayPolicyLearner playLearner_;
-    ChangePolicyLearner changeLearner_;
-    
-public:
-    auto& playPolicy(int p = 0)noexcept{ return playPolicy_; }
-    auto& changePolicy(int p = 0)noexcept{ return changePolicy_; }
-    auto& playLearner(int p = 0)noexcept{ return playLearner_; }
-    auto& changeLearner(int p = 0)noexcept{ return changeLearner_; }
-    
-    LearningSpace(){
-        playPolicy_.setLearner(&playLearner_);
-        changePolicy_.setLearner(&changeLearner_);
-        
-        playLearner_.setPolicy(&playPolicy_);
-        changeLearner_.setPolicy(&changePolicy_);
-    }
-};
+// 重いのでグローバルに置く
+StaticEvaluator<double> staticEvaluator;
+StaticEvaluatorLearner<double> staticEvaluatorLearner;
 
-LearningSpace ls; // 重いのでグローバルに置く
+template<class gameLog_t, class learner_t, class threadTools_t>
+int learnStaticEvalGame(const gameLog_t& gLog,
+                        const BitSet32 flags,
+                        learner_t *const plearner,
+                        threadTools_t *const ptools){
+    // flags : 0 学習, 1 特徴解析, 2 テスト
+    MoveInfo *const buf = ptools->buf;
+    const auto newClass = gLog.infoNewClass();
+    int plies = 0;
+    Field field;
+    iterateGameLogAfterChange
+    (field, gLog,
+     [](const auto& field)->void{}, // after change callback
+     [&](const auto& field, const Move chosenMove, const uint64_t time)->int{ // play callback
+         // 打ち切りプレイアウトと同じく、3人以上残っている空場の局面を使う
+         if(plies++ < LearningSettings::minPlies){ return 0; }
+         if(!field.isNF() || field.getNAlivePlayers() <= 2){ return 0; }
+         
+         int players[N_PLAYERS];
+         int NPlayers = 0;
+         for(int p = 0; p < N_PLAYERS; ++p){
+             if(field.isAlive(p)){ players[NPlayers++] = p; }
+         }
+         while(NPlayers > 1){
+             // 残りの中で次に上がったプレーヤー
+             int idx = 0;
+             for(int m = 1; m < NPlayers; ++m){
+                 if(newClass.at(players[m]) < newClass.at(players[idx])){ idx = m; }
+             }
+             double score[N_PLAYERS];
+             if(!calcStaticEvalScore<1>(score, players, NPlayers, field, buf, *plearner)){
+                 if(flags.test(1)){ // feed feature value
+                     plearner->feedFeatureValue();
+                 }
+                 if(flags.test(0)){ // learn
+                     plearner->feedSupervisedActionIndex(idx);
+                     plearner->updateParams();
+                 }
+                 if(flags.test(2)){ // test
+                     plearner->feedObjValue(idx);
+                 }
+             }
+             // 上がったプレーヤーを外す
+             for(int m = idx; m < NPlayers - 1; ++m){ players[m] = players[m + 1]; }
+             --NPlayers;
+         }
+         return 0;
+     },
+     [](const auto& field)->void{}); // last callback
+    return 0;
+}
 
 int learn(std::vector<std::string> logFileNames, std::string outDirName, int mode){
     
-    using namespace UECda::Fuji;
-    
-    double testRate = (mode & MODE_FLAG_TEST) ? 0.77 : 0;
-    
-    XorShift64 dice((uint32_t)time(NULL));
     std::mt19937 mt((uint32_t)time(NULL));
     
     ThreadTools *const ptools = &threadTools;
@@ -84,34 +112,28 @@ int learn(std::vector<std::string> logFileNames, std::string outDirName, int mod
         outDirName = DIRECTORY_PARAMS_OUT;
     }
     
-    auto& playPolicy = ls.playPolicy();
-    auto& changePolicy = ls.changePolicy();
-    auto& playLearner = ls.playLearner();
-    auto& changeLearner = ls.changeLearner();
+    auto& learner = staticEvaluatorLearner;
+    learner.setClassifier(&staticEvaluator);
     
     // ログを読み込み
-    MinMatchLogAccessor<MinMatchLog<MinGameLog<MinPlayLog<N_PLAYERS>>>, 2048> mLogs(logFileNames);
- 
+    matchRecords_t mLogs(logFileNames);
+    
     // preparing
-    changeLearner.setLearnParam(LearningSettings::temperature, 0, 0, 0, 0);
-    playLearner.setLearnParam(LearningSettings::temperature, 0, 0, 0, 0);
-
+    learner.setLearnParam(LearningSettings::temperature, 0, 0, 0, 0);
+    
     mLogs.initRandomList();
-    const int games = mLogs.games();
+    const int64_t games = mLogs.games();
     
     // トレーニングとテストの試合数を決める
-    const double learnGameRate = games / (games + pow((double)games, testRate));
-    
-    const int learnGames = min((int)(games * learnGameRate), games);
-    const int testGames = games - learnGames;
+    const double learnGameRate = games / (games + pow((double)games, LearningSettings::testRate));
+    const int64_t learnGames = (mode & MODE_FLAG_TEST) ? min((int64_t)(games * learnGameRate), games) : games;
+    const int64_t testGames = games - learnGames;
     if(mode & MODE_FLAG_SHUFFLE){
         mLogs.shuffleRandomList(0, games, mt);
     }
     
     cerr << learnGames << " games for learning, " << testGames << " games for test." << endl;
-    
-    cerr << "change policy : " << changeLearner.toOverviewString() << endl;
-    cerr << "play   policy : " << playLearner.toOverviewString() << endl;
+    cerr << "static evaluator : " << learner.toOverviewString() << endl;
     
     // 特徴要素の解析(学習時のステップ幅決め)
     cerr << "started analyzing feature." << endl;
@@ -119,75 +141,32 @@ int learn(std::vector<std::string> logFileNames, std::string outDirName, int mod
     BitSet32 flag(0);
     flag.set(1);
     
-    if(mode & MODE_FLAG_CHANGE){
-        // 交換学習データ
-        changeLearner.initFeatureValue();
-        iterateGameRandomly(mLogs, 0, learnGames, [flag, ptools](const auto& gLog, const auto& mLog)->void{
-            PolicyGradient::learnChangeParamsGame(gLog, flag, &ls, ptools); // 特徴解析
-        });
-        changeLearner.closeFeatureValue();
-        changeLearner.foutFeatureSurvey(outDirName + "change_policy_feature_survey.dat");
-        for(int ph = 0; ph < 2; ++ph){
-            cerr << "change - training record : " << changeLearner.toRecordString(ph) << endl;
-        }
-        
-        // 交換テストデータ
-        changeLearner.initFeatureValue();
-        iterateGameRandomly(mLogs, learnGames, games, [flag, ptools](const auto& gLog, const auto& mLog)->void{
-            PolicyGradient::learnChangeParamsGame(gLog, flag, &ls, ptools); // 特徴解析
-        });
-        changeLearner.closeFeatureValue();
-        for(int ph = 0; ph < 2; ++ph){
-            cerr << "change - test     record : " << changeLearner.toRecordString(ph) << endl;
-        }
-    }
-    
-    if(mode & MODE_FLAG_PLAY){
-        // 着手学習データ
-        playLearner.initFeatureValue();
-        iterateGameRandomly(mLogs, 0, learnGames, [flag, ptools](const auto& gLog, const auto& mLog)->void{
-            PolicyGradient::learnPlayParamsGame(gLog, flag, &ls, ptools); // 特徴解析
-        });
-        playLearner.closeFeatureValue();
-        playLearner.foutFeatureSurvey(outDirName + "play_policy_feature_survey.dat");
-        
-        cerr << "play   - training record : " << playLearner.toRecordString() << endl;
-        
-        // 着手テストデータ
-        playLearner.initFeatureValue();
-        iterateGameRandomly(mLogs, learnGames, games, [flag, ptools](const auto& gLog, const auto& mLog)->void{
-            PolicyGradient::learnPlayParamsGame(gLog, flag, &ls, ptools); // 特徴解析
-        });
-        playLearner.closeFeatureValue();
-        cerr << "play   - test     record : " << playLearner.toRecordString() << endl;
-    }
+    learner.initFeatureValue();
+    iterateGameRandomly(mLogs, 0, learnGames, [flag, ptools](const auto& gLog, const auto& mLog)->void{
+        learnStaticEvalGame(gLog, flag, &staticEvaluatorLearner, ptools); // 特徴解析
+    });
+    learner.closeFeatureValue();
+    learner.foutFeatureSurvey(outDirName + "static_eval_feature_survey.dat");
+    cerr << "static eval - training record : " << learner.toRecordString() << endl;
     
     cerr << "finished analyzing feature." << endl;
     
-    //learning
+    // learning
     cerr << "started learning." << endl;
     
-    if(mode & MODE_FLAG_CHANGE){
-        changeLearner.finFeatureSurvey(outDirName + "change_policy_feature_survey.dat");
-    }
-    if(mode & MODE_FLAG_PLAY){
-        playLearner.finFeatureSurvey(outDirName + "play_policy_feature_survey.dat");
-    }
+    learner.finFeatureSurvey(outDirName + "static_eval_feature_survey.dat");
     
-    for (int j = 0; j < LearningSettings::iterations; ++j){
+    int64_t trials = 0;
+    for(int j = 0; j < LearningSettings::iterations; ++j){
         
-        cerr << "iteration " << j << endl;
+        cerr << "iteration " << j << " trials " << trials << endl;
         
-        changeLearner.setLearnParam(LearningSettings::temperature,
-                                    LearningSettings::learningRate * exp(-j * LearningSettings::attenuatingRate),
-                                    LearningSettings::L1Rate * exp(-j * LearningSettings::attenuatingRate),
-                                    LearningSettings::L2Rate * exp(-j * LearningSettings::attenuatingRate),
-                                    LearningSettings::batchSize);
-        playLearner.setLearnParam(LearningSettings::temperature,
-                                  LearningSettings::learningRate * exp(-j * LearningSettings::attenuatingRate),
-                                  LearningSettings::L1Rate * exp(-j * LearningSettings::attenuatingRate),
-                                  LearningSettings::L2Rate * exp(-j * LearningSettings::attenuatingRate),
-                                  LearningSettings::batchSize);
+        const double atr = exp(-trials * LearningSettings::attenuationRate);
+        learner.setLearnParam(LearningSettings::temperature,
+                              LearningSettings::learningRate * atr,
+                              LearningSettings::L1Rate * atr,
+                              LearningSettings::L2Rate * atr,
+                              LearningSettings::batchSize);
         
         if(mode & MODE_FLAG_SHUFFLE){
             mLogs.shuffleRandomList(0, learnGames, mt);
@@ -198,47 +177,23 @@ int learn(std::vector<std::string> logFileNames, std::string outDirName, int mod
         flag.set(2);
         
         // 学習フェーズ
-        if(mode & MODE_FLAG_CHANGE){
-            changeLearner.initObjValue();
-            iterateGameRandomly(mLogs, 0, learnGames, [flag, ptools](const auto& gLog, const auto& mLog)->void{
-                PolicyGradient::learnChangeParamsGame(gLog, flag, &ls, ptools); // 学習
-            });
-            changePolicy.fout(outDirName + "change_policy_param.dat");
-            foutComment(changePolicy, outDirName + "change_policy_comment.txt");
-            for(int ph = 0; ph < 2; ++ph){
-                cerr << "Change Training : " << changeLearner.toObjValueString(ph) << endl;
-            }
-        }
-        if(mode & MODE_FLAG_PLAY){
-            playLearner.initObjValue();
-            iterateGameRandomly(mLogs, 0, learnGames, [flag, ptools](const auto& gLog, const auto& mLog)->void{
-                PolicyGradient::learnPlayParamsGame(gLog, flag, &ls, ptools); // 学習
-            });
-            playPolicy.fout(outDirName + "play_policy_param.dat");
-            foutComment(playPolicy, outDirName + "play_policy_comment.txt");
-            cerr << "Play   Training : " << playLearner.toObjValueString() << endl;
-        }
+        learner.initObjValue();
+        iterateGameRandomly(mLogs, 0, learnGames, [flag, ptools](const auto& gLog, const auto& mLog)->void{
+            learnStaticEvalGame(gLog, flag, &staticEvaluatorLearner, ptools); // 学習
+        });
+        trials += learner.trials();
+        staticEvaluator.fout(outDirName + "static_eval_param.dat");
+        foutComment(staticEvaluator, outDirName + "static_eval_comment.txt");
+        cerr << "Static Eval Training : " << learner.toObjValueString() << endl;
         
         if(testGames > 0){
             // テストフェーズ
             flag.reset(0);
-            
-            if(mode & MODE_FLAG_CHANGE){
-                changeLearner.initObjValue();
-                iterateGameRandomly(mLogs, learnGames, games, [flag, ptools](const auto& gLog, const auto& mLog)->void{
-                    PolicyGradient::learnChangeParamsGame(gLog, flag, &ls, ptools); // テスト
-                });
-                for(int ph = 0; ph < 2; ++ph){
-                    cerr << "Change Test     : " << changeLearner.toObjValueString(ph) << endl;
-                }
-            }
-            if(mode & MODE_FLAG_PLAY){
-                playLearner.initObjValue();
-                iterateGameRandomly(mLogs, learnGames, games, [flag, ptools](const auto& gLog, const auto& mLog)->void{
-                    PolicyGradient::learnPlayParamsGame(gLog, flag, &ls, ptools); // テスト
-                });
-                cerr << "Play   Test     : " << playLearner.toObjValueString() << endl;
-            }
+            learner.initObjValue();
+            iterateGameRandomly(mLogs, learnGames, games, [flag, ptools](const auto& gLog, const auto& mLog)->void{
+                learnStaticEvalGame(gLog, flag, &staticEvaluatorLearner, ptools); // テスト
+            });
+            cerr << "Static Eval Test     : " << learner.toObjValueString() << endl;
         }
     }
     cerr << "finished learning." << endl;
@@ -246,7 +201,7 @@ int learn(std::vector<std::string> logFileNames, std::string outDirName, int mod
     return 0;
 }
 
-int main(int argc, char* argv[]){ // For UECda
+int main(int argc, char* argv[]){
     
     // 基本的な初期化
     setvbuf(stdout, NULL, _IONBF, 0);
@@ -264,14 +219,10 @@ int main(int argc, char* argv[]){ // For UECda
     std::vector<std::string> logFileNames;
     std::string outDirName = "";
     
-    int mode = MODE_FLAG_CHANGE | MODE_FLAG_PLAY | MODE_FLAG_SHUFFLE;
+    int mode = MODE_FLAG_SHUFFLE;
     for(int c = 1; c < argc; ++c){
         if(!strcmp(argv[c], "-t")){
             mode |= MODE_FLAG_TEST;
-        }else if(!strcmp(argv[c], "-c")){
-            mode &= (~MODE_FLAG_PLAY);
-        }else if(!strcmp(argv[c], "-p")){
-            mode &= (~MODE_FLAG_CHANGE);
         }else if(!strcmp(argv[c], "-i")){
             LearningSettings::iterations = atoi(argv[c + 1]);
         }else if(!strcmp(argv[c], "-l")){
@@ -284,9 +235,13 @@ int main(int argc, char* argv[]){ // For UECda
         }else if(!strcmp(argv[c], "-f")){
             mode &= (~MODE_FLAG_SHUFFLE);
         }else if(!strcmp(argv[c], "-ar")){
-            LearningSettings::attenuatingRate = atof(argv[c + 1]);
+            LearningSettings::attenuationRate = atof(argv[c + 1]);
         }else if(!strcmp(argv[c], "-lr")){
             LearningSettings::learningRate = atof(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-bs")){
+            LearningSettings::batchSize = atoi(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-mp")){ // 学習に使う最小手数(打ち切り手数に合わせる)
+            LearningSettings::minPlies = atoi(argv[c + 1]);
         }
     }
     